@@ -340,6 +340,9 @@ static err_t gdb_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
 
 	memset(state, 0, sizeof(struct gdb_state));
 
+	/* Every packet is a round trip, with the debugger waiting on it. */
+	tcp_nagle_disable(pcb);
+
 	tcp_arg(pcb, state);
 	tcp_recv(pcb, gdb_recv);
 	tcp_sent(pcb, gdb_sent);
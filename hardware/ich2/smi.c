@@ -16,6 +16,7 @@
 #include <vga-overlay.h>
 #include <reg-82801b.h>
 #include <output.h>
+#include <profile.h>
 
 static smi_handler_t _handlers[SMI_EVENT_MAX] = {0};
 
@@ -54,6 +55,15 @@ unsigned long smi_status()
 	return inl(smi_sts);
 }
 
+/* Run the handler for ev, charging the time so far to smi_poll itself
+ * and the rest to the handler. */
+static void _dispatch(smi_event_t ev)
+{
+	PROF_MARK(PROF_SMI_POLL);
+	_handlers[ev](ev);
+	PROF_MARK(PROF_SMI_HANDLER(ev));
+}
+
 void smi_poll()
 {
 	unsigned long sts = smi_status();
@@ -63,7 +73,7 @@ void smi_poll()
 		if (_handlers[SMI_EVENT_GBL_RLS] == SMI_HANDLER_NONE)
 			output("Unhandled: BIOS_STS");
 		else if (_handlers[SMI_EVENT_GBL_RLS] != SMI_HANDLER_IGNORE)
-			_handlers[SMI_EVENT_GBL_RLS](SMI_EVENT_GBL_RLS);
+			_dispatch(SMI_EVENT_GBL_RLS);
 		outl(_get_PMBASE() + ICH2_PMBASE_SMI_STS, ICH2_SMI_STS_BIOS_STS);
 	}
 	
@@ -90,7 +100,7 @@ void smi_poll()
 		if (_handlers[SMI_EVENT_FAST_TIMER] == SMI_HANDLER_NONE)
 			output("Unhandled: SWSMI_TMR_STS");
 		else if (_handlers[SMI_EVENT_FAST_TIMER] != SMI_HANDLER_IGNORE)
-			_handlers[SMI_EVENT_FAST_TIMER](SMI_EVENT_FAST_TIMER);
+			_dispatch(SMI_EVENT_FAST_TIMER);
 		outl(_get_PMBASE() + ICH2_PMBASE_SMI_STS, ICH2_SMI_STS_SWSMI_TMR_STS);
 	}
 	
@@ -111,7 +121,7 @@ void smi_poll()
 			if (_handlers[SMI_EVENT_PWRBTN] == SMI_HANDLER_NONE)
 				output("Unhandled: PM1_STS: PWRBTN_STS");
 			else if (_handlers[SMI_EVENT_FAST_TIMER] != SMI_HANDLER_IGNORE)
-				_handlers[SMI_EVENT_PWRBTN](SMI_EVENT_PWRBTN);
+				_dispatch(SMI_EVENT_PWRBTN);
 			outw(_get_PMBASE() + ICH2_PMBASE_PM1_STS, ICH2_PM1_STS_PWRBTN_STS);
 		}
 		
@@ -159,7 +169,7 @@ void smi_poll()
 			if (_handlers[SMI_EVENT_DEVTRAP_KBC] == SMI_HANDLER_NONE)
 				output("Unhandled: DEVACT_KBC_ACT_STS");
 			else if (_handlers[SMI_EVENT_DEVTRAP_KBC] != SMI_HANDLER_IGNORE)
-				_handlers[SMI_EVENT_DEVTRAP_KBC](SMI_EVENT_DEVTRAP_KBC);
+				_dispatch(SMI_EVENT_DEVTRAP_KBC);
 			outl(_get_PMBASE() + ICH2_PMBASE_DEVACT_STS, ICH2_DEVACT_STS_KBC_ACT_STS);
 		}
 		
@@ -207,6 +217,49 @@ void smi_poll()
 			ICH2_SMI_EN_GBL_SMI_EN);
 }
 
+/* Every SMI_STS bit that smi_poll() does something about. */
+#define SMI_STS_HANDLED	(ICH2_SMI_STS_BIOS_STS | ICH2_SMI_STS_LEGACY_USB_STS \
+	| ICH2_SMI_STS_SLP_SMI_STS | ICH2_SMI_STS_APM_STS \
+	| ICH2_SMI_STS_SWSMI_TMR_STS | ICH2_SMI_STS_PM1_STS_REG \
+	| ICH2_SMI_STS_GPE0_STS | ICH2_SMI_STS_GPE1_STS \
+	| ICH2_SMI_STS_MCSMI_STS | ICH2_SMI_STS_DEVMON_STS \
+	| ICH2_SMI_STS_TCO_STS | ICH2_SMI_STS_PERIODIC_STS \
+	| ICH2_SMI_STS_SERIRQ_SMI_STS | ICH2_SMI_STS_SMBUS_SMI_STS)
+
+int smi_poll_idle()
+{
+	unsigned long sts = smi_status();
+	unsigned short pm1;
+
+	/* PM1_STS_REG can be left standing by PM1 events that we never
+	 * enabled, and smi_poll() would not do anything about those. */
+	if (sts & ICH2_SMI_STS_PM1_STS_REG)
+	{
+		pm1 = inw(_get_PMBASE() + ICH2_PMBASE_PM1_STS)
+		      & inw(_get_PMBASE() + ICH2_PMBASE_PM1_EN);
+		if (pm1)
+			return 0;
+		sts &= ~ICH2_SMI_STS_PM1_STS_REG;
+	}
+
+	if ((sts & SMI_STS_HANDLED) != ICH2_SMI_STS_SWSMI_TMR_STS
+	    || _handlers[SMI_EVENT_FAST_TIMER] == SMI_HANDLER_NONE
+	    || _handlers[SMI_EVENT_FAST_TIMER] == SMI_HANDLER_IGNORE)
+		return 0;
+
+	/* What timer_handler() and smi_poll() would have done: the
+	 * software SMI timer is one-shot, and restarts when re-enabled. */
+	smi_disable_event(SMI_EVENT_FAST_TIMER);
+	smi_enable_event(SMI_EVENT_FAST_TIMER);
+	outl(_get_PMBASE() + ICH2_PMBASE_SMI_STS, ICH2_SMI_STS_SWSMI_TMR_STS);
+
+	outl(_get_PMBASE() + ICH2_PMBASE_SMI_EN,
+		inl(_get_PMBASE() + ICH2_PMBASE_SMI_EN) |
+			ICH2_SMI_EN_EOS |
+			ICH2_SMI_EN_GBL_SMI_EN);
+	return 1;
+}
+
 int smi_register_handler(smi_event_t ev, smi_handler_t hnd)
 {
 	if (ev >= SMI_EVENT_MAX)
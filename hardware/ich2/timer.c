@@ -10,6 +10,8 @@
 
 #include <pci.h>
 #include <io.h>
+#include <smi.h>
+#include <timer.h>
 #include <reg-82801b.h>
 
 static uint16_t _get_PMBASE()
@@ -49,3 +51,24 @@ int oneshot_running(void)
 	endtmr = starttmr = 0;
 	return 0;
 }
+
+/* Count TSC ticks across 10ms of the PM timer.  Waiting for an edge of
+ * the PM timer first means that the measurement is good to one PM timer
+ * tick (280ns), and keeping it to 10ms keeps the TSC difference well
+ * inside 32 bits. */
+#define CALIBRATE_MS	10
+
+void tsc_calibrate(void)
+{
+	unsigned long t0, t, tsc0;
+
+	t0 = _curtmr();
+	while ((t = _curtmr()) == t0)
+		;
+	tsc0 = rdtsc();
+	while (((_curtmr() - t) & 0xFFFFFF) < (ICH2_PM1_TMR_FREQ / 1000) * CALIBRATE_MS)
+		;
+	tsc_per_ms = (rdtsc() - tsc0) / CALIBRATE_MS;
+	if (tsc_per_ms == 0)
+		tsc_per_ms = 1;
+}
@@ -35,12 +35,14 @@
 
 #include "etherboot-compat.h"
 #include "net.h"
+#include "lwip/netif.h"
 #include <timer.h>
 #include <io.h>
 #include <pci.h>
 #include <pci-bother.h>
 #include <minilib.h>
 #include <output.h>
+#include <trace.h>
 #include <paging.h>
 
 #define	XCVR_MAGIC	(0x5A00)
@@ -215,19 +217,6 @@ typedef struct {
 	unsigned int len;
 } segment_t __attribute__ ((aligned(8)));
 
-typedef struct {
-	unsigned int next;
-	unsigned int hdr;
-	segment_t segments[64 /* XXX magic */];
-} txdesc_t __attribute__ ((aligned(8)));
-
-/*** RX descriptor ***/
-typedef struct {
-	unsigned int	next;
-	unsigned int	status;
-	segment_t segments[64];
-} rxdesc_t __attribute__ ((aligned(8)));
-
 typedef struct {
 	struct nic nic;
 	int is3c556;
@@ -359,66 +348,70 @@ static void _reset(nic_3c90x_t *nic)
 
 /***************************** Transmit routines *****************************/
 
-#define XMIT_BUFS 8
+/* The transmit ring is never waited on.  _transmit only fills in
+ * descriptors; they are handed to the card in one go by _tx_flush, at the
+ * end of each poll, so that a burst of packets costs one DnListPtr kick.
+ * Descriptors are reclaimed as the card marks them done; if the ring is
+ * full, the packet goes back to lwIP as ERR_MEM, and TCP will try again.
+ */
+#define XMIT_BUFS 32	/* Must be a power of two. */
+#define XMIT_SEGS 8	/* Longer pbuf chains get flattened. */
+
+#define TXHDR_DNCOMPLETE	(1 << 16)	/* 905B only */
+#define TXHDR_ADD_IP_CKSUM	(1 << 25)	/* 905B only */
+#define TXHDR_ADD_TCP_CKSUM	(1 << 26)	/* 905B only */
+#define TXHDR_ADD_UDP_CKSUM	(1 << 27)	/* 905B only */
+#define TXSEG_LAST		(1 << 31)
+
+typedef struct {
+	unsigned int next;
+	unsigned int hdr;
+	segment_t segments[XMIT_SEGS];
+} txdesc_t __attribute__ ((aligned(8)));
 
 static txdesc_t txdescs[XMIT_BUFS];
 static struct pbuf *txpbufs[XMIT_BUFS] = {0,};
 
-/* txcons is the index into the ring buffer of the last packet that the
- * 3c90x was seen processing, or -1 if the 3c90x was idle.
+/* Free-running counters; take them modulo XMIT_BUFS to index the ring.
+ * txtail <= txkick <= txhead: [txtail, txkick) belong to the card, and
+ * [txkick, txhead) are filled in but have not been handed over yet.
  */
-static int txcons = -1;
+static unsigned int txtail = 0;
+static unsigned int txkick = 0;
+static unsigned int txhead = 0;
 
-/* txprod is the index of the _next_ buffer that the driver will write into. */
-static int txprod = 0;
+#define TXD(i)	(&txdescs[(i) % XMIT_BUFS])
 
-/* _transmit adds a packet to the transmit ring buffer.  If no space is
- * available in the buffer, then _transmit blocks until a packet has been
- * transmitted.
- */
-static void _transmit(struct nic *_nic, struct pbuf *p)
+/* Free whatever the card has finished downloading. */
+static void _tx_reclaim(nic_3c90x_t *nic)
 {
-	nic_3c90x_t *nic = (nic_3c90x_t *)_nic;
+	unsigned long curp = 0;
 	unsigned char status;
-	int len, n;
-	
-	/* Wait for there to be space. */
-	if (txcons == txprod)
-	{
-		int i = 0;
-		
-		outputf("3c90x: txbuf full, waiting for space...");
-		while (_inl(nic, regDnListPtr_l) != 0)
-			i++;
-		outputf("3c90x: took %d iters", i);
-	}
-	
-	/* Stall the download engine so it doesn't bother us. */
-	_issue_command(nic, cmdStallCtl, 2 /* Stall download */);
-	
-	/* Clean up old txcons. */
-	if (txcons != -1)
+	int i;
+
+	if (txtail == txkick)
+		return;
+
+	/* The original 905 has no per-descriptor completion bit, so we
+	 * have to ask where the download engine is. */
+	if (!nic->isBrev)
+		curp = _inl(nic, regDnListPtr_l);
+
+	while (txtail != txkick)
 	{
-		unsigned long curp = _inl(nic, regDnListPtr_l);
-		int end;
-		
-		if (curp == 0)
-			end = txprod;
-		else
-			end = (curp - v2p(txdescs)) / sizeof(txdescs[0]);
-		
-		while (txcons != end)
-		{
-			pbuf_free(txpbufs[txcons]);
-			txpbufs[txcons] = NULL;
-			txdescs[txcons].hdr = 0;
-			txdescs[txcons].next = 0;
-			txcons = (txcons + 1) % XMIT_BUFS;
-		}
-		if (txcons == txprod)
-			txcons = -1;
+		i = txtail % XMIT_BUFS;
+		if (nic->isBrev
+		    ? !(txdescs[i].hdr & TXHDR_DNCOMPLETE)
+		    : (curp == v2p(&txdescs[i])))
+			break;
+
+		/* Leave the link alone; the card may not have followed
+		 * it yet. */
+		pbuf_free(txpbufs[i]);
+		txpbufs[i] = NULL;
+		txtail++;
 	}
-	
+
 	/* Look at the TX status */
 	status = _inb(nic, regTxStatus_b);
 	if (status)
@@ -426,187 +419,329 @@ static void _transmit(struct nic *_nic, struct pbuf *p)
 		outputf("3c90x: error: the nus.");
 		_outb(nic, regTxStatus_b, 0x00);
 	}
+}
+
+/* Hand everything that has been queued since the last flush to the card. */
+static void _tx_kick(nic_3c90x_t *nic)
+{
+	if (txkick == txhead)
+		return;
+
+	/* The new descriptors are already linked to each other; they just
+	 * need to be hooked on to the end of what the card has. */
+	if (_inl(nic, regDnListPtr_l) == 0)
+		_outl(nic, regDnListPtr_l, v2p(TXD(txkick)));
+	else
+	{
+		/* Stall the download engine so it doesn't read the link
+		 * while we change it, and check that it didn't run dry
+		 * in the meantime. */
+		_issue_command(nic, cmdStallCtl, 2 /* Stall download */);
+		TXD(txkick - 1)->next = v2p(TXD(txkick));
+		if (_inl(nic, regDnListPtr_l) == 0)
+			_outl(nic, regDnListPtr_l, v2p(TXD(txkick)));
+		_issue_command(nic, cmdStallCtl, 3 /* Unstall download */);
+	}
+
+	txkick = txhead;
+}
+
+/* The 905B fills in checksums itself, if it is told which ones the frame
+ * has; lwIP leaves them zero (see _probe).  A UDP fragment gets no UDP
+ * checksum at all, which is legal, rather than a wrong one.
+ */
+static unsigned int _tx_cksum_flags(struct pbuf *p)
+{
+	unsigned char *f = p->payload;
+	unsigned int flags;
+
+	if (p->len < 14 + 20 || f[12] != 0x08 || f[13] != 0x00)
+		return 0;
+
+	flags = TXHDR_ADD_IP_CKSUM;
+	if ((f[14 + 6] & 0x3F) || f[14 + 7])	/* MF, or an offset */
+		return flags;
+
+	switch (f[14 + 9])
+	{
+	case 6:
+		flags |= TXHDR_ADD_TCP_CKSUM;
+		break;
+	case 17:
+		flags |= TXHDR_ADD_UDP_CKSUM;
+		break;
+	}
+	return flags;
+}
+
+static void _tx_flush(struct nic *_nic)
+{
+	nic_3c90x_t *nic = (nic_3c90x_t *)_nic;
+
+	_tx_reclaim(nic);
+	_tx_kick(nic);
+}
+
+/* _transmit adds a packet to the transmit ring buffer.  If no space is
+ * available, it returns -1 rather than waiting for some.
+ */
+static int _transmit(struct nic *_nic, struct pbuf *p)
+{
+	nic_3c90x_t *nic = (nic_3c90x_t *)_nic;
+	txdesc_t *desc;
+	struct pbuf *q;
+	unsigned int cksum;
+	int len, n;
+
+	if ((txhead - txtail) == XMIT_BUFS)
+	{
+		/* Anything that's done yet? */
+		_tx_kick(nic);
+		_tx_reclaim(nic);
+		if ((txhead - txtail) == XMIT_BUFS)
+			return -1;
+	}
+
+	if (pbuf_clen(p) > XMIT_SEGS)
+	{
+		q = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_RAM);
+		if (!q)
+			return -1;
+		pbuf_copy(q, p);
+		p = q;
+	} else
+		pbuf_ref(p);
 
 	/* Set up the new txdesc. */
-	txdescs[txprod].next = 0;
+	desc = TXD(txhead);
+	txpbufs[txhead % XMIT_BUFS] = p;
+	cksum = nic->isBrev ? _tx_cksum_flags(p) : 0;
 	len = 0;
 	n = 0;
-	txpbufs[txprod] = p;
-	pbuf_ref(p);
 	for (; p; p = p->next)
 	{
-		txdescs[txprod].segments[n].addr = v2p(p->payload);
-		txdescs[txprod].segments[n].len = p->len | (p->next ? 0 : (1 << 31));
+		desc->segments[n].addr = v2p(p->payload);
+		desc->segments[n].len = p->len | (p->next ? 0 : TXSEG_LAST);
 		len += p->len;
 		n++;
 	}
-	txdescs[txprod].hdr = len;	/* If we wanted completion notification, bit 15 */
-	
-	/* Now link the new one in, after it's been set up. */
-	txdescs[(txprod + XMIT_BUFS - 1) % XMIT_BUFS].next = v2p(&(txdescs[txprod]));
-	
-	/* If the card is stopped, start it up again. */
-	if (_inl(nic, regDnListPtr_l) == 0)
-	{
-		_outl(nic, regDnListPtr_l, v2p(&(txdescs[txprod])));
-		txcons = txprod;
-	}
-	
-	txprod = (txprod + 1) % XMIT_BUFS;
-	
-	/* And let it proceed on its way. */
-	_issue_command(nic, cmdStallCtl, 3 /* Unstall download */);
+	desc->hdr = len | cksum;	/* If we wanted completion notification, bit 15 */
+	desc->next = 0;
 
-#if 0		
-	/** successful completion (sans "interrupt Requested" bit) **/
-	if ((status & 0xbf) == 0x80)
-		return;
+	/* Chain it on to the batch, which the card can't see yet. */
+	if (txhead != txkick)
+		TXD(txhead - 1)->next = v2p(desc);
+	txhead++;
 
-	outputf("3c90x: Status (%hhX)", status);
-	/** check error codes **/
-	if (status & 0x02)
-	{
-		outputf("3c90x: Tx Reclaim Error (%hhX)", status);
-		_reset(nic);
-	} else if (status & 0x04) {
-		outputf("3c90x: Tx Status Overflow (%hhX)", status);
-		for (i=0; i<32; i++)
-			_outb(nic, regTxStatus_b, 0x00);
-		/** must re-enable after max collisions before re-issuing tx **/
-		_issue_command(nic, cmdTxEnable, 0);
-	} else if (status & 0x08) {
-		outputf("3c90x: Tx Max Collisions (%hhX)", status);
-		/** must re-enable after max collisions before re-issuing tx **/
-		_issue_command(nic, cmdTxEnable, 0);
-	} else if (status & 0x10) {
-		outputf("3c90x: Tx Underrun (%hhX)", status);
-		_reset(nic);
-	} else if (status & 0x20) {
-		outputf("3c90x: Tx Jabber (%hhX)", status);
-		_reset(nic);
-	} else if ((status & 0x80) != 0x80) {
-		outputf("3c90x: Internal Error - Incomplete Transmission (%hhX)", status);
-		_reset(nic);
-	}
-#endif
+	return 0;
 }
 
 /***************************** Receive routines *****************************/
-#define MAX_RECV_SIZE 1536
-#define RECV_BUFS 32
+
+/* Every receive descriptor points at one full-frame buffer from rxpool
+ * (which is net.c's receive arena, and sets how many we can have), so
+ * the card never has to scatter a packet, and the ring is a fixed circle
+ * that is set up once.  A big packet is handed to lwIP in its own buffer,
+ * as a custom pbuf, and a spare from rxfree takes its place in the ring;
+ * the buffer comes back to rxfree when lwIP frees the pbuf.  Small packets
+ * (and big ones, if we are out of spares) are copied out instead, and the
+ * buffer stays where it is.
+ */
+#define MAX_RECV_SIZE 1536	/* A multiple of the cache line size. */
+#define RECV_BUFS 24
+#define RECV_SPARE_BUFS 8
+#define RECV_COPYBREAK 256
+
+#define RXSTAT_LEN_MASK		0x1FFF
+#define RXSTAT_ERROR		(1 << 14)
+#define RXSTAT_COMPLETE		(1 << 15)
+#define RXSTAT_IP_CKSUM_ERR	(1 << 25)	/* 905B only, as are the rest */
+#define RXSTAT_TCP_CKSUM_ERR	(1 << 26)
+#define RXSTAT_UDP_CKSUM_ERR	(1 << 27)
+#define RXSTAT_IP_CKSUM_OK	(1 << 29)
+#define RXSTAT_TCP_CKSUM_OK	(1 << 30)
+#define RXSTAT_UDP_CKSUM_OK	(1 << 31)
+#define RXSTAT_CKSUM_MASK	0xEE000000
+#define RXSEG_LAST		(1 << 31)
+
+/*** RX descriptor ***/
+typedef struct {
+	unsigned int	next;
+	unsigned int	status;
+	segment_t segment;
+} rxdesc_t __attribute__ ((aligned(8)));
+
+/* The pbuf goes in front of the data, so that lwIP sees a PBUF_POOL
+ * layout and will let pbuf_header() move back over headers that it has
+ * stripped; ICMP echo builds its reply that way.  (A PBUF_REF could only
+ * ever shrink.) */
+struct rxbuf {
+	struct pbuf_custom pc;
+	unsigned char data[MAX_RECV_SIZE] __attribute__ ((aligned(32)));
+} __attribute__ ((aligned(32)));
 
 static rxdesc_t rxdescs[RECV_BUFS];
-static struct pbuf *rxpbufs[RECV_BUFS] = {0,};
+static struct rxbuf *rxbufs[RECV_BUFS];
+
+static struct rxbuf *rxpool;	/* RECV_BUFS + RECV_SPARE_BUFS of them */
+static struct rxbuf *rxfree[RECV_SPARE_BUFS];
+static int rxnfree = 0;
 
 /* rxcons is the pointer to the receive descriptor that the ethernet card will
  * write into next.
  */
 static int rxcons = 0;
 
-/* rxprod is the pointer to the receive descriptor that the driver will
- * allocate next.
- */
-static int rxprod = 0;
+static void _rxbuf_free(struct pbuf *p)
+{
+	struct rxbuf *b = (struct rxbuf *)
+		((char *)p - __builtin_offsetof(struct rxbuf, pc));
 
-/* _recv_prepare fills the 3c90x's ring buffer with fresh pbufs from lwIP.
- * The upload engine need not be stalled.
- */
-static void _recv_prepare(nic_3c90x_t *nic)
+	rxfree[rxnfree++] = b;
+}
+
+static void _rx_arm(int i, struct rxbuf *b)
+{
+	rxbufs[i] = b;
+	rxdescs[i].segment.addr = v2p(b->data);
+	rxdescs[i].segment.len = MAX_RECV_SIZE | RXSEG_LAST;
+	rxdescs[i].status = 0;
+}
+
+/* _recv_init sets up the ring, and points the card at it. */
+static void _recv_init(nic_3c90x_t *nic)
 {
-	int oldprod;
+	int i;
 
-	oldprod = rxprod;
-	while ((rxprod != rxcons) || !rxpbufs[rxprod])
+	for (i = 0; i < RECV_BUFS; i++)
 	{
-		int i;
-		struct pbuf *p;
-		
-		if (!rxpbufs[rxprod])
-			rxpbufs[rxprod] = p = pbuf_alloc(PBUF_RAW, MAX_RECV_SIZE, PBUF_POOL);
-		else {
-			outputf("WARNING: 3c90x has pbuf in slot %d", rxprod);
-			p = rxpbufs[rxprod];
-		}
-		
-		if (!p)
-		{
-			outputf("3c90x: out of memory for rx pbuf?");
-			break;
-		}
-		
-		rxdescs[rxprod].status = 0;
-		rxdescs[rxprod].next = 0;
-		for (i = 0; p; p = p->next, i++)
-		{
-			rxdescs[rxprod].segments[i].addr = v2p(p->payload);
-			rxdescs[rxprod].segments[i].len = p->len | (p->next ? 0 : (1 << 31));
-		}
-		
-		/* Hook in the new one after and only after it's been fully set up. */
-		rxdescs[(rxprod + RECV_BUFS - 1) % RECV_BUFS].next = v2p(&(rxdescs[rxprod]));
-		rxprod = (rxprod + 1) % RECV_BUFS;
+		_rx_arm(i, &rxpool[i]);
+		rxdescs[i].next = v2p(&rxdescs[(i + 1) % RECV_BUFS]);
 	}
-	
-	if (_inl(nic, regUpListPtr_l) == 0 && rxpbufs[oldprod])	/* Ran out of shit, and got new shit? */
+	for (i = 0; i < RECV_SPARE_BUFS; i++)
+		rxfree[i] = &rxpool[RECV_BUFS + i];
+	rxnfree = RECV_SPARE_BUFS;
+
+	rxcons = 0;
+	_outl(nic, regUpListPtr_l, v2p(&rxdescs[0]));
+}
+
+/* Get the packet in slot i out into a pbuf, leaving the slot ready for
+ * the card again. */
+static struct pbuf *_recv_take(int i, int len, u8_t flags)
+{
+	struct rxbuf *b = rxbufs[i];
+	struct pbuf *p, *q;
+	int off = 0;
+
+	if (len > RECV_COPYBREAK && rxnfree > 0)
 	{
-		_outl(nic, regUpListPtr_l, v2p(&rxdescs[oldprod]));
-		outputf("3c90x: WARNING: Ran out of rx slots");
+		p = &b->pc.pbuf;
+		p->next = NULL;
+		p->payload = b->data;
+		p->tot_len = p->len = len;
+		p->type = PBUF_POOL;
+		p->flags = PBUF_FLAG_IS_CUSTOM | flags;
+		p->ref = 1;
+		b->pc.custom_free_function = _rxbuf_free;
+
+		_rx_arm(i, rxfree[--rxnfree]);
+		return p;
 	}
-	
-	_issue_command(nic, cmdStallCtl, 1 /* Unstall upload */);
+
+	p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+	if (!p)
+		outputf("3c90x: out of memory for rx pbuf?");
+	else
+		p->flags |= flags;
+	for (q = p; q; q = q->next)
+	{
+		memcpy(q->payload, b->data + off, q->len);
+		off += q->len;
+	}
+
+	rxdescs[i].status = 0;
+	return p;
+}
+
+/* Only a frame that the card says is a good IP packet with a good TCP or
+ * UDP checksum gets to skip lwIP's own checks.  Anything else -- errors
+ * included -- is left for lwIP to look at, and to count if it is bad.
+ */
+static u8_t _rx_cksum_flags(unsigned int status)
+{
+	status &= RXSTAT_CKSUM_MASK;
+	if (status == (RXSTAT_IP_CKSUM_OK | RXSTAT_TCP_CKSUM_OK) ||
+	    status == (RXSTAT_IP_CKSUM_OK | RXSTAT_UDP_CKSUM_OK))
+		return PBUF_FLAG_CHKSUM_OK;
+	return 0;
 }
 
 /* _recv polls the ring buffer to see if any packets are available.  If any 
- * are, then eth_recv is called for each available.  _recv returns how many
- * packets it received successfully.  Whether _recv got any packets or not,
- * _recv does not block, and reinitializes the ring buffer with fresh pbufs.
+ * are, then eth_recv is called for each, up to budget of them.  _recv
+ * returns how many descriptors it consumed, bad packets included.  _recv
+ * does not block.
  */
-static int _recv(struct nic *_nic)
+static int _recv(struct nic *_nic, int budget)
 {
 	nic_3c90x_t *nic = (nic_3c90x_t *)_nic;
-	int errcode, n = 0;
+	int errcode, consumed = 0;
+	unsigned int status;
 	struct pbuf *p;
 	
 	/* Nothing to do? */
-	while ((rxdescs[rxcons].status & ((1<<14) | (1<<15))) != 0)
+	while (consumed < budget
+	       && (rxdescs[rxcons].status & (RXSTAT_ERROR | RXSTAT_COMPLETE)) != 0)
 	{
+		consumed++;
+
 		/** Check for Error (else we have good packet) **/
-		if (rxdescs[rxcons].status & (1<<14))
+		if (rxdescs[rxcons].status & RXSTAT_ERROR)
 		{
 			errcode = rxdescs[rxcons].status;
 			if (errcode & (1<<16))
-				outputf("3C90X: Rx Overrun (%hX)",errcode>>16);
+				TRACE(TRACE_WARN, "3C90X: Rx Overrun (%hX)",errcode>>16);
 			else if (errcode & (1<<17))
-				outputf("3C90X: Runt Frame (%hX)",errcode>>16);
+				TRACE(TRACE_WARN, "3C90X: Runt Frame (%hX)",errcode>>16);
 			else if (errcode & (1<<18))
-				outputf("3C90X: Alignment Error (%hX)",errcode>>16);
+				TRACE(TRACE_WARN, "3C90X: Alignment Error (%hX)",errcode>>16);
 			else if (errcode & (1<<19))
-				outputf("3C90X: CRC Error (%hX)",errcode>>16);
+				TRACE(TRACE_WARN, "3C90X: CRC Error (%hX)",errcode>>16);
 			else if (errcode & (1<<20))
-				outputf("3C90X: Oversized Frame (%hX)",errcode>>16);
+				TRACE(TRACE_WARN, "3C90X: Oversized Frame (%hX)",errcode>>16);
 			else
-				outputf("3C90X: Packet error (%hX)",errcode>>16);
+				TRACE(TRACE_WARN, "3C90X: Packet error (%hX)",errcode>>16);
 		
-			p = NULL;	
-			pbuf_free(rxpbufs[rxcons]);		/* Bounce the old one before setting it up again. */
+			p = NULL;
+			rxdescs[rxcons].status = 0;
 		} else {
-			p = rxpbufs[rxcons];
-			pbuf_realloc(p, rxdescs[rxcons].status & 0x1FFF);	/* Resize the packet to how large it actually is. */
+			status = rxdescs[rxcons].status;
+			p = _recv_take(rxcons, status & RXSTAT_LEN_MASK,
+			               nic->isBrev ? _rx_cksum_flags(status) : 0);
 		}
 		
-		rxpbufs[rxcons] = NULL;
-		rxdescs[rxcons].status = 0; 
 		rxcons = (rxcons + 1) % RECV_BUFS;
 		
 		if (p)
-		{
 			eth_recv(_nic, p);
-			n++;
-		}
 	}
 
-	_recv_prepare(nic);	/* Light the NIC up again. */
-	return n;
+	/* The card stalls if it catches up with us; it can carry on now. */
+	if (consumed)
+		_issue_command(nic, cmdStallCtl, 1 /* Unstall upload */);
+	return consumed;
+}
+
+static void _pending(struct nic *_nic, int *rx, int *tx)
+{
+	int i;
+
+	for (i = 0; i < RECV_BUFS; i++)
+		if (!(rxdescs[(rxcons + i) % RECV_BUFS].status
+		      & (RXSTAT_ERROR | RXSTAT_COMPLETE)))
+			break;
+	*rx = i;
+	*tx = txhead - txtail;
 }
 
 /*** a3c90x_probe: exported routine to probe for the 3c905 card and perform
@@ -637,6 +772,13 @@ static int _probe(struct pci_dev *pci, void *data)
 		outputf("3c90x: Unable to find I/O address");
 		return 0;
 	}
+
+	rxpool = eth_rx_arena(sizeof(struct rxbuf) * (RECV_BUFS + RECV_SPARE_BUFS));
+	if (!rxpool)
+	{
+		outputf("3c90x: no receive buffers to be had");
+		return 0;
+	}
     
 	/* Power it on */
 	pci_write16(pci->bus, pci->dev, pci->fn, 0xE0,
@@ -799,8 +941,8 @@ static int _probe(struct pci_dev *pci, void *data)
 
 	/* Reset and turn on the receive engine. */
 	_issue_command(nic, cmdRxReset, nic->isBrev ? 0x04 : 0x00);
-	_issue_command(nic, cmdSetRxFilter, 0x01 + 0x02 + 0x04);	/* Individual, multicast, broadcast */
-	_recv_prepare(nic);					/* Set up the ring buffer... */
+	_issue_command(nic, cmdSetRxFilter, 0x01 + 0x04);	/* Individual, broadcast */
+	_recv_init(nic);					/* Set up the ring buffer... */
 	_issue_command(nic, cmdRxEnable, 0);	/* ... and light it up. */
 
 	/* Turn on interrupts, and ack any that are hanging out. */
@@ -808,9 +950,21 @@ static int _probe(struct pci_dev *pci, void *data)
 	_issue_command(nic, cmdSetIndicationEnable, 0x0014);
 	_issue_command(nic, cmdAcknowledgeInterrupt, 0x661);
 
-	/* Register with lwIP. */
+	/* Register with lwIP.  The 905B generates and checks IP, TCP and UDP
+	 * checksums in hardware; the original 905 leaves them to lwIP. */
+	if (nic->isBrev)
+		nic->nic.csum_offload = NETIF_CHECKSUM_GEN_IP
+		                      | NETIF_CHECKSUM_GEN_TCP
+		                      | NETIF_CHECKSUM_GEN_UDP
+		                      | NETIF_CHECKSUM_CHECK_IP
+		                      | NETIF_CHECKSUM_CHECK_TCP
+		                      | NETIF_CHECKSUM_CHECK_UDP;
 	nic->nic.recv = _recv;
 	nic->nic.transmit = _transmit;
+	nic->nic.tx_flush = _tx_flush;
+	nic->nic.pending = _pending;
+	nic->nic.rx_ring = RECV_BUFS;
+	nic->nic.tx_ring = XMIT_BUFS;
 	eth_register(&(nic->nic));
 
 	return 1;
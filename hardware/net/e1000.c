@@ -0,0 +1,637 @@
+/* e1000.c
+ * Intel 8254x ("e1000") gigabit Ethernet driver
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include "etherboot-compat.h"
+#include "net.h"
+#include "lwip/netif.h"
+#include <stdint.h>
+#include <pci.h>
+#include <pci-bother.h>
+#include <minilib.h>
+#include <output.h>
+#include <trace.h>
+#include <paging.h>
+
+/* Everything here is polled: interrupts stay masked, and eth_poll() comes
+ * by once per SMI to take packets off the receive ring and to hand queued
+ * ones to the card.  The registers are memory-mapped, through BAR0, with a
+ * 4MB page of their own.
+ */
+#define E1000_MMIO_VADDR	0x50000000
+
+/*** Registers ***/
+#define REG_CTRL	0x0000
+#define REG_STATUS	0x0008
+#define REG_EERD	0x0014
+#define REG_ICR		0x00C0
+#define REG_IMC		0x00D8
+#define REG_RCTL	0x0100
+#define REG_TCTL	0x0400
+#define REG_TIPG	0x0410
+#define REG_RXCSUM	0x5000
+#define REG_MTA		0x5200
+#define REG_RAL0	0x5400
+#define REG_RAH0	0x5404
+
+#define REG_RDBAL	0x2800
+#define REG_RDBAH	0x2804
+#define REG_RDLEN	0x2808
+#define REG_RDH		0x2810
+#define REG_RDT		0x2818
+#define REG_RDTR	0x2820
+
+#define REG_TDBAL	0x3800
+#define REG_TDBAH	0x3804
+#define REG_TDLEN	0x3808
+#define REG_TDH		0x3810
+#define REG_TDT		0x3818
+#define REG_TIDV	0x3820
+
+#define CTRL_ASDE	(1 << 5)
+#define CTRL_SLU	(1 << 6)
+#define CTRL_ILOS	(1 << 7)
+#define CTRL_LRST	(1 << 3)
+#define CTRL_RST	(1 << 26)
+#define CTRL_VME	(1 << 30)
+#define CTRL_PHY_RST	(1 << 31)
+
+#define STATUS_FD	(1 << 0)
+#define STATUS_LU	(1 << 1)
+
+#define EERD_START	(1 << 0)
+#define EERD_DONE	(1 << 4)
+
+#define RCTL_EN		(1 << 1)
+#define RCTL_BAM	(1 << 15)
+#define RCTL_BSIZE_2048	(0 << 16)
+#define RCTL_SECRC	(1 << 26)
+
+#define TCTL_EN		(1 << 1)
+#define TCTL_PSP	(1 << 3)
+#define TCTL_CT(x)	((x) << 4)
+#define TCTL_COLD(x)	((x) << 12)
+
+#define TIPG_COPPER	(10 | (8 << 10) | (6 << 20))
+
+#define RXCSUM_IPOFL	(1 << 8)
+#define RXCSUM_TUOFL	(1 << 9)
+
+#define RAH_AV		(1 << 31)
+
+static volatile unsigned char *_regs;
+
+#define _rd(r)		(*(volatile uint32_t *)(_regs + (r)))
+#define _wr(r, v)	(*(volatile uint32_t *)(_regs + (r)) = (v))
+
+/*** Descriptors ***/
+typedef struct {
+	uint32_t addr_lo, addr_hi;
+	uint16_t length;
+	uint16_t csum;
+	uint8_t status;
+	uint8_t errors;
+	uint16_t special;
+} rxdesc_t;
+
+#define RXD_STAT_DD	0x01
+#define RXD_STAT_EOP	0x02
+#define RXD_STAT_IXSM	0x04
+#define RXD_STAT_TCPCS	0x20
+#define RXD_STAT_IPCS	0x40
+
+#define RXD_ERR_CE	0x01
+#define RXD_ERR_SE	0x02
+#define RXD_ERR_SEQ	0x04
+#define RXD_ERR_CXE	0x10
+#define RXD_ERR_TCPE	0x20
+#define RXD_ERR_IPE	0x40
+#define RXD_ERR_RXE	0x80
+#define RXD_ERR_FRAME	(RXD_ERR_CE | RXD_ERR_SE | RXD_ERR_SEQ | RXD_ERR_CXE | RXD_ERR_RXE)
+
+/* The transmit side uses extended descriptors only: a context descriptor
+ * tells the card where the checksums are, and the data descriptors that
+ * follow it say which of them to fill in. */
+typedef struct {
+	uint32_t addr_lo, addr_hi;
+	uint32_t cmd;		/* Length, type and command */
+	uint32_t opts;		/* Status, options, and VLAN */
+} txdesc_t;
+
+typedef struct {
+	uint8_t ipcss, ipcso;
+	uint16_t ipcse;
+	uint8_t tucss, tucso;
+	uint16_t tucse;
+	uint32_t cmd;
+	uint32_t opts;
+} txctx_t;
+
+#define TXD_DTYP_C	(0x0 << 20)
+#define TXD_DTYP_D	(0x1 << 20)
+#define TXD_CMD_EOP	(1 << 24)
+#define TXD_CMD_IFCS	(1 << 25)
+#define TXD_CMD_RS	(1 << 27)
+#define TXD_CMD_DEXT	(1 << 29)
+
+#define TXD_CTX_TCP	(1 << 24)	/* TCP, rather than UDP */
+#define TXD_CTX_IP	(1 << 25)	/* IPv4 */
+
+#define TXD_STAT_DD	0x01
+#define TXD_POPTS_IXSM	(0x01 << 8)
+#define TXD_POPTS_TXSM	(0x02 << 8)
+
+/*** Transmit ***/
+
+/* Packets are queued up in the ring by _transmit, and the tail pointer is
+ * only moved -- handing them to the card -- by _tx_flush, so that a burst
+ * costs one register write.  Each packet may take a context descriptor and
+ * then one data descriptor per pbuf; only its last descriptor asks for a
+ * status write-back, and the pbuf is freed once that comes in.
+ */
+#define XMIT_BUFS	64	/* A multiple of 8, and a power of two. */
+#define XMIT_SEGS	8	/* Longer pbuf chains get flattened. */
+
+static txdesc_t txdescs[XMIT_BUFS] __attribute__ ((aligned(128)));
+static struct pbuf *txpbufs[XMIT_BUFS];
+static unsigned int txlast[XMIT_BUFS];	/* For a packet's first slot. */
+
+/* Free-running counters, as in 3c90x.c: [txtail, txkick) belong to the
+ * card, and [txkick, txhead) have not been handed over yet. */
+static unsigned int txtail = 0;
+static unsigned int txkick = 0;
+static unsigned int txhead = 0;
+
+/* The card has one checksum context; it only needs to be told again if
+ * the header layout changes. */
+static uint32_t txctx = 0;
+
+#define TXD(i)	(&txdescs[(i) % XMIT_BUFS])
+
+static void _tx_reclaim()
+{
+	unsigned int i;
+
+	while (txtail != txkick)
+	{
+		i = txtail % XMIT_BUFS;
+		if (!(TXD(txlast[i])->opts & TXD_STAT_DD))
+			break;
+		pbuf_free(txpbufs[i]);
+		txpbufs[i] = NULL;
+		txtail = txlast[i] + 1;
+	}
+}
+
+static void _tx_flush(struct nic *nic)
+{
+	_tx_reclaim();
+	if (txkick != txhead)
+	{
+		txkick = txhead;
+		_wr(REG_TDT, txhead % XMIT_BUFS);
+	}
+}
+
+/* The card adds the data into the TCP or UDP checksum field, but not the
+ * pseudo-header; that has to be there already. */
+static uint16_t _pseudo_sum(const unsigned char *ip, int ihl)
+{
+	uint32_t sum;
+	int i;
+
+	sum = ip[9] + (((ip[2] << 8) | ip[3]) - ihl);
+	for (i = 12; i < 20; i += 2)
+		sum += (ip[i] << 8) | ip[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	return sum;
+}
+
+/* Work out which checksums the card should fill in for the frame in p,
+ * sending a new context descriptor first if need be.  Returns the options
+ * for the data descriptors. */
+static uint32_t _tx_cksum(struct pbuf *p)
+{
+	unsigned char *f = p->payload;
+	unsigned char *ip = f + 14;
+	int ihl, tucso;
+	uint32_t ctx, popts;
+	uint16_t sum;
+	txctx_t *c;
+
+	if (p->len < 14 + 20 || f[12] != 0x08 || f[13] != 0x00)
+		return 0;
+
+	ihl = (ip[0] & 0xF) * 4;
+	if (p->len < 14 + ihl)
+		return 0;
+
+	/* The card sums the whole header, checksum field and all, and
+	 * stores the result there.  ip_output leaves the field at zero, but
+	 * ICMP echo replies and fragments arrive with it already filled in
+	 * by software, so clear it first. */
+	ip[10] = 0;
+	ip[11] = 0;
+	popts = TXD_POPTS_IXSM;
+	tucso = 0;
+	if (!(ip[6] & 0x3F) && !ip[7])	/* Not a fragment */
+	{
+		if (ip[9] == 6)
+			tucso = 14 + ihl + 16;
+		else if (ip[9] == 17)
+			tucso = 14 + ihl + 6;
+	}
+	if (tucso && p->len >= tucso + 2)
+	{
+		sum = _pseudo_sum(ip, ihl);
+		f[tucso] = sum >> 8;
+		f[tucso + 1] = sum;
+		popts |= TXD_POPTS_TXSM;
+	} else
+		tucso = 0;
+
+	ctx = (ihl << 16) | (tucso << 8) | ip[9];
+	if (ctx != txctx)
+	{
+		c = (txctx_t *)TXD(txhead);
+		c->ipcss = 14;
+		c->ipcso = 14 + 10;
+		c->ipcse = 14 + ihl - 1;
+		c->tucss = 14 + ihl;
+		c->tucso = tucso;
+		c->tucse = 0;	/* To the end of the packet */
+		c->cmd = TXD_CMD_DEXT | TXD_DTYP_C | TXD_CTX_IP
+		         | (ip[9] == 6 ? TXD_CTX_TCP : 0);
+		c->opts = 0;
+		txhead++;
+		txctx = ctx;
+	}
+
+	return popts;
+}
+
+/* _transmit adds a packet to the ring.  If no space is available, it
+ * returns -1 rather than waiting for some. */
+static int _transmit(struct nic *nic, struct pbuf *p)
+{
+	unsigned int first, need;
+	uint32_t popts;
+	txdesc_t *d;
+	struct pbuf *q;
+
+	if (pbuf_clen(p) > XMIT_SEGS)
+	{
+		q = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_RAM);
+		if (!q)
+			return -1;
+		pbuf_copy(q, p);
+	} else {
+		q = p;
+		pbuf_ref(q);
+	}
+
+	/* One slot is always left empty, so that head == tail means idle. */
+	need = pbuf_clen(q) + 1;
+	if (XMIT_BUFS - 1 - (txhead - txtail) < need)
+	{
+		_tx_reclaim();
+		if (XMIT_BUFS - 1 - (txhead - txtail) < need)
+		{
+			pbuf_free(q);
+			return -1;
+		}
+	}
+
+	first = txhead;
+	popts = _tx_cksum(q);
+
+	txpbufs[first % XMIT_BUFS] = q;
+	for (p = q; p; p = p->next)
+	{
+		d = TXD(txhead);
+		d->addr_lo = v2p(p->payload);
+		d->addr_hi = 0;
+		d->cmd = TXD_CMD_DEXT | TXD_DTYP_D | TXD_CMD_IFCS | p->len
+		         | (p->next ? 0 : TXD_CMD_EOP | TXD_CMD_RS);
+		d->opts = popts;
+		txhead++;
+	}
+	txlast[first % XMIT_BUFS] = txhead - 1;
+
+	return 0;
+}
+
+/*** Receive ***/
+
+/* As in 3c90x.c: every descriptor has a full-frame buffer, big packets
+ * are handed up in place as custom pbufs (a spare buffer takes their slot),
+ * and small ones are copied.  The buffers are 2K, the smallest size the
+ * card will do without splitting a frame, and come out of the shared
+ * receive arena in net.c; 16 in the ring and 8 spare is all that fits
+ * there, which is a lot shallower than gigabit would like.
+ */
+#define RECV_BUFS	16	/* A multiple of 8. */
+#define RECV_SPARE_BUFS	8
+#define RECV_BUF_SIZE	2048
+#define RECV_COPYBREAK	256
+
+/* Laid out as in 3c90x.c, with the pbuf in front of the data, so that
+ * lwIP treats it as PBUF_POOL and can grow headers back into it. */
+struct rxbuf {
+	struct pbuf_custom pc;
+	unsigned char data[RECV_BUF_SIZE] __attribute__ ((aligned(32)));
+} __attribute__ ((aligned(32)));
+
+static rxdesc_t rxdescs[RECV_BUFS] __attribute__ ((aligned(128)));
+static int rxbufs[RECV_BUFS];	/* Which pool buffer each slot has. */
+
+static struct rxbuf *rxpool;	/* RECV_BUFS + RECV_SPARE_BUFS of them */
+static int rxfree[RECV_SPARE_BUFS];
+static int rxnfree = 0;
+
+/* The next slot the card will fill. */
+static int rxcons = 0;
+
+static void _rxbuf_free(struct pbuf *p)
+{
+	struct rxbuf *b = (struct rxbuf *)
+		((char *)p - __builtin_offsetof(struct rxbuf, pc));
+
+	rxfree[rxnfree++] = b - rxpool;
+}
+
+static void _rx_arm(int i, int b)
+{
+	rxbufs[i] = b;
+	rxdescs[i].addr_lo = v2p(rxpool[b].data);
+	rxdescs[i].addr_hi = 0;
+	rxdescs[i].status = 0;
+}
+
+static struct pbuf *_recv_take(int i, int len, u8_t flags)
+{
+	struct rxbuf *b = &rxpool[rxbufs[i]];
+	struct pbuf *p, *q;
+	int off = 0;
+
+	if (len > RECV_COPYBREAK && rxnfree > 0)
+	{
+		p = &b->pc.pbuf;
+		p->next = NULL;
+		p->payload = b->data;
+		p->tot_len = p->len = len;
+		p->type = PBUF_POOL;
+		p->flags = PBUF_FLAG_IS_CUSTOM | flags;
+		p->ref = 1;
+		b->pc.custom_free_function = _rxbuf_free;
+
+		_rx_arm(i, rxfree[--rxnfree]);
+		return p;
+	}
+
+	p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+	if (!p)
+		outputf("e1000: out of memory for rx pbuf?");
+	else
+		p->flags |= flags;
+	for (q = p; q; q = q->next)
+	{
+		memcpy(q->payload, b->data + off, q->len);
+		off += q->len;
+	}
+
+	rxdescs[i].status = 0;
+	return p;
+}
+
+/* Only a good IP packet with a good TCP or UDP checksum skips lwIP's own
+ * checks; see 3c90x.c. */
+static u8_t _rx_cksum_flags(rxdesc_t *d)
+{
+	if ((d->status & (RXD_STAT_IXSM | RXD_STAT_IPCS | RXD_STAT_TCPCS))
+	     == (RXD_STAT_IPCS | RXD_STAT_TCPCS)
+	    && !(d->errors & (RXD_ERR_IPE | RXD_ERR_TCPE)))
+		return PBUF_FLAG_CHKSUM_OK;
+	return 0;
+}
+
+static int _recv(struct nic *nic, int budget)
+{
+	rxdesc_t *d;
+	struct pbuf *p;
+	int consumed = 0;
+
+	while (consumed < budget && (rxdescs[rxcons].status & RXD_STAT_DD))
+	{
+		d = &rxdescs[rxcons];
+		consumed++;
+
+		if ((d->errors & RXD_ERR_FRAME) || !(d->status & RXD_STAT_EOP))
+		{
+			TRACE(TRACE_WARN, "e1000: bad packet (status %02x, errors %02x)",
+			      d->status, d->errors);
+			d->status = 0;
+			p = NULL;
+		} else
+			p = _recv_take(rxcons, d->length, _rx_cksum_flags(d));
+
+		rxcons = (rxcons + 1) % RECV_BUFS;
+
+		if (p)
+			eth_recv(nic, p);
+	}
+
+	/* Give the slots back; the card owns everything up to, but not
+	 * including, the tail. */
+	if (consumed)
+		_wr(REG_RDT, (rxcons + RECV_BUFS - 1) % RECV_BUFS);
+	return consumed;
+}
+
+static void _pending(struct nic *nic, int *rx, int *tx)
+{
+	int i;
+
+	for (i = 0; i < RECV_BUFS; i++)
+		if (!(rxdescs[(rxcons + i) % RECV_BUFS].status & RXD_STAT_DD))
+			break;
+	*rx = i;
+	*tx = txhead - txtail;
+}
+
+/*** Setup ***/
+
+static uint16_t _read_eeprom(int addr)
+{
+	uint32_t v;
+	int i;
+
+	_wr(REG_EERD, (addr << 8) | EERD_START);
+	for (i = 0; i < 100000; i++)
+	{
+		v = _rd(REG_EERD);
+		if (v & EERD_DONE)
+			return v >> 16;
+	}
+	outputf("e1000: EEPROM read of %d timed out", addr);
+	return 0xFFFF;
+}
+
+static void _reset()
+{
+	int i;
+
+	_wr(REG_IMC, 0xFFFFFFFF);
+	_wr(REG_RCTL, 0);
+	_wr(REG_TCTL, 0);
+	_rd(REG_STATUS);
+
+	_wr(REG_CTRL, _rd(REG_CTRL) | CTRL_RST);
+	for (i = 0; i < 100000 && (_rd(REG_CTRL) & CTRL_RST); i++)
+		;
+
+	/* The reset turns interrupts back on; we want none. */
+	_wr(REG_IMC, 0xFFFFFFFF);
+	_rd(REG_ICR);
+}
+
+static void _recv_init()
+{
+	int i;
+
+	for (i = 0; i < RECV_BUFS; i++)
+		_rx_arm(i, i);
+	for (i = 0; i < RECV_SPARE_BUFS; i++)
+		rxfree[i] = RECV_BUFS + i;
+	rxnfree = RECV_SPARE_BUFS;
+	rxcons = 0;
+
+	_wr(REG_RDBAL, v2p(rxdescs));
+	_wr(REG_RDBAH, 0);
+	_wr(REG_RDLEN, sizeof(rxdescs));
+	_wr(REG_RDH, 0);
+	_wr(REG_RDT, RECV_BUFS - 1);
+	_wr(REG_RDTR, 0);
+	_wr(REG_RXCSUM, _rd(REG_RXCSUM) | RXCSUM_IPOFL | RXCSUM_TUOFL);
+	_wr(REG_RCTL, RCTL_EN | RCTL_BAM | RCTL_BSIZE_2048 | RCTL_SECRC);
+}
+
+static void _xmit_init()
+{
+	memset(txdescs, 0, sizeof(txdescs));
+	txtail = txkick = txhead = 0;
+	txctx = 0;
+
+	_wr(REG_TDBAL, v2p(txdescs));
+	_wr(REG_TDBAH, 0);
+	_wr(REG_TDLEN, sizeof(txdescs));
+	_wr(REG_TDH, 0);
+	_wr(REG_TDT, 0);
+	_wr(REG_TIDV, 0);
+	_wr(REG_TIPG, TIPG_COPPER);
+	_wr(REG_TCTL, TCTL_EN | TCTL_PSP | TCTL_CT(0x0F) | TCTL_COLD(0x40));
+}
+
+static struct nic _nic;
+
+static int _probe(struct pci_dev *pci, void *data)
+{
+	unsigned long mmio;
+	uint16_t w;
+	uint32_t status;
+	int i;
+
+	if (pci->bars[0].type != PCI_BAR_MEMORY32)
+	{
+		outputf("e1000: BAR0 is not memory32?");
+		return 0;
+	}
+	mmio = pci->bars[0].addr;
+
+	rxpool = eth_rx_arena(sizeof(struct rxbuf) * (RECV_BUFS + RECV_SPARE_BUFS));
+	if (!rxpool)
+	{
+		outputf("e1000: no receive buffers to be had");
+		return 0;
+	}
+
+	/* Memory space and bus mastering on, before pci_bother_add saves
+	 * the command register to put back at every SMI. */
+	pci_write16(pci->bus, pci->dev, pci->fn, 0x04,
+		pci_read16(pci->bus, pci->dev, pci->fn, 0x04) | 0x06);
+	pci_bother_add(pci);
+
+	addmap_4m(E1000_MMIO_VADDR, mmio & ~0x3FFFFF);
+	_regs = (volatile unsigned char *)(E1000_MMIO_VADDR + (mmio & 0x3FFFFF));
+	outputf("e1000: registers at %08x, mapped to %08x", mmio, _regs);
+
+	_reset();
+
+	_wr(REG_CTRL, (_rd(REG_CTRL) | CTRL_SLU | CTRL_ASDE)
+	              & ~(CTRL_LRST | CTRL_PHY_RST | CTRL_ILOS | CTRL_VME));
+
+	for (i = 0; i < 3; i++)
+	{
+		w = _read_eeprom(i);
+		_nic.hwaddr[i * 2] = w & 0xFF;
+		_nic.hwaddr[i * 2 + 1] = w >> 8;
+	}
+	outputf("e1000: MAC address %02x:%02x:%02x:%02x:%02x:%02x",
+		_nic.hwaddr[0], _nic.hwaddr[1], _nic.hwaddr[2],
+		_nic.hwaddr[3], _nic.hwaddr[4], _nic.hwaddr[5]);
+
+	_wr(REG_RAL0, _nic.hwaddr[0] | (_nic.hwaddr[1] << 8)
+	              | (_nic.hwaddr[2] << 16) | (_nic.hwaddr[3] << 24));
+	_wr(REG_RAH0, _nic.hwaddr[4] | (_nic.hwaddr[5] << 8) | RAH_AV);
+	for (i = 0; i < 128; i++)
+		_wr(REG_MTA + i * 4, 0);
+
+	_recv_init();
+	_xmit_init();
+
+	status = _rd(REG_STATUS);
+	outputf("e1000: link %s, %s duplex",
+	        (status & STATUS_LU) ? "up" : "down",
+	        (status & STATUS_FD) ? "full" : "half");
+
+	/* Register with lwIP. */
+	_nic.csum_offload = NETIF_CHECKSUM_GEN_IP
+	                  | NETIF_CHECKSUM_GEN_TCP
+	                  | NETIF_CHECKSUM_GEN_UDP
+	                  | NETIF_CHECKSUM_CHECK_IP
+	                  | NETIF_CHECKSUM_CHECK_TCP
+	                  | NETIF_CHECKSUM_CHECK_UDP;
+	_nic.recv = _recv;
+	_nic.transmit = _transmit;
+	_nic.tx_flush = _tx_flush;
+	_nic.pending = _pending;
+	_nic.rx_ring = RECV_BUFS;
+	_nic.tx_ring = XMIT_BUFS;
+	eth_register(&_nic);
+
+	return 1;
+}
+
+static struct pci_id _pci_ids[] = {
+	PCI_ROM(0x8086, 0x100e, "82540em",     "Intel 82540EM"),
+	PCI_ROM(0x8086, 0x1015, "82540em-lom", "Intel 82540EM (LOM)"),
+	PCI_ROM(0x8086, 0x1016, "82540ep-lom", "Intel 82540EP (LOM)"),
+	PCI_ROM(0x8086, 0x1017, "82540ep",     "Intel 82540EP"),
+	PCI_ROM(0x8086, 0x101e, "82540ep-lp",  "Intel 82540EP (Mobile)"),
+	PCI_ROM(0x8086, 0x100f, "82545em",     "Intel 82545EM"),
+	PCI_ROM(0x8086, 0x1026, "82545gm",     "Intel 82545GM"),
+};
+
+struct pci_driver e1000_driver = {
+	.name     = "e1000",
+	.probe    = _probe,
+	.ids      = _pci_ids,
+	.id_count = sizeof(_pci_ids)/sizeof(_pci_ids[0]),
+};
@@ -0,0 +1,227 @@
+/* bochs.c
+ * Bochs/QEMU standard VGA ("DISPI") driver.
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <minilib.h>
+#include <io.h>
+#include <pci.h>
+#include <output.h>
+#include <fb.h>
+#include <paging.h>
+#include <text.h>
+#include <vga.h>
+
+#include "generic.h"
+
+/* The DISPI interface is a pair of index/data I/O ports; the linear
+ * framebuffer lives in BAR0. */
+#define DISPI_IOPORT_INDEX	0x1CE
+#define DISPI_IOPORT_DATA	0x1CF
+
+#define DISPI_INDEX_ID		0x0
+#define DISPI_INDEX_XRES	0x1
+#define DISPI_INDEX_YRES	0x2
+#define DISPI_INDEX_BPP		0x3
+#define DISPI_INDEX_ENABLE	0x4
+#define DISPI_INDEX_BANK	0x5
+#define DISPI_INDEX_VIRT_WIDTH	0x6
+#define DISPI_INDEX_VIRT_HEIGHT	0x7
+#define DISPI_INDEX_X_OFFSET	0x8
+#define DISPI_INDEX_Y_OFFSET	0x9
+#define DISPI_INDEX_VIDEO_MEMORY_64K	0xA
+
+#define DISPI_ID0		0xB0C0
+#define DISPI_ID5		0xB0C5
+
+#define DISPI_ENABLED		0x01
+#define DISPI_8BIT_DAC		0x20
+#define DISPI_LFB_ENABLED	0x40
+
+#define BOCHS_FB_VADDR		0x40000000
+#define BOCHS_DEFAULT_VRAM_MB	16
+
+static void bochs_getvmode(void *priv);
+static uint32_t bochs_getsig(void *priv);
+
+static struct fbdevice bochs_fb = {
+	.getvmode = &bochs_getvmode,
+	.getsig = &bochs_getsig,
+};
+
+/* Base of the mapped framebuffer; fbaddr moves around from here as the
+ * guest pans the display. */
+static unsigned char *bochs_lfb;
+
+/* getvmode runs again and again in the same mode, so the complaint is
+ * only made when the depth changes. */
+static unsigned short _warned_bpp;
+
+static unsigned short dispi_read(unsigned short idx)
+{
+	outw(DISPI_IOPORT_INDEX, idx);
+	return inw(DISPI_IOPORT_DATA);
+}
+
+/* A DISPI mode that we can't read: show it as a black screen of the right
+ * size, rather than whatever is left in the VGA's text buffer. */
+static uint32_t bochs_blank_checksum(int x, int y, int w, int h)
+{
+	return 0;
+}
+
+static void bochs_blank_copy(char *buf, int x, int y, int w, int h)
+{
+	memset(buf, 0, w * h * 4);
+}
+
+static void bochs_set_text(void)
+{
+	text_getvmode(&bochs_fb.curmode);
+	bochs_fb.checksum_rect = text_checksum;
+	bochs_fb.copy_pixels = text_render;
+	bochs_fb.copy_checksum = 0;
+}
+
+/* The Y offset is in here so that page flipping is noticed promptly. */
+static uint32_t bochs_getsig(void *priv)
+{
+	unsigned short oldidx = inw(DISPI_IOPORT_INDEX);
+	uint32_t sig;
+
+	if (dispi_read(DISPI_INDEX_ENABLE) & DISPI_ENABLED)
+		sig = 0x80000000
+		      | (dispi_read(DISPI_INDEX_BPP) << 24)
+		      | ((dispi_read(DISPI_INDEX_XRES) & 0xFFF) << 12)
+		      | (dispi_read(DISPI_INDEX_Y_OFFSET) & 0xFFF);
+	else
+		sig = vga_signature();
+
+	outw(DISPI_IOPORT_INDEX, oldidx);
+	return sig;
+}
+
+static void bochs_getvmode(void *priv)
+{
+	unsigned short oldidx = inw(DISPI_IOPORT_INDEX);
+	unsigned short enable, bpp, vwidth, xoff, yoff;
+	int bytes;
+
+	enable = dispi_read(DISPI_INDEX_ENABLE);
+
+	/* With DISPI off, the card is a plain VGA. */
+	if (!(enable & DISPI_ENABLED))
+	{
+		if (!vga_getvmode(&bochs_fb))
+			bochs_set_text();
+		outw(DISPI_IOPORT_INDEX, oldidx);
+		return;
+	}
+
+	bpp = dispi_read(DISPI_INDEX_BPP);
+	bochs_fb.curmode.xres = dispi_read(DISPI_INDEX_XRES);
+	bochs_fb.curmode.yres = dispi_read(DISPI_INDEX_YRES);
+	vwidth = dispi_read(DISPI_INDEX_VIRT_WIDTH);
+	xoff = dispi_read(DISPI_INDEX_X_OFFSET);
+	yoff = dispi_read(DISPI_INDEX_Y_OFFSET);
+
+	outw(DISPI_IOPORT_INDEX, oldidx);
+
+	/* The scanline is vwidth pixels long, whatever xres is. */
+	bytes = (bpp + 7) / 8;
+	bochs_fb.pitch = vwidth * bytes;
+	bochs_fb.fbaddr = bochs_lfb + yoff * bochs_fb.pitch + xoff * bytes;
+	bochs_fb.curmode.format = FB_RGB888;
+	bochs_fb.curmode.bytestride = bytes;
+	bochs_fb.curmode.text = 0;
+	bochs_fb.copy_indices = 0;
+	bochs_fb.getpalette = 0;
+
+	switch (bpp)
+	{
+	case 8:
+		vga_linear8(&bochs_fb, bochs_fb.fbaddr, bochs_fb.pitch,
+		            enable & DISPI_8BIT_DAC);
+		break;
+	case 16:
+		bochs_fb.checksum_rect = checksum_rect_generic16;
+		bochs_fb.copy_pixels = copy_pixels_generic16;
+		bochs_fb.copy_checksum = copy_checksum_generic16;
+		break;
+	case 24:
+		bochs_fb.checksum_rect = checksum_rect_generic24;
+		bochs_fb.copy_pixels = copy_pixels_generic24;
+		bochs_fb.copy_checksum = copy_checksum_generic24;
+		break;
+	case 32:
+		bochs_fb.checksum_rect = checksum_rect_generic32;
+		bochs_fb.copy_pixels = copy_pixels_generic32;
+		bochs_fb.copy_checksum = copy_checksum_generic32;
+		break;
+	default:
+		/* 4 and 15bpp; too rare to be worth the code. */
+		bochs_fb.checksum_rect = bochs_blank_checksum;
+		bochs_fb.copy_pixels = bochs_blank_copy;
+		bochs_fb.copy_checksum = 0;
+		if (bpp != _warned_bpp)
+			outputf("bochs: %dbpp not supported; showing a blank screen", bpp);
+		_warned_bpp = bpp;
+		return;
+	}
+
+	_warned_bpp = 0;
+}
+
+static int bochs_probe(struct pci_dev *pci, void *data)
+{
+	unsigned int p, vram;
+	unsigned short id;
+
+	if (pci->bars[0].type != PCI_BAR_MEMORY32)
+	{
+		output("bochs: BAR0 is not memory32?");
+		return 0;
+	}
+
+	id = dispi_read(DISPI_INDEX_ID);
+	if (id < DISPI_ID0 || id > DISPI_ID5)
+	{
+		outputf("bochs: bad DISPI ID %04x", id);
+		return 0;
+	}
+
+	/* The video memory size register only exists from ID5 on. */
+	if (id >= DISPI_ID5)
+		vram = dispi_read(DISPI_INDEX_VIDEO_MEMORY_64K) / 16;
+	else
+		vram = BOCHS_DEFAULT_VRAM_MB;
+	if (vram == 0)
+		vram = BOCHS_DEFAULT_VRAM_MB;
+
+	for (p = 0; p < vram; p += 4)
+		addmap_4m(BOCHS_FB_VADDR + p*1024*1024, pci->bars[0].addr + p*1024*1024);
+	bochs_lfb = (void *)BOCHS_FB_VADDR;
+	bochs_fb.fbaddr = bochs_lfb;
+
+	generic_init();
+	fb = &bochs_fb;
+	outputf("Found bochs VGA (DISPI %04x, %dM) with FB at %08x, mapped to %08x",
+	        id, vram, pci->bars[0].addr, bochs_fb.fbaddr);
+	return 1;
+}
+
+static struct pci_id bochs_pci[] = {
+	{0x1234, 0x1111, "stdvga", "Bochs/QEMU standard VGA"}
+};
+
+struct pci_driver bochs_driver = {
+	.name     = "bochs",
+	.probe    = bochs_probe,
+	.ids      = bochs_pci,
+	.id_count = sizeof(bochs_pci)/sizeof(bochs_pci[0]),
+};
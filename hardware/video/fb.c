@@ -1,5 +1,5 @@
 /* fb.c
- * Framebuffer device pointer
+ * Framebuffer device pointer and mode tracking
  * NetWatch system management mode administration console
  *
  * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
@@ -9,5 +9,62 @@
  */
 
 #include <fb.h>
+#include <output.h>
+
+/* Even if the signature has not changed, redo the full getvmode this
+ * often, to catch changes that the signature does not cover. */
+#define FB_REVALIDATE_TICKS	64
 
 struct fbdevice *fb = 0;
+
+unsigned int fb_frame = 0;
+unsigned int fb_modegen = 0;
+
+static uint32_t _lastsig;
+static int _ticks = 0;
+static int _valid = 0;
+
+/* Called once per SMI.  Reading the whole mode is a lot of slow legacy
+ * I/O, so if the driver can give us a cheap signature of it, we only do
+ * so when that changes (or every so often, just in case).
+ */
+void fb_checkmode()
+{
+	struct vmode old;
+	unsigned char *oldaddr;
+	uint32_t sig = 0;
+
+	fb_frame++;
+
+	if (!fb)
+		return;
+
+	if (fb->getsig)
+	{
+		sig = fb->getsig(fb->priv);
+		if (_valid && sig == _lastsig && ++_ticks < FB_REVALIDATE_TICKS)
+			return;
+	}
+
+	old = fb->curmode;
+	oldaddr = fb->fbaddr;
+
+	fb->getvmode(fb->priv);
+
+	_lastsig = sig;
+	_ticks = 0;
+
+	if (!_valid
+	    || old.text != fb->curmode.text
+	    || old.xres != fb->curmode.xres
+	    || old.yres != fb->curmode.yres
+	    || old.format != fb->curmode.format
+	    || oldaddr != fb->fbaddr)
+	{
+		fb_modegen++;
+		outputf("fb: mode %dx%d%s (generation %d)",
+		        fb->curmode.xres, fb->curmode.yres,
+		        fb->curmode.text ? " text" : "", fb_modegen);
+	}
+	_valid = 1;
+}
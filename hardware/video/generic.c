@@ -10,39 +10,344 @@
 
 #include <stdint.h>
 #include <fb.h>
-#include <crc32.h>
+#include <cpuid.h>
+#include <output.h>
 
-uint32_t checksum_rect_generic32(int x, int y, int width, int height) {
+#include "generic.h"
 
+/* Framebuffer memory is uncached or write-combining, so every read from it
+ * is expensive; the kernels here are built to touch each pixel exactly once.
+ * If the CPU has SSE4.1, we use MOVNTDQA streaming loads, which pull in a
+ * whole 64-byte line from WC memory at a time; otherwise, we fall back on
+ * rep movsd, which is at least no slower than a hand-written loop.
+ *
+ * The hash is a multiplicative one rather than CRC32, since it is cheap
+ * enough to compute four lanes at once with pmulld.  It is only ever
+ * compared against itself, so the lane layout does not need to match the
+ * scalar path; the path is picked once, in generic_init().
+ */
+
+#define HASH_MUL	0x9E3779B1
+#define HASH(h, w)	(((h) ^ (w)) * HASH_MUL)
+
+#define CPUID_1_ECX_SSE41	(1 << 19)
+
+static int _use_sse41 = 0;
+
+static uint32_t _lanes[4] __attribute__((aligned(16)));
+static const uint32_t _lane_mul[4] __attribute__((aligned(16))) =
+	{ HASH_MUL, HASH_MUL, HASH_MUL, HASH_MUL };
+
+/* SMM does not save the host's XMM registers for us, so anything we touch
+ * has to be put back by hand.  text.c borrows xmm0-5 the same way. */
+static uint8_t _xmm_save[6 * 16] __attribute__((aligned(16)));
+
+void generic_init()
+{
+	struct cpuid_result r;
+
+	cpuid(0, &r);
+	if (r.eax >= 1)
+	{
+		cpuid(1, &r);
+		_use_sse41 = (r.ecx & CPUID_1_ECX_SSE41) ? 1 : 0;
+	}
+
+	outputf("generic: using %s framebuffer reads",
+	        _use_sse41 ? "MOVNTDQA" : "rep movsd");
+}
+
+void generic_xmm_save()
+{
+	asm volatile(
+		"movdqa %%xmm0, 0x00(%0)\n"
+		"movdqa %%xmm1, 0x10(%0)\n"
+		"movdqa %%xmm2, 0x20(%0)\n"
+		"movdqa %%xmm3, 0x30(%0)\n"
+		"movdqa %%xmm4, 0x40(%0)\n"
+		"movdqa %%xmm5, 0x50(%0)\n"
+		: : "r" (_xmm_save) : "memory");
+}
+
+void generic_xmm_restore()
+{
+	asm volatile(
+		"movdqa 0x00(%0), %%xmm0\n"
+		"movdqa 0x10(%0), %%xmm1\n"
+		"movdqa 0x20(%0), %%xmm2\n"
+		"movdqa 0x30(%0), %%xmm3\n"
+		"movdqa 0x40(%0), %%xmm4\n"
+		"movdqa 0x50(%0), %%xmm5\n"
+		: : "r" (_xmm_save) : "memory");
+}
+
+static void _xmm_enter()
+{
+	generic_xmm_save();
+	_lanes[0] = _lanes[1] = _lanes[2] = _lanes[3] = 0;
+}
+
+static uint32_t _xmm_leave(uint32_t h)
+{
+	generic_xmm_restore();
+
+	h = HASH(h, _lanes[0]);
+	h = HASH(h, _lanes[1]);
+	h = HASH(h, _lanes[2]);
+	h = HASH(h, _lanes[3]);
+	return h;
+}
+
+/* Stream one scanline's worth of pixels out of the framebuffer, 64 bytes at
+ * a time, hashing them into _lanes and (if dst is non-null) storing them.
+ * The unaligned head and the tail are done a word at a time.
+ */
+static uint32_t _row_sse41(uint32_t *dst, const uint32_t *src, int n, uint32_t h)
+{
+	int blocks;
+	uint32_t w;
+
+	while (n && ((unsigned long)src & 15))
+	{
+		w = *(src++);
+		if (dst)
+			*(dst++) = w;
+		h = HASH(h, w);
+		n--;
+	}
+
+	blocks = n / 16;
+	n %= 16;
+
+	if (blocks && dst)
+		asm volatile(
+			"movdqa (%3), %%xmm5\n"
+			"movdqa (%4), %%xmm4\n"
+			"1:\n"
+			"movntdqa 0x00(%1), %%xmm0\n"
+			"movntdqa 0x10(%1), %%xmm1\n"
+			"movntdqa 0x20(%1), %%xmm2\n"
+			"movntdqa 0x30(%1), %%xmm3\n"
+			"movdqu %%xmm0, 0x00(%0)\n"
+			"movdqu %%xmm1, 0x10(%0)\n"
+			"movdqu %%xmm2, 0x20(%0)\n"
+			"movdqu %%xmm3, 0x30(%0)\n"
+			"pxor %%xmm0, %%xmm5\n"
+			"pmulld %%xmm4, %%xmm5\n"
+			"pxor %%xmm1, %%xmm5\n"
+			"pmulld %%xmm4, %%xmm5\n"
+			"pxor %%xmm2, %%xmm5\n"
+			"pmulld %%xmm4, %%xmm5\n"
+			"pxor %%xmm3, %%xmm5\n"
+			"pmulld %%xmm4, %%xmm5\n"
+			"add $64, %1\n"
+			"add $64, %0\n"
+			"dec %2\n"
+			"jnz 1b\n"
+			"movdqa %%xmm5, (%3)\n"
+			: "+r" (dst), "+r" (src), "+r" (blocks)
+			: "r" (_lanes), "r" (_lane_mul)
+			: "memory", "cc");
+	else if (blocks)
+		asm volatile(
+			"movdqa (%2), %%xmm5\n"
+			"movdqa (%3), %%xmm4\n"
+			"1:\n"
+			"movntdqa 0x00(%0), %%xmm0\n"
+			"movntdqa 0x10(%0), %%xmm1\n"
+			"movntdqa 0x20(%0), %%xmm2\n"
+			"movntdqa 0x30(%0), %%xmm3\n"
+			"pxor %%xmm0, %%xmm5\n"
+			"pmulld %%xmm4, %%xmm5\n"
+			"pxor %%xmm1, %%xmm5\n"
+			"pmulld %%xmm4, %%xmm5\n"
+			"pxor %%xmm2, %%xmm5\n"
+			"pmulld %%xmm4, %%xmm5\n"
+			"pxor %%xmm3, %%xmm5\n"
+			"pmulld %%xmm4, %%xmm5\n"
+			"add $64, %0\n"
+			"dec %1\n"
+			"jnz 1b\n"
+			"movdqa %%xmm5, (%2)\n"
+			: "+r" (src), "+r" (blocks)
+			: "r" (_lanes), "r" (_lane_mul)
+			: "memory", "cc");
+
+	while (n--)
+	{
+		w = *(src++);
+		if (dst)
+			*(dst++) = w;
+		h = HASH(h, w);
+	}
+
+	return h;
+}
+
+/* Without SSE4.1: copy the scanline with one rep movsd, then hash the
+ * (cached) copy.  Hash-only callers have to read the framebuffer directly.
+ */
+static uint32_t _row_movsd(uint32_t *dst, const uint32_t *src, int n, uint32_t h)
+{
+	const uint32_t *p;
+
+	if (dst)
+	{
+		p = dst;
+		asm volatile("rep movsl"
+			: "+D" (dst), "+S" (src), "+c" (n)
+			: : "memory");
+		n = dst - p;
+	} else
+		p = src;
+
+	while (n--)
+		h = HASH(h, *(p++));
+
+	return h;
+}
+
+static uint32_t _rect_generic32(uint32_t *buf, int x, int y, int width, int height)
+{
+	const uint32_t *fbuf;
+	uint32_t sum = 0;
+	int i;
+
+	if (_use_sse41)
+		_xmm_enter();
+
+	for (i = 0; i < height; i++)
+	{
+		fbuf = (const uint32_t *)(fb->fbaddr + (i + y) * fb->pitch) + x;
+
+		if (_use_sse41)
+			sum = _row_sse41(buf, fbuf, width, sum);
+		else
+			sum = _row_movsd(buf, fbuf, width, sum);
+
+		if (buf)
+			buf += width;
+	}
+
+	if (_use_sse41)
+		sum = _xmm_leave(sum);
+
+	return sum;
+}
+
+uint32_t checksum_rect_generic32(int x, int y, int width, int height)
+{
 	/* Generic checksum_rect function for video modes with 32-bit pixels
 	 * (i.e. fb->curmode.bytestride = 4).
 	 */
+	return _rect_generic32(0, x, y, width, height);
+}
+
+void copy_pixels_generic32(char *buf, int x, int y, int width, int height)
+{
+	_rect_generic32((uint32_t *)buf, x, y, width, height);
+}
+
+uint32_t copy_checksum_generic32(char *buf, int x, int y, int width, int height)
+{
+	/* Copy and hash in the same pass, so that a dirty tile only has to
+	 * come across the bus once.  Gives the same result as
+	 * checksum_rect_generic32 for the same rectangle.
+	 */
+	return _rect_generic32((uint32_t *)buf, x, y, width, height);
+}
+
+/* 16 (RGB565) and 24bpp modes: pull whole dwords across into a cached
+ * buffer, a chunk of the scanline at a time, and widen them there to the
+ * RGB888 that copy_pixels promises, red in the low byte.  The hash is over
+ * the widened pixels, so both entry points agree on it.
+ */
+#define PACKED_CHUNK	64
+
+static uint32_t _row_packed(uint32_t *dst, const unsigned char *src, int n, int bpp, uint32_t h)
+{
+	uint32_t raw[PACKED_CHUNK * 3 / 4 + 2];
+	const unsigned char *p;
+	unsigned long start;
+	uint32_t v, px;
+	int k, i, words, d0, d1, d2;
 
-        int scanline = fb->curmode.xres * 4;
-        unsigned char * lineaddr;
-        int i;
+	while (n > 0)
+	{
+		k = (n < PACKED_CHUNK) ? n : PACKED_CHUNK;
+		start = (unsigned long)src & ~3UL;
+		words = ((unsigned long)src + k * bpp - start + 3) / 4;
+		asm volatile("rep movsl"
+			: "=S" (d0), "=D" (d1), "=c" (d2)
+			: "0" (start), "1" (raw), "2" (words)
+			: "memory");
 
-        uint32_t sum = 0;
+		p = (const unsigned char *)raw + ((unsigned long)src & 3);
+		for (i = 0; i < k; i++, p += bpp)
+		{
+			if (bpp == 2)
+			{
+				v = p[0] | (p[1] << 8);
+				px = ((v >> 8) & 0xF8) | ((v >> 13) & 0x07)
+				   | ((v << 5) & 0xFC00) | ((v >> 1) & 0x0300)
+				   | ((v << 19) & 0xF80000) | ((v << 14) & 0x070000);
+			} else
+				px = p[2] | (p[1] << 8) | (p[0] << 16);
 
-        for (i = 0; i < height; i++) {
-                lineaddr = fb->fbaddr + (i + y) * scanline + (4 * x);
+			h = HASH(h, px);
+			if (dst)
+				*(dst++) = px;
+		}
 
-                sum = crc32(lineaddr, width * 4, sum);
-        }
+		src += k * bpp;
+		n -= k;
+	}
 
-        return sum;
+	return h;
 }
 
-void copy_pixels_generic32(char *buf, int x, int y, int width, int height)
+static uint32_t _rect_packed(uint32_t *buf, int x, int y, int width, int height, int bpp)
 {
-	int cx, cy;
-	unsigned int *ibuf = (unsigned int *)buf;
-	unsigned int *fbuf;
-	for (cy = 0; cy < height; cy++)
+	uint32_t sum = 0;
+	int i;
+
+	for (i = 0; i < height; i++)
 	{
-		fbuf = (unsigned int *)fb->fbaddr;
-		fbuf += (cy + y) * (fb->curmode.xres) + x;
-		for (cx = 0; cx < width; cx++)
-			*(ibuf++) = *(fbuf++);
+		sum = _row_packed(buf, fb->fbaddr + (i + y) * fb->pitch + x * bpp,
+		                  width, bpp, sum);
+		if (buf)
+			buf += width;
 	}
+
+	return sum;
+}
+
+uint32_t checksum_rect_generic16(int x, int y, int width, int height)
+{
+	return _rect_packed(0, x, y, width, height, 2);
+}
+
+void copy_pixels_generic16(char *buf, int x, int y, int width, int height)
+{
+	_rect_packed((uint32_t *)buf, x, y, width, height, 2);
+}
+
+uint32_t copy_checksum_generic16(char *buf, int x, int y, int width, int height)
+{
+	return _rect_packed((uint32_t *)buf, x, y, width, height, 2);
+}
+
+uint32_t checksum_rect_generic24(int x, int y, int width, int height)
+{
+	return _rect_packed(0, x, y, width, height, 3);
+}
+
+void copy_pixels_generic24(char *buf, int x, int y, int width, int height)
+{
+	_rect_packed((uint32_t *)buf, x, y, width, height, 3);
+}
+
+uint32_t copy_checksum_generic24(char *buf, int x, int y, int width, int height)
+{
+	return _rect_packed((uint32_t *)buf, x, y, width, height, 3);
 }
@@ -1,7 +1,17 @@
 #ifndef _CHECKSUM_RECT_C
 #define _CHECKSUM_RECT_H
 
+void generic_init();
+void generic_xmm_save();
+void generic_xmm_restore();
 uint32_t checksum_rect_generic32(int x, int y, int width, int height);
 void copy_pixels_generic32(char *buf, int x, int y, int width, int height);
+uint32_t copy_checksum_generic32(char *buf, int x, int y, int width, int height);
+uint32_t checksum_rect_generic16(int x, int y, int width, int height);
+void copy_pixels_generic16(char *buf, int x, int y, int width, int height);
+uint32_t copy_checksum_generic16(char *buf, int x, int y, int width, int height);
+uint32_t checksum_rect_generic24(int x, int y, int width, int height);
+void copy_pixels_generic24(char *buf, int x, int y, int width, int height);
+uint32_t copy_checksum_generic24(char *buf, int x, int y, int width, int height);
 
 #endif
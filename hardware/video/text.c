@@ -9,16 +9,73 @@
  */
 
 #include <io.h>
+#include <cpuid.h>
 #include <text.h>
 #include <paging.h>
 #include <minilib.h>
 #include <stdint.h>
 #include <output.h>
 #include <smram.h>
-#include <crc32.h>
 #include <video_defines.h>
 
-static unsigned char _font[256 * 32];
+#include "generic.h"
+
+#define TEXT_FONT_HEIGHT	16
+#define TEXT_MAX_COLS		132
+#define TEXT_MAX_ROWS		48	/* 768 lines of TEXT_FONT_HEIGHT */
+#define TEXT_MAX_CELLS		(TEXT_MAX_COLS * TEXT_MAX_ROWS)
+
+/* Only the rows that are drawn; plane 2 has 32 per glyph. */
+static unsigned char _font[256 * TEXT_FONT_HEIGHT];
+
+/* Width of a character cell in pixels; 8 or 9, from the sequencer. */
+static int _cell_w = 8;
+
+/* The 16 text colors, already in the FB_RGB888 layout that RFB clients
+ * are told about (red in the low byte). */
+#define RGB(r, g, b)	((r) | ((g) << 8) | ((b) << 16))
+static const uint32_t _palette[16] = {
+	RGB(0x00, 0x00, 0x00), RGB(0x00, 0x00, 0xAA),
+	RGB(0x00, 0xAA, 0x00), RGB(0x00, 0xAA, 0xAA),
+	RGB(0xAA, 0x00, 0x00), RGB(0xAA, 0x00, 0xAA),
+	RGB(0xAA, 0x55, 0x00), RGB(0xAA, 0xAA, 0xAA),
+	RGB(0x55, 0x55, 0x55), RGB(0x55, 0x55, 0xFF),
+	RGB(0x55, 0xFF, 0x55), RGB(0x55, 0xFF, 0xFF),
+	RGB(0xFF, 0x55, 0x55), RGB(0xFF, 0x55, 0xFF),
+	RGB(0xFF, 0xFF, 0x55), RGB(0xFF, 0xFF, 0xFF),
+};
+
+/* EXPAND(b)[i] is all ones if pixel i of font byte b is lit.  Each row
+ * has three zero words before it and after it, so that the SSE2 renderer
+ * can load any four consecutive pixels of a glyph row, with background
+ * beyond its ends, from anywhere between 3 pixels before the row and 3
+ * after; that is how it lines cells up for 9-dot modes without shifting
+ * anything.  Rows are EXPAND_ROW words apart, and share their padding. */
+#define EXPAND_PAD	3
+#define EXPAND_ROW	(8 + EXPAND_PAD)
+#define EXPAND(b)	(_expand + EXPAND_PAD + (b) * EXPAND_ROW)
+static uint32_t _expand[EXPAND_PAD + 256 * EXPAND_ROW];
+
+#define CPUID_1_EDX_SSE2	(1 << 26)
+static int _use_sse2 = 0;
+
+/* Damage tracking.  Rather than checksumming text memory for every region
+ * that somebody asks about, we keep a shadow copy of the char/attr grid,
+ * and compare it against VGA memory at most once per SMI.  Every cell
+ * remembers the scan generation in which it last changed; a region's
+ * "checksum" is then just the newest generation of any cell in it, which
+ * changes exactly when one of its cells does.  Rendering is done from the
+ * shadow, too, so that what gets drawn is what was checksummed.
+ */
+static uint16_t _shadow[TEXT_MAX_CELLS] __attribute__((aligned(4)));
+static uint32_t _cellgen[TEXT_MAX_CELLS];
+static uint32_t _gen = 0;
+static int _cols = 80, _rows = 25;
+static int _stride = 160;	/* Bytes from one row to the next in VRAM. */
+static int _shadow_cols = 0, _shadow_rows = 0, _shadow_stride = 0;
+static char *_shadow_base = 0;
+static unsigned int _scanned_frame = ~0U;
+static int _changed = 0;
 
 /* XXX reunify this with vga-overlay? */
 #define VRAM_BASE		0xA0000UL
@@ -41,11 +98,138 @@ static char * vga_base()
 	);
 }
 
+/* Fill in the geometry of the current text mode from the VGA CRTC and
+ * sequencer. */
+void text_getvmode(struct vmode *mode)
+{
+	unsigned char seqsave = inb(0x3C4);
+
+	outb(0x3C4, 0x01 /* Clocking mode */);
+	_cell_w = (inb(0x3C5) & 0x01) ? 8 : 9;
+	outb(0x3C4, seqsave);
+
+	mode->xres = (vga_read(0x01) + 1) * _cell_w;
+	mode->yres = (vga_read(0x12) | (vga_read(0x07) & 0x02) << 7
+	              | (vga_read(0x07) & 0x40) << 3) + 1;
+	mode->text = 1;
+	mode->format = FB_RGB888;	/* What text_render produces. */
+	mode->bytestride = 4;
+
+	_cols = mode->xres / _cell_w;
+	_rows = mode->yres / TEXT_FONT_HEIGHT;
+	if (_cols > TEXT_MAX_COLS)
+		_cols = TEXT_MAX_COLS;
+	if (_rows > TEXT_MAX_ROWS)
+		_rows = TEXT_MAX_ROWS;
+	_cols &= ~1;	/* We compare two cells at a time. */
+
+	/* The CRTC offset register counts in words of character/attribute
+	 * pairs, so 40 means 160 bytes for 80 columns, 66 means 264 for
+	 * 132.  It can be set wider than the screen, but never narrower. */
+	_stride = vga_read(0x13) * 4;
+	if (_stride < _cols * 2)
+		_stride = _cols * 2;
+}
+
+/* Compare VGA text memory against the shadow, if that hasn't already been
+ * done in this fb_frame.  Returns the current generation.
+ */
+uint32_t text_scan()
+{
+	const uint32_t *video;
+	uint32_t *shadow;
+	uint32_t v, diff;
+	char *base;
+	int i, n, row, cell, bumped = 0;
+	smram_state_t old_state;
+
+	if (_scanned_frame == fb_frame)
+		return _gen;
+	_scanned_frame = fb_frame;
+	_changed = 0;
+
+	base = vga_base();
+	n = _rows * _cols;
+
+	/* A moved start address means the whole screen scrolled (or
+	 * flipped); a new geometry means it is a different screen
+	 * altogether.  Either way, everything is damaged. */
+	if (base != _shadow_base || _cols != _shadow_cols || _rows != _shadow_rows
+	    || _stride != _shadow_stride)
+	{
+		_gen++;
+		bumped = 1;
+		for (i = 0; i < n; i++)
+			_cellgen[i] = _gen;
+		_changed = n;
+		_shadow_base = base;
+		_shadow_cols = _cols;
+		_shadow_rows = _rows;
+		_shadow_stride = _stride;
+	}
+
+	old_state = smram_save_state();
+	smram_aseg_set_state(SMRAM_ASEG_SMMCODE);
+
+	/* The shadow is packed, _cols cells to a row; VRAM is _stride
+	 * bytes to a row. */
+	for (row = 0; row < _rows; row++)
+	{
+		video = (const uint32_t *)(base + row * _stride);
+		shadow = (uint32_t *)(_shadow + row * _cols);
+		for (i = 0; i < _cols / 2; i++)
+		{
+			v = video[i];
+			diff = v ^ shadow[i];
+			if (!diff)
+				continue;
+
+			shadow[i] = v;
+			if (bumped && _changed == n)
+				continue;
+			if (!bumped)
+			{
+				_gen++;
+				bumped = 1;
+			}
+			cell = row * _cols + i * 2;
+			if (diff & 0xFFFF)
+			{
+				_cellgen[cell] = _gen;
+				_changed++;
+			}
+			if (diff >> 16)
+			{
+				_cellgen[cell + 1] = _gen;
+				_changed++;
+			}
+		}
+	}
+
+	smram_restore_state(old_state);
+
+	return _gen;
+}
+
 /* Must be called from a firstrun context, where we don't care about saving
  * 0x3CE state. */
 void text_init()
 {
+	struct cpuid_result r;
 	unsigned char oldread;
+	int b, i;
+	const unsigned char *plane2;
+
+	cpuid(0, &r);
+	if (r.eax >= 1)
+	{
+		cpuid(1, &r);
+		_use_sse2 = (r.edx & CPUID_1_EDX_SSE2) ? 1 : 0;
+	}
+
+	for (b = 0; b < 256; b++)
+		for (i = 0; i < 8; i++)
+			EXPAND(b)[i] = (b & (0x80 >> i)) ? 0xFFFFFFFF : 0;
 
 	smram_state_t old_state = smram_save_state();
 	outb(0x3CE, 0x06 /* Miscellaneous */);
@@ -59,7 +243,10 @@ void text_init()
 	outb(0x3CF, 0x02 /* Font plane */);
 
 	smram_aseg_set_state(SMRAM_ASEG_SMMCODE);
-	memcpy(_font, p2v(0xB8000), sizeof(_font));
+	plane2 = p2v(0xB8000);
+	for (b = 0; b < 256; b++)
+		memcpy(_font + b * TEXT_FONT_HEIGHT, plane2 + b * 32,
+		       TEXT_FONT_HEIGHT);
 	smram_restore_state(old_state);
 
 	outb(0x3CF, oldread);
@@ -71,75 +258,296 @@ void text_init()
 	outb(0x3C5, inb(0x3C5) & ~0x04);
 }
 
+/* Rendering goes a cell at a time, down as many of the cell's pixel rows
+ * as the rectangle covers, so that the colors and the glyph are looked up
+ * once per cell rather than once per row.  out is where the cell's first
+ * pixel goes, and pitch is the rectangle's width in pixels.
+ *
+ * In 9-dot modes, the line-drawing characters have their 8th column
+ * stretched into the 9th; everything else gets background.  We assume that
+ * Line Graphics Enable is set, as the BIOS leaves it.
+ */
+
+/* Pixels skip..skip+n-1 of the cell, for the edges of the rectangle, and
+ * for everything on CPUs without SSE2. */
+static void _cell_part(uint32_t *out, int pitch, unsigned char ch, unsigned char at,
+                       int line, int lines, int skip, int n)
+{
+	uint32_t bg = _palette[(at >> 4) & 0x07];
+	uint32_t diff = _palette[at & 0x0F] ^ bg;
+	const unsigned char *font = _font + ch * TEXT_FONT_HEIGHT + line;
+	const uint32_t *mask;
+	int lg = (ch & 0xE0) == 0xC0;
+	int end = skip + n;
+	int i;
+
+	out -= skip;
+	for (; lines; lines--, out += pitch)
+	{
+		mask = EXPAND(*(font++));
+		for (i = skip; i < end && i < 8; i++)
+			out[i] = bg ^ (diff & mask[i]);
+		if (end == 9)
+			out[8] = lg ? (bg ^ (diff & mask[7])) : bg;
+	}
+}
+
+/* A cell, or part of one, as two XMM words per row: the first four pixels
+ * and the last four, overlapping as need be, straight out of the padded
+ * EXPAND rows.  A whole 9-dot cell is the first eight pixels and then the
+ * 9th by itself, which is background, or for line-drawing characters, a
+ * copy of the 8th; the three loops differ only in that.  Part of a cell
+ * never ends in a line-drawing character's 9th pixel; _cell_part does
+ * those.
+ *
+ * Fewer than four pixels still take a whole XMM word, spilling into the
+ * next cell if this is the left edge of the rectangle (skip is nonzero),
+ * or into the one before if it is the right edge, so the caller has to
+ * draw that cell afterwards.
+ *
+ * %2 and %3 are where the two words come from in the glyph row, and %4 is
+ * how far apart they go in the output.  xmm0 is the background and xmm1
+ * the foreground XOR background, both in every lane. */
+#define CELL_LOOP(ninth) \
+	asm volatile( \
+		"movd %7, %%xmm0\n" \
+		"pshufd $0, %%xmm0, %%xmm0\n" \
+		"movd %8, %%xmm1\n" \
+		"pshufd $0, %%xmm1, %%xmm1\n" \
+		"1:\n" \
+		"movzbl (%1), %%eax\n" \
+		"imul %9, %%eax, %%eax\n" \
+		"movdqu %c6(%%eax,%2), %%xmm2\n" \
+		"movdqu %c6(%%eax,%3), %%xmm3\n" \
+		"pand %%xmm1, %%xmm2\n" \
+		"pand %%xmm1, %%xmm3\n" \
+		"pxor %%xmm0, %%xmm2\n" \
+		"pxor %%xmm0, %%xmm3\n" \
+		"movdqu %%xmm2, (%0)\n" \
+		"movdqu %%xmm3, (%0,%4)\n" \
+		ninth \
+		"add %10, %0\n" \
+		"inc %1\n" \
+		"cmp %5, %1\n" \
+		"jne 1b\n" \
+		: "+r" (out), "+r" (font) \
+		: "r" (first * 4), "r" (last * 4), "r" ((last - first) * 4), \
+		  "m" (end), "i" (EXPAND(0)), "m" (bg), "m" (diff), \
+		  "i" (EXPAND_ROW * 4), "m" (stride) \
+		: "eax", "memory", "cc")
+
+static void _cell_sse2(uint32_t *out, int pitch, unsigned char ch, unsigned char at,
+                       int line, int lines, int skip, int n)
+{
+	uint32_t bg = _palette[(at >> 4) & 0x07];
+	uint32_t diff = _palette[at & 0x0F] ^ bg;
+	const unsigned char *font = _font + ch * TEXT_FONT_HEIGHT + line;
+	const unsigned char *end = font + lines;
+	int first = skip, last = skip + n - 4;
+	int stride = pitch * 4;
+
+	if (n == 9)
+		last = 4;
+	else if (n < 4 && skip)
+		last = first;
+	else if (n < 4)
+	{
+		first = last;
+		out += last;
+	}
+
+	if (n < 9)
+		CELL_LOOP("");
+	else if ((ch & 0xE0) != 0xC0)
+		CELL_LOOP("movd %%xmm0, 32(%0)\n");
+	else
+		CELL_LOOP("pshufd $0xFF, %%xmm3, %%xmm3\n"
+		          "movd %%xmm3, 32(%0)\n");
+}
+
+/* In 9-dot modes, a cell is 36 bytes, so _cell_sse2's stores straddle
+ * XMM words and mostly cross cache lines too, which costs about as much
+ * as all the rest of the work.  Four cells, though, are nine whole XMM
+ * words; where four cells in a row share an attribute, they go together.
+ * Each word is then at most two loads from the padded EXPAND rows, ORed:
+ * the first is pixels 0-3 of the first cell, the third is the first
+ * cell's 9th pixel and pixels 0-2 of the second, and so on.  %1 walks
+ * down the first cell's glyph, and %2-%4 are how far the others' glyphs
+ * are from it.  Line-drawing characters get their 9th column copied over
+ * afterwards. */
+static int _group_ok(const unsigned char *cells)
+{
+	return cells[3] == cells[1] && cells[5] == cells[1] && cells[7] == cells[1];
+}
+
+#define GROUP_WORD(src, to) \
+	"movdqu " src ", %%xmm2\n" \
+	"pand %%xmm1, %%xmm2\n" \
+	"pxor %%xmm0, %%xmm2\n" \
+	"movdqu %%xmm2, " to "\n"
+
+#define GROUP_SPLIT(reg, src, to) \
+	"movdqu " src ", %%xmm2\n" \
+	"por %%xmm2, " reg "\n" \
+	"pand %%xmm1, " reg "\n" \
+	"pxor %%xmm0, " reg "\n" \
+	"movdqu " reg ", " to "\n"
+
+#define GROUP_GLYPH(f) \
+	"movzbl " f ", %%eax\n" \
+	"imul %10, %%eax, %%eax\n"
+
+static void _group_sse2(uint32_t *out, int pitch, const unsigned char *cells,
+                        int line, int lines)
+{
+	unsigned char at = cells[1];
+	uint32_t bg = _palette[(at >> 4) & 0x07];
+	uint32_t diff = _palette[at & 0x0F] ^ bg;
+	const unsigned char *font = _font + cells[0] * TEXT_FONT_HEIGHT + line;
+	const unsigned char *end = font + lines;
+	int d1 = (cells[2] - cells[0]) * TEXT_FONT_HEIGHT;
+	int d2 = (cells[4] - cells[0]) * TEXT_FONT_HEIGHT;
+	int d3 = (cells[6] - cells[0]) * TEXT_FONT_HEIGHT;
+	uint32_t *first = out, *ninth;
+	int stride = pitch * 4;
+	int c, i;
+
+	asm volatile(
+		"movd %8, %%xmm0\n"
+		"pshufd $0, %%xmm0, %%xmm0\n"
+		"movd %9, %%xmm1\n"
+		"pshufd $0, %%xmm1, %%xmm1\n"
+		"1:\n"
+		GROUP_GLYPH("(%1)")
+		GROUP_WORD("%c7(%%eax)", "(%0)")
+		GROUP_WORD("%c7+16(%%eax)", "16(%0)")
+		GROUP_GLYPH("(%1,%2)")
+		"movdqu %c7+28(%%eax), %%xmm4\n"
+		GROUP_WORD("%c7-4(%%eax)", "32(%0)")
+		GROUP_WORD("%c7+12(%%eax)", "48(%0)")
+		GROUP_GLYPH("(%1,%3)")
+		"movdqu %c7+24(%%eax), %%xmm5\n"
+		GROUP_SPLIT("%%xmm4", "%c7-8(%%eax)", "64(%0)")
+		GROUP_WORD("%c7+8(%%eax)", "80(%0)")
+		GROUP_GLYPH("(%1,%4)")
+		GROUP_SPLIT("%%xmm5", "%c7-12(%%eax)", "96(%0)")
+		GROUP_WORD("%c7+4(%%eax)", "112(%0)")
+		GROUP_WORD("%c7+20(%%eax)", "128(%0)")
+		"add %6, %0\n"
+		"inc %1\n"
+		"cmp %5, %1\n"
+		"jne 1b\n"
+		: "+r" (out), "+r" (font)
+		: "r" (d1), "r" (d2), "r" (d3), "m" (end), "m" (stride),
+		  "i" (EXPAND(0)), "m" (bg), "m" (diff), "i" (EXPAND_ROW * 4)
+		: "eax", "memory", "cc");
+
+	for (c = 0; c < 4; c++)
+		if ((cells[c * 2] & 0xE0) == 0xC0)
+			for (i = 0, ninth = first + c * 9 + 8; i < lines;
+			     i++, ninth += pitch)
+				*ninth = ninth[-1];
+}
+
 void text_render(char *buf, int x, int y, int w, int h)
 {
-	unsigned char *video = (unsigned char *)vga_base();
-	unsigned int textx = x / 9;
-	unsigned int texty = y / 16;
-	unsigned int cx, cy;
-	unsigned char ch, at, font;
-	smram_state_t old_state = smram_save_state();
-/*
-	outputf("text_render: (%d,%d),(%d,%d)", x, y, w, h);
-*/	
-	smram_aseg_set_state(SMRAM_ASEG_SMMCODE);
-	for (cy = y; cy < (y + h); cy++)
+	const unsigned char *cells;
+	uint32_t *out = (uint32_t *)buf;
+	uint32_t *dst;
+	int cy, line, texty, lines, px, c, skip, n, i;
+	int c0 = x / _cell_w, skip0 = x % _cell_w;
+	int right = x + w, rc = right / _cell_w, rn = right % _cell_w;
+
+	if (w <= 0)
+		return;
+
+	text_scan();
+
+	/* A sliver of a cell at the right edge would spill to the left, so
+	 * it goes first; see _cell_sse2. */
+	if (!_use_sse2 || w < 8 || rn >= 4 || rc >= _cols)
+		rn = 0;
+	right -= rn;
+
+	if (_use_sse2)
+		generic_xmm_save();
+
+	for (cy = y; cy < (y + h); cy += lines, out += lines * w)
 	{
-		cx = x;
-		texty = cy / 16;
-		textx = cx / 9;
-		ch = video[texty * 160 + textx * 2];
-		at = video[texty * 160 + textx * 2 + 1];
-		font = _font[ch * 32 + cy % 16];
-		for (cx = x; cx < (x + w); cx++)
+		line = cy % TEXT_FONT_HEIGHT;
+		texty = cy / TEXT_FONT_HEIGHT;
+		lines = TEXT_FONT_HEIGHT - line;
+		if (lines > y + h - cy)
+			lines = y + h - cy;
+
+		if (texty >= _rows)
 		{
-			unsigned int pos = cx % 8;
-			if (pos == 0)
+			memset(out, 0, lines * w * 4);
+			continue;
+		}
+
+		cells = (const unsigned char *)(_shadow + texty * _cols);
+		if (rn)
+			_cell_sse2(out + w - rn, w, cells[rc * 2],
+			           cells[rc * 2 + 1], line, lines, 0, rn);
+
+		dst = out;
+		px = x;
+		for (c = c0, skip = skip0; px < right; c++, skip = 0)
+		{
+			n = _cell_w - skip;
+			if (n > right - px)
+				n = right - px;
+
+			if (c >= _cols)
 			{
-				textx = cx / 8;
-				ch = video[texty * 160 + textx * 2];
-				at = video[texty * 160 + textx * 2 + 1];
-				font = _font[ch * 32 + cy % 16];
-			}
-			/* XXX always BGR888 */
-			if (pos == 8)	/* 9th pixel is cloned */
-				pos = 7;
-			if ((font >> (7 - pos)) & 1)
+				/* Off the right of the text: black. */
+				n = right - px;
+				for (i = 0; i < lines; i++)
+					memset(dst + i * w, 0, n * 4);
+			} else if (!_use_sse2 || (n < 4 && w < 8) || (skip &&
+			           skip + n == 9 && (cells[c * 2] & 0xE0) == 0xC0))
+				_cell_part(dst, w, cells[c * 2], cells[c * 2 + 1],
+				           line, lines, skip, n);
+			else if (_cell_w == 9 && !skip && c + 4 <= _cols &&
+			         px + 36 <= right && _group_ok(cells + c * 2))
 			{
-				*(buf++) = (at & 0x01) ? 0xFF : 0x00;
-				*(buf++) = (at & 0x02) ? 0xFF : 0x00;
-				*(buf++) = (at & 0x04) ? 0xFF : 0x00;
-			} else {
-				*(buf++) = (at & 0x10) ? 0xFF : 0x00;
-				*(buf++) = (at & 0x20) ? 0xFF : 0x00;
-				*(buf++) = (at & 0x40) ? 0xFF : 0x00;
-			}
-			*(buf++) = 0;
+				_group_sse2(dst, w, cells + c * 2, line, lines);
+				n = 36;
+				c += 3;
+			} else
+				_cell_sse2(dst, w, cells[c * 2], cells[c * 2 + 1],
+				           line, lines, skip, n);
+
+			dst += n;
+			px += n;
 		}
 	}
-	smram_restore_state(old_state);
+
+	if (_use_sse2)
+		generic_xmm_restore();
 }
 
 uint32_t text_checksum(int x, int y, int w, int h)
 {
-	unsigned char *video = (unsigned char *)vga_base();
-	unsigned int textx = x / 8;
-	unsigned int texty = y / 16;
-	int cx, cy;
-	uint32_t cksm = 0;
-	smram_state_t old_state = smram_save_state();
-	
-	smram_aseg_set_state(SMRAM_ASEG_SMMCODE);
-	
-	for (cy = y; cy < (y + h); cy++)
-	{
-		cx = x;
-		texty = cy / 16;
-		textx = cx / 8;
-		cksm = crc32(video + texty * 160 + textx * 2, (w / 8) * 2 + 2, cksm);	/* Err on the side of 'too many'. */
-	}
-	
-	smram_restore_state(old_state);
-	
-	return cksm;
+	int col0 = x / _cell_w;
+	int col1 = (x + w - 1) / _cell_w;
+	int row0 = y / TEXT_FONT_HEIGHT;
+	int row1 = (y + h - 1) / TEXT_FONT_HEIGHT;
+	int row, col;
+	uint32_t newest = 0;
+
+	text_scan();
+
+	if (col1 >= _cols)
+		col1 = _cols - 1;
+	if (row1 >= _rows)
+		row1 = _rows - 1;
+
+	for (row = row0; row <= row1; row++)
+		for (col = col0; col <= col1; col++)
+			if (_cellgen[row * _cols + col] > newest)
+				newest = _cellgen[row * _cols + col];
+
+	return newest;
 }
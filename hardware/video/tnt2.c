@@ -15,13 +15,16 @@
 #include <fb.h>
 #include <paging.h>
 #include <text.h>
+#include <vga.h>
 
 #include "generic.h"
 
 static void tnt2_getvmode(void *priv);
+static uint32_t tnt2_getsig(void *priv);
 
 static struct fbdevice tnt2_fb = {
 	.getvmode = &tnt2_getvmode,
+	.getsig = &tnt2_getsig,
 };
 
 static unsigned int vgard(unsigned char a)
@@ -30,6 +33,26 @@ static unsigned int vgard(unsigned char a)
 	return (unsigned int)inb(0x3D5);
 }
 
+/* Any mode set changes the pixel depth (CR28) or the width (CR01), and
+ * those are two of the five registers that getvmode reads.  In the plain
+ * VGA modes, text and graphics can share both, so the graphics
+ * controller's alphanumeric bit goes in as well.  Anything subtler waits
+ * for fb_checkmode's periodic full read. */
+static uint32_t tnt2_getsig(void *priv)
+{
+	uint32_t sig = vgard(0x28) | (vgard(0x01) << 8);
+	unsigned char gcidx;
+
+	if ((sig & 0xFF) == 0)
+	{
+		gcidx = inb(0x3CE);
+		outb(0x3CE, 0x06 /* Miscellaneous */);
+		sig |= (inb(0x3CF) & 0x01) << 16;
+		outb(0x3CE, gcidx);
+	}
+	return sig;
+}
+
 static void tnt2_getvmode(void *priv)
 {
 	tnt2_fb.curmode.xres = (vgard(0x1) + 1) * 8;
@@ -40,18 +63,26 @@ static void tnt2_getvmode(void *priv)
 		tnt2_fb.curmode.format = FB_RGB888;
 		tnt2_fb.curmode.bytestride = 4;
 		tnt2_fb.curmode.text = 0;
+		tnt2_fb.pitch = tnt2_fb.curmode.xres * 4;
 		tnt2_fb.checksum_rect = checksum_rect_generic32;
 		tnt2_fb.copy_pixels = copy_pixels_generic32;
+		tnt2_fb.copy_checksum = copy_checksum_generic32;
 		break;
 	case 0:
-		tnt2_fb.curmode.text = 1;
+		/* Plain VGA: either text, or one of the standard
+		 * graphics modes. */
+		if (vga_getvmode(&tnt2_fb))
+			break;
+		text_getvmode(&tnt2_fb.curmode);
 		tnt2_fb.checksum_rect = text_checksum;
 		tnt2_fb.copy_pixels = text_render;
+		tnt2_fb.copy_checksum = 0;
 		break;
 	default:
-		tnt2_fb.curmode.text = 1;
+		text_getvmode(&tnt2_fb.curmode);
 		tnt2_fb.checksum_rect = text_checksum;
 		tnt2_fb.copy_pixels = text_render;
+		tnt2_fb.copy_checksum = 0;
 		outputf("Unknown TNT2 format %x", vgard(0x28));
 		break;
 	}
@@ -72,6 +103,7 @@ static int tnt2_probe(struct pci_dev *pci, void *data)
 		addmap_4m(0x40000000 + p*1024*1024, pci->bars[1].addr + p*1024*1024);
 	tnt2_fb.fbaddr = (void *)0x40000000;
 	
+	generic_init();
 	fb = &tnt2_fb;
 	outputf("Found TNT2 with FB at %08x, mapped to %08x", pci->bars[1].addr, tnt2_fb.fbaddr);
 	return 1;
@@ -0,0 +1,545 @@
+/* vga.c
+ * Capture of standard VGA graphics modes (planar and 8bpp)
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <io.h>
+#include <minilib.h>
+#include <stdint.h>
+#include <output.h>
+#include <smram.h>
+#include <fb.h>
+#include <vga.h>
+#include <video_defines.h>
+
+/* BIOS setup screens and bootloaders like to use mode 12h (640x480,
+ * 16 colors, planar) and mode 13h (320x200, 256 colors, chained); either
+ * way, what is in memory is a palette index per pixel.  We hand those out
+ * as FB_PAL8: copy_indices gives the raw DAC indices, so that an RFB client
+ * that asked for a color map can have them as they are, and copy_pixels
+ * runs them through the DAC for everybody else.
+ *
+ * The registers that we need to touch to get at the planes are put back
+ * the way we found them.
+ */
+
+#define GC_IDX_REG		0x3CE
+#define GC_DATA_REG		0x3CF
+#define GC_READ_MAP		0x04
+#define GC_MODE			0x05
+#define GC_MISC			0x06
+
+#define GC_MODE_READ1		0x08
+#define GC_MODE_INTERLEAVE	0x20
+#define GC_MODE_256		0x40
+#define GC_MISC_GRAPHICS	0x01
+
+#define SEQ_IDX_REG		0x3C4
+#define SEQ_DATA_REG		0x3C5
+#define SEQ_MEMORY_MODE		0x04
+#define SEQ_MEMORY_CHAIN4	0x08
+
+#define ATC_REG			0x3C0
+#define ATC_READ_REG		0x3C1
+#define ATC_PAS			0x20
+#define ATC_MODE		0x10
+#define ATC_COLOR_SELECT	0x14
+#define ATC_MODE_P54S		0x80
+#define INPUT_STATUS_1		0x3DA
+
+#define DAC_READ_IDX_REG	0x3C7
+#define DAC_WRITE_IDX_REG	0x3C8
+#define DAC_DATA_REG		0x3C9
+
+#define HASH(h, w)	(((h) ^ (w)) * 0x9E3779B1)
+
+enum vga_layout {
+	VGA_PLANAR16,	/* Four planes, one bit per pixel in each. */
+	VGA_UNCHAINED,	/* "Mode X": byte pixels, plane = x & 3. */
+	VGA_CHAIN4,	/* Byte pixels, linear to the CPU. */
+	VGA_LINEAR	/* Byte pixels in an SVGA's LFB; see vga_linear8. */
+};
+
+static enum vga_layout _layout;
+static int _warned_cga = 0;
+static unsigned char *_window;
+static unsigned char *_base;
+static int _stride;
+static int _start_mul;
+
+/* The start address and the palette can change without the mode changing,
+ * so they are looked at again (lazily) on each new fb_frame. */
+static unsigned int _frame;
+
+/* The palette, already in RFB's RGB888 layout; _map16 takes 4-bit planar
+ * pixels to DAC indices through the attribute controller. */
+static uint32_t _palette[256];
+static uint8_t _map16[16];
+static uint32_t _pal_hash;
+static int _pal_valid = 0;
+static int _dac8 = 0;
+
+/* _bits8[b] has byte i set to bit (7 - i) of b: one planar byte, spread
+ * out into eight pixels. */
+static uint64_t _bits8[256];
+static int _bits8_built = 0;
+
+static unsigned char crtc_read(unsigned char idx)
+{
+	outb(CRTC_IDX_REG, idx);
+	return inb(CRTC_DATA_REG);
+}
+
+static unsigned char gc_read(unsigned char idx)
+{
+	outb(GC_IDX_REG, idx);
+	return inb(GC_DATA_REG);
+}
+
+static void gc_write(unsigned char idx, unsigned char val)
+{
+	outb(GC_IDX_REG, idx);
+	outb(GC_DATA_REG, val);
+}
+
+static void _set_base()
+{
+	int start = (crtc_read(CRTC_START_ADDR_MSB_IDX) << 8)
+	            | crtc_read(CRTC_START_ADDR_LSB_IDX);
+
+	_base = _window + start * _start_mul;
+}
+
+static void _refresh()
+{
+	if (_frame == fb_frame)
+		return;
+	_frame = fb_frame;
+	_pal_valid = 0;
+	if (_layout != VGA_LINEAR)
+		_set_base();
+}
+
+/* Read the DAC, and, for 16-color modes, the attribute controller palette.
+ * This is a good 800 port reads, so it is done at most once per SMI, and
+ * only if somebody is actually looking at the screen.
+ */
+static void _load_palette()
+{
+	unsigned char windex, atcidx, mode, csel, c;
+	uint8_t r, g, b;
+	uint32_t h = 0;
+	int i;
+
+	if (_pal_valid)
+		return;
+
+	/* We can put back the write index, but not a host that was half
+	 * way through writing an entry. */
+	windex = inb(DAC_WRITE_IDX_REG);
+	outb(DAC_READ_IDX_REG, 0);
+	for (i = 0; i < 256; i++)
+	{
+		r = inb(DAC_DATA_REG);
+		g = inb(DAC_DATA_REG);
+		b = inb(DAC_DATA_REG);
+		if (_dac8)
+			_palette[i] = r | (g << 8) | (b << 16);
+		else
+		{
+			r &= 0x3F;
+			g &= 0x3F;
+			b &= 0x3F;
+			_palette[i] = ((r << 2) | (r >> 4))
+			            | ((g << 2) | (g >> 4)) << 8
+			            | ((b << 2) | (b >> 4)) << 16;
+		}
+		h = HASH(h, _palette[i]);
+	}
+	outb(DAC_WRITE_IDX_REG, windex);
+
+	if (_layout == VGA_PLANAR16)
+	{
+		/* Keep PAS set throughout, or the screen blanks.  Reading
+		 * 0x3C1 does not move the ATC's flip-flop on to the index
+		 * again, so it is reset before every index write; otherwise
+		 * that write would land in a register as data. */
+		inb(INPUT_STATUS_1);
+		atcidx = inb(ATC_REG);
+		outb(ATC_REG, ATC_MODE | ATC_PAS);
+		mode = inb(ATC_READ_REG);
+		inb(INPUT_STATUS_1);
+		outb(ATC_REG, ATC_COLOR_SELECT | ATC_PAS);
+		csel = inb(ATC_READ_REG);
+		for (i = 0; i < 16; i++)
+		{
+			inb(INPUT_STATUS_1);
+			outb(ATC_REG, i | ATC_PAS);
+			c = inb(ATC_READ_REG);
+			if (mode & ATC_MODE_P54S)
+				c = (c & 0x0F) | ((csel & 0x03) << 4);
+			else
+				c &= 0x3F;
+			_map16[i] = c | ((csel & 0x0C) << 4);
+			h = HASH(h, _map16[i]);
+		}
+		inb(INPUT_STATUS_1);
+		outb(ATC_REG, atcidx);
+	}
+
+	_pal_hash = h;
+	_pal_valid = 1;
+}
+
+static const uint32_t *vga_getpalette(uint32_t *hash)
+{
+	_refresh();
+	_load_palette();
+	if (hash)
+		*hash = _pal_hash;
+	return _palette;
+}
+
+/* Pull one plane's worth of a rectangle of 16-color pixels into buf,
+ * setting bit 'plane' of each index. */
+static void _planar_plane(uint8_t *buf, int x, int y, int w, int h, int plane)
+{
+	const unsigned char *src;
+	uint8_t *dst;
+	uint8_t px[8];
+	uint64_t e;
+	int row, bx, b0 = x >> 3, b1 = (x + w - 1) >> 3;
+	int pos, i;
+
+	for (row = 0; row < h; row++)
+	{
+		src = _base + (y + row) * _stride;
+		dst = buf + row * w;
+
+		for (bx = b0; bx <= b1; bx++)
+		{
+			e = _bits8[src[bx]] << plane;
+			pos = bx * 8 - x;
+
+			if (pos >= 0 && pos + 8 <= w)
+			{
+				if (plane == 0)
+					memcpy(dst + pos, &e, 8);
+				else
+				{
+					uint64_t cur;
+					memcpy(&cur, dst + pos, 8);
+					cur |= e;
+					memcpy(dst + pos, &cur, 8);
+				}
+				continue;
+			}
+
+			/* Partial byte at either edge. */
+			memcpy(px, &e, 8);
+			for (i = 0; i < 8; i++)
+			{
+				if (pos + i < 0 || pos + i >= w)
+					continue;
+				if (plane == 0)
+					dst[pos + i] = px[i];
+				else
+					dst[pos + i] |= px[i];
+			}
+		}
+	}
+}
+
+static void _unchained_plane(uint8_t *buf, int x, int y, int w, int h, int plane)
+{
+	const unsigned char *src;
+	uint8_t *dst;
+	int row, xx;
+	int first = x + ((plane - x) & 3);	/* First pixel in this plane. */
+
+	for (row = 0; row < h; row++)
+	{
+		src = _base + (y + row) * _stride;
+		dst = buf + row * w - x;
+		for (xx = first; xx < x + w; xx += 4)
+			dst[xx] = src[xx >> 2];
+	}
+}
+
+void vga_copy_indices(char *buf, int x, int y, int w, int h)
+{
+	smram_state_t old_state;
+	unsigned char gcidx, readmap, mode;
+	uint8_t *out = (uint8_t *)buf;
+	int plane, row, i;
+
+	_refresh();
+
+	old_state = smram_save_state();
+	smram_aseg_set_state(SMRAM_ASEG_SMMCODE);
+
+	if (_layout == VGA_CHAIN4 || _layout == VGA_LINEAR)
+	{
+		for (row = 0; row < h; row++)
+			memcpy(out + row * w, _base + (y + row) * _stride + x, w);
+		smram_restore_state(old_state);
+		return;
+	}
+
+	gcidx = inb(GC_IDX_REG);
+	readmap = gc_read(GC_READ_MAP);
+	mode = gc_read(GC_MODE);
+	gc_write(GC_MODE, mode & ~GC_MODE_READ1);
+
+	for (plane = 0; plane < 4; plane++)
+	{
+		gc_write(GC_READ_MAP, plane);
+		if (_layout == VGA_PLANAR16)
+			_planar_plane(out, x, y, w, h, plane);
+		else
+			_unchained_plane(out, x, y, w, h, plane);
+	}
+
+	gc_write(GC_MODE, mode);
+	gc_write(GC_READ_MAP, readmap);
+	outb(GC_IDX_REG, gcidx);
+
+	smram_restore_state(old_state);
+
+	if (_layout == VGA_PLANAR16)
+	{
+		_load_palette();
+		for (i = 0; i < w * h; i++)
+			out[i] = _map16[out[i]];
+	}
+}
+
+void vga_copy_pixels(char *buf, int x, int y, int w, int h)
+{
+	uint32_t *out = (uint32_t *)buf;
+	const uint8_t *idx = (const uint8_t *)buf;
+	int i;
+
+	vga_copy_indices(buf, x, y, w, h);
+	_load_palette();
+
+	/* Expand in place, from the back, so that no index is overwritten
+	 * before it has been looked up. */
+	for (i = w * h - 1; i >= 0; i--)
+		out[i] = _palette[idx[i]];
+}
+
+/* Hash the raw memory behind a rectangle, rounded out to whole bytes in
+ * the 16-color modes, and the palette that it will be seen through. */
+uint32_t vga_checksum(int x, int y, int w, int h)
+{
+	smram_state_t old_state;
+	unsigned char gcidx, readmap, mode;
+	const unsigned char *src;
+	uint32_t sum;
+	int plane, row, b0, b1, bx;
+
+	_refresh();
+	_load_palette();
+	sum = _pal_hash;
+
+	if (_layout == VGA_PLANAR16)
+	{
+		b0 = x >> 3;
+		b1 = (x + w - 1) >> 3;
+	} else if (_layout == VGA_UNCHAINED) {
+		b0 = x >> 2;
+		b1 = (x + w - 1) >> 2;
+	} else {
+		b0 = x;
+		b1 = x + w - 1;
+	}
+
+	old_state = smram_save_state();
+	smram_aseg_set_state(SMRAM_ASEG_SMMCODE);
+
+	if (_layout == VGA_CHAIN4 || _layout == VGA_LINEAR)
+	{
+		for (row = 0; row < h; row++)
+		{
+			src = _base + (y + row) * _stride;
+			for (bx = b0; bx <= b1; bx++)
+				sum = HASH(sum, src[bx]);
+		}
+		smram_restore_state(old_state);
+		return sum;
+	}
+
+	gcidx = inb(GC_IDX_REG);
+	readmap = gc_read(GC_READ_MAP);
+	mode = gc_read(GC_MODE);
+	gc_write(GC_MODE, mode & ~GC_MODE_READ1);
+
+	for (plane = 0; plane < 4; plane++)
+	{
+		gc_write(GC_READ_MAP, plane);
+		for (row = 0; row < h; row++)
+		{
+			src = _base + (y + row) * _stride;
+			for (bx = b0; bx <= b1; bx++)
+				sum = HASH(sum, src[bx]);
+		}
+	}
+
+	gc_write(GC_MODE, mode);
+	gc_write(GC_READ_MAP, readmap);
+	outb(GC_IDX_REG, gcidx);
+
+	smram_restore_state(old_state);
+
+	return sum;
+}
+
+static void _build_bits8()
+{
+	int b, i;
+	uint8_t px[8];
+
+	for (b = 0; b < 256; b++)
+	{
+		for (i = 0; i < 8; i++)
+			px[i] = (b >> (7 - i)) & 1;
+		memcpy(&_bits8[b], px, 8);
+	}
+	_bits8_built = 1;
+}
+
+/* A cheap fingerprint of the VGA mode, for fb->getsig: the graphics
+ * controller mode and misc registers tell text from the various graphics
+ * layouts, and the horizontal display end catches most resolution changes.
+ */
+uint32_t vga_signature()
+{
+	unsigned char gcidx = inb(GC_IDX_REG);
+	uint32_t sig;
+
+	sig = gc_read(GC_MODE) | (gc_read(GC_MISC) << 8);
+	outb(GC_IDX_REG, gcidx);
+
+	return sig | (crtc_read(0x01) << 16);
+}
+
+static void _set_hooks(struct fbdevice *dev)
+{
+	dev->curmode.text = 0;
+	dev->curmode.format = FB_PAL8;
+	dev->curmode.bytestride = 1;
+	dev->checksum_rect = vga_checksum;
+	dev->copy_pixels = vga_copy_pixels;
+	dev->copy_checksum = 0;
+	dev->copy_indices = vga_copy_indices;
+	dev->getpalette = vga_getpalette;
+}
+
+/* If the VGA is in a graphics mode that we know how to read, fill in the
+ * mode and hooks in dev, and return 1.  Otherwise (text, or something odd
+ * like the CGA-compatible modes), return 0 and leave dev alone.
+ */
+int vga_getvmode(struct fbdevice *dev)
+{
+	unsigned char gcidx, seqidx, gcmode, gcmisc, seqmem;
+	unsigned char maxscan, underline, modectl;
+	int lines, scan;
+	static const unsigned long windows[4] = {
+		0xA0000, 0xA0000, 0xB0000, 0xB8000
+	};
+
+	gcidx = inb(GC_IDX_REG);
+	gcmode = gc_read(GC_MODE);
+	gcmisc = gc_read(GC_MISC);
+	outb(GC_IDX_REG, gcidx);
+
+	if (!(gcmisc & GC_MISC_GRAPHICS))
+	{
+		_warned_cga = 0;
+		return 0;
+	}
+
+	/* This gets called again for as long as the mode lasts, so only
+	 * say so the first time. */
+	if (gcmode & GC_MODE_INTERLEAVE)
+	{
+		if (!_warned_cga)
+			outputf("vga: CGA-style graphics mode not supported");
+		_warned_cga = 1;
+		return 0;
+	}
+	_warned_cga = 0;
+
+	seqidx = inb(SEQ_IDX_REG);
+	outb(SEQ_IDX_REG, SEQ_MEMORY_MODE);
+	seqmem = inb(SEQ_DATA_REG);
+	outb(SEQ_IDX_REG, seqidx);
+
+	if (!(gcmode & GC_MODE_256))
+		_layout = VGA_PLANAR16;
+	else if (seqmem & SEQ_MEMORY_CHAIN4)
+		_layout = VGA_CHAIN4;
+	else
+		_layout = VGA_UNCHAINED;
+
+	if (!_bits8_built)
+		_build_bits8();
+
+	maxscan = crtc_read(0x09);
+	underline = crtc_read(0x14);
+	modectl = crtc_read(0x17);
+
+	dev->curmode.xres = (crtc_read(0x01) + 1) * 8;
+	if (_layout != VGA_PLANAR16)
+		dev->curmode.xres /= 2;	/* Two dot clocks per pixel. */
+
+	lines = (crtc_read(0x12) | (crtc_read(0x07) & 0x02) << 7
+	         | (crtc_read(0x07) & 0x40) << 3) + 1;
+	scan = (maxscan & 0x1F) + 1;
+	if (maxscan & 0x80)
+		scan *= 2;
+	dev->curmode.yres = lines / scan;
+
+	/* Row offset and start address are in units that depend on the
+	 * CRTC's addressing mode. */
+	_stride = crtc_read(0x13) * 2;
+	_start_mul = 1;
+	if (underline & 0x40)
+	{
+		_stride *= 4;
+		_start_mul = 4;
+	} else if (!(modectl & 0x40))
+		_stride *= 2;
+
+	_window = (unsigned char *)windows[(gcmisc >> 2) & 3];
+	_set_base();
+	_frame = fb_frame;
+	_pal_valid = 0;
+	_dac8 = 0;
+
+	_set_hooks(dev);
+	return 1;
+}
+
+/* An SVGA's 8bpp modes are still looked up through the VGA DAC, but the
+ * pixels are in the card's own linear framebuffer, where the CRTC start
+ * address means nothing; the driver works out base and stride.  dac8 says
+ * that the DAC has been switched to 8 bits per channel.
+ */
+void vga_linear8(struct fbdevice *dev, unsigned char *base, int stride, int dac8)
+{
+	_layout = VGA_LINEAR;
+	_base = base;
+	_stride = stride;
+	_dac8 = dac8;
+	_frame = fb_frame;
+	_pal_valid = 0;
+
+	_set_hooks(dev);
+}
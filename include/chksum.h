@@ -0,0 +1,22 @@
+/* chksum.h
+ * Internet checksum routines
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#ifndef __CHKSUM_H
+#define __CHKSUM_H
+
+#include <stdint.h>
+
+/* Both return the folded, non-inverted ones' complement sum of the data, in
+ * memory byte order -- what lwIP expects of LWIP_CHKSUM.  chksum_copy also
+ * copies the data to dst on the way past. */
+extern uint16_t chksum(const void *data, uint16_t len);
+extern uint16_t chksum_copy(void *dst, const void *src, uint16_t len);
+
+#endif
@@ -17,12 +17,16 @@ struct fbdevice;
 struct vmode;
 
 typedef enum {
-	FB_RGB888
+	FB_RGB888,
+	FB_PAL8		/* Indices into a 256-entry palette. */
 } format_t;
 
 typedef void (*getvmode_t)(void *);
+typedef uint32_t (*getsig_t)(void *);
 typedef uint32_t (*checksum_rect_t)(int x, int y, int width, int height);
 typedef void (*copy_pixels_t)(char *buf, int x, int y, int width, int height);
+typedef uint32_t (*copy_checksum_t)(char *buf, int x, int y, int width, int height);
+typedef const uint32_t *(*getpalette_t)(uint32_t *hash);
 
 struct vmode {
 	int text:1;
@@ -32,14 +36,28 @@ struct vmode {
 
 struct fbdevice {
 	unsigned char *fbaddr;
+	int pitch;		/* Bytes from one scanline to the next at fbaddr. */
 	unsigned char *textbase;	/* A safe place to put a textfb. */
 	void *priv;
 	getvmode_t getvmode;
+	getsig_t getsig;	/* Optional; a few registers that change with the mode. */
 	checksum_rect_t checksum_rect;
 	copy_pixels_t copy_pixels;
+	copy_checksum_t copy_checksum;	/* Optional; copy_pixels and checksum_rect in one pass. */
+	/* FB_PAL8 only.  copy_pixels always gives RGB888; copy_indices gives
+	 * one byte per pixel, to be looked up in what getpalette returns. */
+	copy_pixels_t copy_indices;
+	getpalette_t getpalette;
 	struct vmode curmode;
 };
 
 extern struct fbdevice *fb;
 
+/* fb_frame is bumped on every SMI; anything read from the screen is stale
+ * once it changes.  fb_modegen is bumped whenever curmode changes. */
+extern unsigned int fb_frame;
+extern unsigned int fb_modegen;
+
+extern void fb_checkmode();
+
 #endif
@@ -0,0 +1,117 @@
+/* profile.h
+ * Per-SMI phase profiler
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdint.h>
+
+/* Each SMI is cut into phases by PROF_MARK(phase), which charges the TSC
+ * cycles since the previous mark (or since PROF_BEGIN()) to that phase.
+ * PROF_END() charges the whole SMI to PROF_TOTAL.  Every phase keeps a
+ * count, a total, a maximum and a histogram with one bucket per power of
+ * two, so that the occasional very slow SMI shows up rather than being
+ * averaged away.  The results are served over HTTP as /profile.txt and
+ * /profile.bin.
+ *
+ * Marks must be made in the order that the phases happen, so that
+ * nothing is counted twice, but a phase that does not happen on a given
+ * SMI can simply be left out.  The scheduler's tasks may run (and so be
+ * marked) several times in one SMI; each run counts separately.
+ *
+ * Define PROFILE to 0 to compile the whole thing out.
+ */
+
+#ifndef PROFILE
+#define PROFILE	1
+#endif
+
+enum prof_phase {
+	PROF_ENTRY = 0,		/* From the SMI to smi_entry(); see entry.asm */
+	PROF_UNBOTHER,		/* Saving state, pci_unbother_all */
+	PROF_GETVMODE,		/* fb_checkmode */
+	PROF_STATUS,		/* Status line */
+	PROF_ETH_POLL,		/* The tasks run by sched_run: receiving, */
+	PROF_RFB,		/* ... RFB updates, */
+	PROF_HTTPD,		/* ... HTTP responses, */
+	PROF_ETH_FLUSH,		/* ... and transmitting what they queued. */
+	PROF_SMI_POLL,		/* smi_poll, apart from the handlers */
+	PROF_SMI_TIMER,		/* The SMI_EVENT_* handlers, in order */
+	PROF_SMI_KBC,
+	PROF_SMI_GBL_RLS,
+	PROF_SMI_PWRBTN,
+	PROF_REBOTHER,		/* pci_bother_all, restoring state */
+	PROF_IDLE,		/* The whole of an SMI that had nothing to do */
+	PROF_TOTAL,		/* The whole of smi_entry */
+	PROF_MAX
+};
+
+/* So that smi_poll can find a handler's phase from its event. */
+#define PROF_SMI_HANDLER(ev)	(PROF_SMI_TIMER + (ev))
+
+#define PROF_BUCKETS	32	/* log2 of a 32-bit cycle count */
+#define PROF_NAME_LEN	12
+
+struct prof_stats {
+	char name[PROF_NAME_LEN];
+	uint32_t count;
+	uint32_t max;
+	uint64_t total;
+	uint32_t hist[PROF_BUCKETS];
+};
+
+extern struct prof_stats prof_stats[PROF_MAX];
+extern uint32_t prof_start, prof_last;
+
+extern void _prof_charge(enum prof_phase phase, uint32_t cycles);
+
+static inline uint32_t _prof_tsc(void)
+{
+	uint32_t tsc;
+
+	/* Ring 0, so CR4.TSD does not matter; see _trace(). */
+	asm volatile("rdtsc" : "=a" (tsc) : : "edx");
+	return tsc;
+}
+
+#if PROFILE
+
+#define PROF_BEGIN() do { \
+	prof_start = prof_last = _prof_tsc(); \
+} while (0)
+
+/* As PROF_BEGIN(), but for an SMI that started at tsc. */
+#define PROF_BEGIN_AT(tsc) do { \
+	prof_start = prof_last = (tsc); \
+} while (0)
+
+#define PROF_MARK(phase) do { \
+	uint32_t _now = _prof_tsc(); \
+	_prof_charge((phase), _now - prof_last); \
+	prof_last = _now; \
+} while (0)
+
+#define PROF_END() do { \
+	_prof_charge(PROF_TOTAL, _prof_tsc() - prof_start); \
+} while (0)
+
+#else
+
+#define PROF_BEGIN() do { } while (0)
+#define PROF_BEGIN_AT(tsc) do { } while (0)
+#define PROF_MARK(phase) do { } while (0)
+#define PROF_END() do { } while (0)
+
+#endif
+
+/* Forget everything recorded so far. */
+extern void prof_reset(void);
+
+#endif
@@ -0,0 +1,52 @@
+/* sched.h
+ * Cooperative scheduling of work within an SMI
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#ifndef __SCHED_H
+#define __SCHED_H
+
+#include <tables.h>
+#include <profile.h>
+
+/* Everything that NetWatch does on an SMI, apart from looking after the
+ * chipset, is a task declared with TASK() (see tables.h).  sched_run()
+ * goes through the tasks in priority order, and then again for as long
+ * as one of them says it has more to do and the deadline has not passed.
+ * A task is never stopped from outside: it must look at sched_expired()
+ * itself and come back with work left over rather than overrun.  But it
+ * should always get something done on each call, even if the deadline
+ * has passed already, so that every task moves forward on every SMI
+ * however busy the ones before it are.
+ *
+ * run() is passed nonzero on its first call in an SMI, and returns
+ * nonzero if it stopped with work still to do.
+ */
+
+struct task {
+	int (*run)(int first);
+	enum prof_phase phase;
+};
+
+#ifndef SCHED_BUDGET_US
+#define SCHED_BUDGET_US	500	/* Deadline, from the start of sched_run(). */
+#endif
+
+struct sched_stats {
+	unsigned long runs;		/* Calls to sched_run() */
+	unsigned long passes;		/* Passes over the tasks, in all */
+	unsigned long overruns;		/* Times work was left for next SMI */
+};
+
+extern struct sched_stats sched_stats;
+
+extern void sched_run(void);
+extern int sched_expired(void);
+extern unsigned long sched_left(void);	/* TSC cycles to the deadline */
+
+#endif
@@ -12,6 +12,13 @@
 #define SERIAL_H
 
 extern void serial_init();
+extern void serial_enter();
+extern void serial_leave();
 extern void serial_tx(unsigned char c);
+extern void serial_flush();
+extern int serial_pending();
+
+/* Bytes thrown away because the transmit buffer was full. */
+extern unsigned long serial_dropped;
 
 #endif
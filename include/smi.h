@@ -15,7 +15,14 @@ extern void smi_disable();	/* akin to cli / sti */
 extern void smi_enable();
 
 extern void smi_poll();
+/* If the fast timer is the only thing pending, deal with it, leave the
+ * SMI ready to return, and return 1; otherwise do nothing, and return 0
+ * so that the caller goes on to smi_poll().  The handler for the timer
+ * is not called. */
+extern int smi_poll_idle();
 extern unsigned long smi_status();	/* Architecturally defined; for debugging only. */
+extern unsigned long rdtsc();	/* Low 32 bits of the TSC. */
+extern unsigned long entry_tsc;	/* rdtsc() as the SMI came in; see entry.asm. */
 
 typedef enum {
 	SMI_EVENT_FAST_TIMER = 0,
@@ -52,13 +52,21 @@
  *
  * And everything Just Works. Etherboot and the Linux kernel both use this
  * for identifying linked-in modules; they have a somewhat more elaborate
- * macro infastructure, but at the moment there are only two tables in
- * NetWatch (network protocols and built-in drivers), so less is needed.
+ * macro infastructure, but at the moment there are only three tables in
+ * NetWatch (network protocols, scheduler tasks and built-in drivers), so
+ * less is needed.
  */
 
 #define PROTOCOL(x) void (* const x##_ptr)(void) \
 	__attribute__((section(".table.protocols.1"))) = x
 
+/* A task is polled by sched_run() on every SMI; see sched.h.  prio is a
+ * single digit, since the sections are sorted by name: tasks at 1 run
+ * first, and those at 9 last.  phase is what the profiler charges the
+ * task's time to. */
+#define TASK(x, prio, phase) const struct task x##_task \
+	__attribute__((section(".table.tasks." #prio))) = { x, phase }
+
 
 
 #define TABLE(typ, name) \
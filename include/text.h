@@ -11,9 +11,14 @@
 #ifndef _TEXT_H
 
 #include <stdint.h>
+#include <fb.h>
 
 extern void text_init();
+extern void text_getvmode(struct vmode *mode);
 extern void text_render(char *buf, int x, int y, int w, int h);
 extern uint32_t text_checksum(int x, int y, int w, int h);
 
+/* Cell-level damage tracking; rescanned once per fb_frame. */
+extern uint32_t text_scan();
+
 #endif
@@ -14,4 +14,11 @@
 void oneshot_start_ms(unsigned long milliseconds);
 int oneshot_running(void);
 
+/* A millisecond clock run off the TSC.  tsc_calibrate() is chipset code
+ * (it needs some other clock to measure the TSC against); timer_ms()
+ * calls it the first time through. */
+extern unsigned long tsc_per_ms;
+void tsc_calibrate(void);
+unsigned long timer_ms(void);
+
 #endif /* TIMER_H */
@@ -0,0 +1,64 @@
+/* trace.h
+ * Deferred binary trace ring
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+
+/* TRACE() is for messages on paths that run every SMI, or every packet,
+ * where outputf's vsnprintf and synchronous serial output cost far more
+ * than the work being logged.  It stores the format string's address, the
+ * TSC and up to four word-sized arguments in a ring, and the text is made
+ * later: by trace_format() when the ring is read over HTTP, or on the host
+ * from a dump of the ring and aseg.elf.
+ *
+ * Since formatting is deferred, %s arguments must point at something that
+ * will still be there then -- in practice, string literals.
+ *
+ * Anything above TRACE_LEVEL is compiled out entirely.
+ */
+
+#define TRACE_ERR	0
+#define TRACE_WARN	1
+#define TRACE_INFO	2
+#define TRACE_DEBUG	3
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL	TRACE_INFO
+#endif
+
+#define TRACE_RING_SIZE	256	/* Records; must be a power of two.  6K of SMRAM. */
+#define TRACE_MAX_ARGS	4
+
+struct trace_rec {
+	uint32_t tsc;
+	const char *fmt;
+	uint32_t args[TRACE_MAX_ARGS];
+};
+
+/* The ring is written only from SMM, so it needs no lock: a record is
+ * complete once trace_head has moved past it.  trace_head counts every
+ * record ever written; the ring holds the last TRACE_RING_SIZE of them. */
+extern struct trace_rec trace_ring[TRACE_RING_SIZE];
+extern volatile uint32_t trace_head;
+
+extern void _trace(const char *fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
+extern int trace_format(char *buf, int len, const struct trace_rec *rec);
+
+#define _TRACE_ARGS(fmt, a, b, c, d, ...) \
+	fmt, (uint32_t)(a), (uint32_t)(b), (uint32_t)(c), (uint32_t)(d)
+
+#define TRACE(level, ...) do { \
+	if ((level) <= TRACE_LEVEL) \
+		_trace(_TRACE_ARGS(__VA_ARGS__, 0, 0, 0, 0, 0)); \
+} while (0)
+
+#endif
@@ -18,6 +18,7 @@ void strblit(char *src, int row, int col, int fill);
 void dolog(char *s);
 void dologf(char *s, ...);
 void outlog();
+int log_pending();
 
 void dump_log(char *buffer);
 
@@ -0,0 +1,24 @@
+/* vga.h
+ * Standard VGA graphics mode capture
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#ifndef _VGA_H
+#define _VGA_H
+
+#include <stdint.h>
+#include <fb.h>
+
+extern int vga_getvmode(struct fbdevice *dev);
+extern void vga_linear8(struct fbdevice *dev, unsigned char *base, int stride, int dac8);
+extern uint32_t vga_signature();
+extern uint32_t vga_checksum(int x, int y, int w, int h);
+extern void vga_copy_pixels(char *buf, int x, int y, int w, int h);
+extern void vga_copy_indices(char *buf, int x, int y, int w, int h);
+
+#endif
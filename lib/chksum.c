@@ -0,0 +1,125 @@
+/* chksum.c
+ * Internet checksum routines
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <stdint.h>
+#include <chksum.h>
+
+/* The ones' complement sum doesn't care about byte order or word size, so
+ * long as the carries wrap around, so we sum 32 bits at a time and fold at
+ * the end.  The main loops are adcl chains: lea and dec leave the carry
+ * flag alone, so one carry feeds straight into the next block.  Unaligned
+ * loads cost little next to the rest of the loop, so there is no attempt
+ * to align anything; each word is summed at its offset from the start of
+ * the buffer, which is all the result depends on.
+ *
+ * There is no SSE2 version: the buffers here are at most a frame long, and
+ * in SMM we would have to save and restore the XMM registers by hand
+ * around each one (see generic.c), which would eat the difference.
+ */
+
+static inline uint32_t _add(uint32_t sum, uint32_t w)
+{
+	sum += w;
+	return sum + (sum < w);
+}
+
+static inline uint16_t _fold(uint32_t sum)
+{
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	return sum;
+}
+
+/* Whatever is left over after the unrolled loop. */
+static uint32_t _tail(const uint8_t *p, int len, uint32_t sum)
+{
+	while (len >= 4)
+	{
+		sum = _add(sum, *(const uint32_t *)p);
+		p += 4;
+		len -= 4;
+	}
+	if (len >= 2)
+	{
+		sum = _add(sum, *(const uint16_t *)p);
+		p += 2;
+		len -= 2;
+	}
+	if (len)
+		sum = _add(sum, *p);
+	return sum;
+}
+
+uint16_t chksum(const void *data, uint16_t len)
+{
+	const uint8_t *p = data;
+	uint32_t sum = 0;
+	int blocks = len / 32;
+
+	if (blocks)
+		asm volatile(
+			"clc\n"
+			"1:\n"
+			"adcl 0x00(%1), %0\n"
+			"adcl 0x04(%1), %0\n"
+			"adcl 0x08(%1), %0\n"
+			"adcl 0x0C(%1), %0\n"
+			"adcl 0x10(%1), %0\n"
+			"adcl 0x14(%1), %0\n"
+			"adcl 0x18(%1), %0\n"
+			"adcl 0x1C(%1), %0\n"
+			"leal 0x20(%1), %1\n"
+			"decl %2\n"
+			"jnz 1b\n"
+			"adcl $0, %0\n"
+			: "+r" (sum), "+r" (p), "+r" (blocks)
+			: : "memory", "cc");
+
+	return _fold(_tail(p, len % 32, sum));
+}
+
+uint16_t chksum_copy(void *dst, const void *src, uint16_t len)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	uint32_t sum = 0, w;
+	int blocks = len / 16;
+	int rest = len % 16;
+	int i;
+
+	if (blocks)
+		asm volatile(
+			"clc\n"
+			"1:\n"
+			"movl 0x00(%2), %4\n"
+			"adcl %4, %0\n"
+			"movl %4, 0x00(%1)\n"
+			"movl 0x04(%2), %4\n"
+			"adcl %4, %0\n"
+			"movl %4, 0x04(%1)\n"
+			"movl 0x08(%2), %4\n"
+			"adcl %4, %0\n"
+			"movl %4, 0x08(%1)\n"
+			"movl 0x0C(%2), %4\n"
+			"adcl %4, %0\n"
+			"movl %4, 0x0C(%1)\n"
+			"leal 0x10(%2), %2\n"
+			"leal 0x10(%1), %1\n"
+			"decl %3\n"
+			"jnz 1b\n"
+			"adcl $0, %0\n"
+			: "+r" (sum), "+r" (d), "+r" (s), "+r" (blocks), "=&r" (w)
+			: : "memory", "cc");
+
+	/* The tail is short, so copy it bytewise and sum it in place. */
+	for (i = 0; i < rest; i++)
+		d[i] = s[i];
+	return _fold(_tail(d, rest, sum));
+}
@@ -38,6 +38,7 @@
 #include <reg-x86.h>
 #include <paging.h>
 #include <output.h>
+#include <trace.h>
 #include <demap.h>
 
 #define REG_CS_ATTRIB_L		(1<<9)
@@ -144,7 +145,7 @@ uint64_t demap_phys (uint64_t vaddr) {
 	if (mode == UNKNOWN)
 		probe_operating_mode();
 
-outputf("demapping %08x %08x m %d", (uint32_t)(vaddr>>32), (uint32_t)vaddr, mode);
+	TRACE(TRACE_DEBUG, "demapping %08x %08x m %d", (uint32_t)(vaddr>>32), (uint32_t)vaddr, mode);
 	switch (mode) {
 	case LONG_64BIT:
 	case LONG_COMPAT: {
@@ -195,7 +196,7 @@ outputf("demapping %08x %08x m %d", (uint32_t)(vaddr>>32), (uint32_t)vaddr, mode
 
 void *demap(uint64_t vaddr) {
 	uint64_t paddr = demap_phys(vaddr);
-	outputf("demap: paddr 0x%08x %08x", (uint32_t)(paddr>>32), (uint32_t)paddr);
+	TRACE(TRACE_DEBUG, "demap: paddr 0x%08x %08x", (uint32_t)(paddr>>32), (uint32_t)paddr);
 	if (!paddr) return 0;
 	return p2v(paddr);
 }
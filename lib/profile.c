@@ -0,0 +1,59 @@
+/* profile.c
+ * Per-SMI phase profiler
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+#include <profile.h>
+
+struct prof_stats prof_stats[PROF_MAX] = {
+	[PROF_ENTRY]		= { .name = "entry" },
+	[PROF_UNBOTHER]		= { .name = "unbother" },
+	[PROF_GETVMODE]		= { .name = "getvmode" },
+	[PROF_STATUS]		= { .name = "status" },
+	[PROF_ETH_POLL]		= { .name = "eth_poll" },
+	[PROF_RFB]		= { .name = "rfb" },
+	[PROF_HTTPD]		= { .name = "httpd" },
+	[PROF_ETH_FLUSH]	= { .name = "eth_flush" },
+	[PROF_SMI_POLL]		= { .name = "smi_poll" },
+	[PROF_SMI_TIMER]	= { .name = "smi_timer" },
+	[PROF_SMI_KBC]		= { .name = "smi_kbc" },
+	[PROF_SMI_GBL_RLS]	= { .name = "smi_gbl_rls" },
+	[PROF_SMI_PWRBTN]	= { .name = "smi_pwrbtn" },
+	[PROF_REBOTHER]		= { .name = "rebother" },
+	[PROF_IDLE]		= { .name = "idle" },
+	[PROF_TOTAL]		= { .name = "total" },
+};
+
+uint32_t prof_start, prof_last;
+
+void _prof_charge(enum prof_phase phase, uint32_t cycles)
+{
+	struct prof_stats *s = &prof_stats[phase];
+
+	s->count++;
+	s->total += cycles;
+	if (cycles > s->max)
+		s->max = cycles;
+	/* Bucket n holds [2^n, 2^(n+1)); zero goes in with one. */
+	s->hist[31 - __builtin_clz(cycles | 1)]++;
+}
+
+void prof_reset(void)
+{
+	int i;
+
+	for (i = 0; i < PROF_MAX; i++)
+	{
+		prof_stats[i].count = 0;
+		prof_stats[i].max = 0;
+		prof_stats[i].total = 0;
+		memset(prof_stats[i].hist, 0, sizeof(prof_stats[i].hist));
+	}
+}
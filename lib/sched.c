@@ -0,0 +1,67 @@
+/* sched.c
+ * Cooperative scheduling of work within an SMI
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <smi.h>
+#include <timer.h>
+#include <tables.h>
+#include <profile.h>
+#include <sched.h>
+
+TABLE(const struct task, tasks);
+
+struct sched_stats sched_stats;
+
+static unsigned long _deadline;
+
+/* The TSC is only 32 bits here, so compare by difference. */
+int sched_expired(void)
+{
+	return (long)(rdtsc() - _deadline) >= 0;
+}
+
+unsigned long sched_left(void)
+{
+	long left = _deadline - rdtsc();
+
+	return left > 0 ? left : 0;
+}
+
+void sched_run(void)
+{
+	const struct task *t;
+	int first = 1, more;
+
+	/* timer_ms() calibrates the TSC the first time through; until then
+	 * the budget is nothing, and each task gets its one go. */
+	timer_ms();
+	_deadline = rdtsc() + tsc_per_ms / 1000 * SCHED_BUDGET_US;
+	sched_stats.runs++;
+
+	for (;;)
+	{
+		sched_stats.passes++;
+		more = 0;
+		for (t = tasks_table; t < tasks_table_end; t++)
+		{
+			if (t->run(first))
+				more = 1;
+			PROF_MARK(t->phase);
+		}
+		first = 0;
+
+		if (!more)
+			return;
+		if (sched_expired())
+		{
+			sched_stats.overruns++;
+			return;
+		}
+	}
+}
@@ -10,6 +10,7 @@
 
 #include <minilib.h>
 #include <io.h>
+#include <serial.h>
 
 #define SER_BASE 0x3F8
 #define SER_THR 0x0
@@ -18,9 +19,13 @@
 #define SER_IER 0x1
 #define SER_DLM 0x1
 #define SER_IIR 0x2
+#define SER_IIR_FIFO 0xC0
 #define SER_FCR 0x2
+#define SER_FCR_ENABLE 0x01
+#define SER_FCR_CLEAR 0x06
 #define SER_LCR 0x3
 #define SER_LCR_DLAB 0x80
+#define SER_LCR_8N1 0x03
 #define SER_MCR 0x4
 #define SER_LSR 0x5
 #define SER_LSR_THR_EMPTY 0x20
@@ -30,6 +35,33 @@
 #define SER_BAUD_BASE 115200
 #define SER_BAUD_REQ 115200
 
+/* Left in the scratch register, so that we can tell on the next SMI
+ * whether anyone else has been programming the port. */
+#define SER_COOKIE 0x4E
+
+#define SER_FIFO_DEPTH 16
+
+/* Output is queued here and fed to the UART's FIFO a burst at a time, as
+ * there is room, so that nobody ever waits for the line.  If more than
+ * this is queued in one go, the excess is counted and dropped. */
+#define SER_TXBUF_SIZE 4096	/* Must be a power of two. */
+
+static unsigned char _txbuf[SER_TXBUF_SIZE];
+static unsigned int _txhead = 0, _txtail = 0;
+static int _fifo_depth = 1;
+
+unsigned long serial_dropped = 0;
+static unsigned long _dropped_reported = 0;
+
+/* When the OS has the port, we write to it only if it is already set up
+ * the way we would have set it up ourselves: then there is nothing to
+ * change, and nothing to put back but IER.  Otherwise, output stays queued
+ * (_blocked) until a later SMI finds the port usable. */
+static struct {
+	unsigned char ier, fifo;
+} _saved;
+static int _borrowed = 0, _blocked = 0;
+
 void _outb(unsigned short port, unsigned char d)
 {
 	outb(SER_BASE + port, d);
@@ -43,20 +75,114 @@ unsigned char _inb(unsigned short port)
 void serial_init()
 {
 	unsigned short baud = SER_BAUD_REQ / SER_BAUD_BASE;
-	_outb(SER_LCR, _inb(SER_LCR) | SER_LCR_DLAB);
+
+	_outb(SER_LCR, SER_LCR_DLAB);
 	_outb(SER_DLL, baud & 0xFF);
 	_outb(SER_DLM, baud >> 8);
-	_outb(SER_LCR, _inb(SER_LCR) & ~SER_LCR_DLAB);
+	_outb(SER_LCR, SER_LCR_8N1);	/* 8 data bits, one stop bit, no parity */
 	_outb(SER_IER, 0x0);
-	_outb(SER_FCR, 0x0);	/* FIFOs off */
-	_outb(SER_LCR, 0x03);	/* 8 data bits, one stop bit, no parity */
+	_outb(SER_FCR, SER_FCR_ENABLE | SER_FCR_CLEAR);
+	_outb(SER_SR, SER_COOKIE);
+
+	/* Only a 16550A or better says that its FIFOs are on. */
+	if ((_inb(SER_IIR) & SER_IIR_FIFO) == SER_IIR_FIFO)
+		_fifo_depth = SER_FIFO_DEPTH;
+	else
+		_fifo_depth = 1;
+	_borrowed = 0;
+	_blocked = 0;
+}
+
+/* Called on the way into SMM.  Usually the port is just as we left it,
+ * and this is four reads.  If the OS has it, we look at the line settings
+ * (toggling DLAB leaves a byte on its way out alone) and, if they match
+ * ours, take the port's interrupts away for the duration.  IIR is only
+ * ever read with IER at zero: reading it acknowledges a pending THRE
+ * interrupt, and that interrupt belongs to the OS.  FCR is never touched,
+ * since the OS's RX trigger level can't be read back. */
+void serial_enter()
+{
+	unsigned short baud = SER_BAUD_REQ / SER_BAUD_BASE;
+	unsigned char lcr, dll, dlm;
+
+	_borrowed = 0;
+	_blocked = 0;
+	if (_inb(SER_LCR) == SER_LCR_8N1
+	    && _inb(SER_IER) == 0
+	    && (_fifo_depth == 1 || (_inb(SER_IIR) & SER_IIR_FIFO) == SER_IIR_FIFO)
+	    && _inb(SER_SR) == SER_COOKIE)
+		return;
+
+	_borrowed = 1;
+	lcr = _inb(SER_LCR);
+	_outb(SER_LCR, lcr | SER_LCR_DLAB);
+	dll = _inb(SER_DLL);
+	dlm = _inb(SER_DLM);
+	_outb(SER_LCR, lcr);
+
+	if (lcr != SER_LCR_8N1 || dll != (baud & 0xFF) || dlm != (baud >> 8))
+	{
+		_blocked = 1;
+		return;
+	}
+
+	_saved.ier = _inb(SER_IER);
+	_outb(SER_IER, 0);
+	_saved.fifo = (_inb(SER_IIR) & SER_IIR_FIFO) == SER_IIR_FIFO;
+}
+
+/* Called on the way out of SMM.  Neither path waits for the line. */
+void serial_leave()
+{
+	serial_flush();
+
+	if (_borrowed && !_blocked)
+		_outb(SER_IER, _saved.ier);
+	_borrowed = 0;
 }
 
 void serial_tx(unsigned char c)
 {
-	int i = 100000;
-	
-	while (!(_inb(SER_LSR) & SER_LSR_THR_EMPTY) && (i--))
-		;
-	_outb(SER_THR, c);
+	if (_txhead - _txtail == SER_TXBUF_SIZE)
+	{
+		serial_dropped++;
+		return;
+	}
+	_txbuf[_txhead++ & (SER_TXBUF_SIZE - 1)] = c;
+}
+
+/* Is there anything for serial_flush() to do?  Only the queue is looked
+ * at, so this is safe to call without having the port.  Output that the
+ * last SMI couldn't send doesn't count, or an OS running the port at
+ * another speed would keep every SMI off the idle path; it goes out once
+ * some busier SMI finds the port usable again. */
+int serial_pending()
+{
+	if (_blocked)
+		return 0;
+	return _txhead != _txtail || serial_dropped != _dropped_reported;
+}
+
+/* Hand the UART as much as fits in its FIFO, if it has finished with the
+ * last lot; never waits. */
+void serial_flush()
+{
+	char note[40];
+	int n;
+
+	if (_txhead == _txtail && serial_dropped != _dropped_reported)
+	{
+		snprintf(note, sizeof(note) - 1, "[serial: %lu bytes dropped]\r\n",
+		         serial_dropped - _dropped_reported);
+		_dropped_reported = serial_dropped;
+		for (n = 0; note[n]; n++)
+			serial_tx(note[n]);
+	}
+
+	if (_blocked || _txhead == _txtail || !(_inb(SER_LSR) & SER_LSR_THR_EMPTY))
+		return;
+
+	for (n = (_borrowed && !_saved.fifo) ? 1 : _fifo_depth;
+	     n && _txhead != _txtail; n--)
+		_outb(SER_THR, _txbuf[_txtail++ & (SER_TXBUF_SIZE - 1)]);
 }
@@ -0,0 +1,49 @@
+/* trace.c
+ * Deferred binary trace ring
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+#include <trace.h>
+
+struct trace_rec trace_ring[TRACE_RING_SIZE];
+volatile uint32_t trace_head = 0;
+
+void _trace(const char *fmt, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+	struct trace_rec *r = &trace_ring[trace_head & (TRACE_RING_SIZE - 1)];
+	uint32_t tsc;
+
+	/* We are in ring 0 (or a Linux process, in the simulator), so
+	 * CR4.TSD does not get in the way here. */
+	asm volatile("rdtsc" : "=a" (tsc) : : "edx");
+
+	r->tsc = tsc;
+	r->fmt = fmt;
+	r->args[0] = a;
+	r->args[1] = b;
+	r->args[2] = c;
+	r->args[3] = d;
+
+	/* The record has to be in memory before anyone can see it. */
+	asm volatile("" : : : "memory");
+	trace_head++;
+}
+
+/* Returns the length of the line; buf is always terminated.  (Our
+ * snprintf stores up to size characters and then the NUL, hence the -1.) */
+int trace_format(char *buf, int len, const struct trace_rec *rec)
+{
+	int n;
+
+	n = snprintf(buf, len - 1, "%08x ", rec->tsc);
+	n += snprintf(buf + n, len - 1 - n, rec->fmt, rec->args[0],
+	              rec->args[1], rec->args[2], rec->args[3]);
+	return n;
+}
@@ -0,0 +1,41 @@
+/* tsc.c
+ * Millisecond clock from the TSC
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <smi.h>
+#include <timer.h>
+
+unsigned long tsc_per_ms = 0;
+
+static unsigned long _last_tsc;
+static unsigned long _ms = 0;
+static unsigned long _rem = 0;
+
+/* rdtsc() only gives us the low 32 bits, so this has to be called at
+ * least once per wrap (about a second at 4GHz) to keep good time; once
+ * per SMI is plenty.  Leftover cycles are carried over, so that frequent
+ * calls do not make the clock run slow. */
+unsigned long timer_ms(void)
+{
+	unsigned long now = rdtsc();
+	unsigned long delta;
+
+	if (!tsc_per_ms)
+	{
+		tsc_calibrate();
+		_last_tsc = rdtsc();
+		return _ms;
+	}
+
+	delta = now - _last_tsc + _rem;
+	_last_tsc = now;
+	_ms += delta / tsc_per_ms;
+	_rem = delta % tsc_per_ms;
+	return _ms;
+}
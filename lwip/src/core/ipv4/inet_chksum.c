@@ -367,6 +367,18 @@ inet_chksum_pseudo_partial(struct pbuf *p,
   return (u16_t)~(acc & 0xffffUL);
 }
 
+#if LWIP_CHECKSUM_ON_COPY
+/**
+ * Reference version of LWIP_CHKSUM_COPY: copy, then sum the copy.
+ */
+u16_t
+lwip_chksum_copy(void *dst, const void *src, u16_t len)
+{
+  MEMCPY(dst, src, len);
+  return LWIP_CHKSUM(dst, len);
+}
+#endif
+
 /* inet_chksum:
  *
  * Calculates the Internet checksum over a portion of memory. Used primarily for IP
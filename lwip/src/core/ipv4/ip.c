@@ -224,7 +224,8 @@ ip_input(struct pbuf *p, struct netif *inp)
 
   /* verify checksum */
 #if CHECKSUM_CHECK_IP
-  if (inet_chksum(iphdr, iphdr_hlen) != 0) {
+  if (NETIF_CHECKSUM_NEEDED(inp, p, NETIF_CHECKSUM_CHECK_IP) &&
+      inet_chksum(iphdr, iphdr_hlen) != 0) {
 
     LWIP_DEBUGF(IP_DEBUG | 2, ("Checksum (0x%"X16_F") failed, IP packet dropped.\n", inet_chksum(iphdr, iphdr_hlen)));
     ip_debug_print(p);
@@ -512,7 +513,8 @@ ip_output_if(struct pbuf *p, struct ip_addr *src, struct ip_addr *dest,
 
     IPH_CHKSUM_SET(iphdr, 0);
 #if CHECKSUM_GEN_IP
-    IPH_CHKSUM_SET(iphdr, inet_chksum(iphdr, IP_HLEN));
+    if (NETIF_CHECKSUM_ENABLED(netif, NETIF_CHECKSUM_GEN_IP))
+      IPH_CHKSUM_SET(iphdr, inet_chksum(iphdr, IP_HLEN));
 #endif
   } else {
     /* IP header already included in p */
@@ -68,24 +68,27 @@
 /* lwIP head implemented with different sized pools */
 
 /**
- * This structure is used to save the pool one element came from.
+ * This structure is used to save the pool one element came from,
+ * and the size that was asked for (for the statistics).
  */
 struct mem_helper
 {
-   memp_t poolnr;
+   u16_t poolnr;
+   u16_t size;
 };
 
 /**
  * Allocate memory: determine the smallest pool that is big enough
  * to contain an element of 'size' and get an element from that pool.
+ * If that pool is empty, the next bigger ones are tried in turn.
  *
  * @param size the size in bytes of the memory needed
- * @return a pointer to the allocated memory or NULL if the pool is empty
+ * @return a pointer to the allocated memory or NULL if the pools are empty
  */
 void *
 mem_malloc(mem_size_t size)
 {
-  struct mem_helper *element;
+  struct mem_helper *element = NULL;
   memp_t poolnr;
 
   for (poolnr = MEMP_POOL_FIRST; poolnr <= MEMP_POOL_LAST; poolnr++) {
@@ -96,19 +99,37 @@ mem_malloc(mem_size_t size)
     }
   }
   if (poolnr > MEMP_POOL_LAST) {
-    LWIP_ASSERT("mem_malloc(): no pool is that big!", 0);
+    LWIP_DEBUGF(MEM_DEBUG | 2, ("mem_malloc: no pool holds %"U32_F" bytes\n", (u32_t)size));
+#if MEM_STATS
+    ++lwip_stats.mem.err;
+#endif /* MEM_STATS */
     return NULL;
   }
-  element = (struct mem_helper*)memp_malloc(poolnr);
+  for (; poolnr <= MEMP_POOL_LAST; poolnr++) {
+    /* No need to DEBUGF or ASSERT when a pool is empty: memp.c has
+       already counted it against that pool. */
+    element = (struct mem_helper*)memp_malloc(poolnr);
+    if (element != NULL) {
+      break;
+    }
+  }
   if (element == NULL) {
-    /* No need to DEBUGF or ASSERT: This error is already
-       taken care of in memp.c */
-    /** @todo: we could try a bigger pool if this one is empty! */
+#if MEM_STATS
+    ++lwip_stats.mem.err;
+#endif /* MEM_STATS */
     return NULL;
   }
 
   /* save the pool number this element came from */
   element->poolnr = poolnr;
+  element->size = size;
+#if MEM_STATS
+  lwip_stats.mem.used += memp_sizes[poolnr];
+  lwip_stats.mem.requested += size;
+  if (lwip_stats.mem.used > lwip_stats.mem.max) {
+    lwip_stats.mem.max = lwip_stats.mem.used;
+  }
+#endif /* MEM_STATS */
   /* and return a pointer to the memory directly after the struct mem_helper */
   element++;
 
@@ -137,8 +158,13 @@ mem_free(void *rmem)
   LWIP_ASSERT("hmem == MEM_ALIGN(hmem)", (hmem == LWIP_MEM_ALIGN(hmem)));
   LWIP_ASSERT("hmem->poolnr < MEMP_MAX", (hmem->poolnr < MEMP_MAX));
 
+#if MEM_STATS
+  lwip_stats.mem.used -= memp_sizes[hmem->poolnr];
+  lwip_stats.mem.requested -= hmem->size;
+#endif /* MEM_STATS */
+
   /* and put it in the pool we saved earlier */
-  memp_free(hmem->poolnr, hmem);
+  memp_free((memp_t)hmem->poolnr, hmem);
 }
 
 #else /* MEM_USE_POOLS */
@@ -260,6 +260,15 @@ memp_init(void)
   }
 #endif /* MEMP_STATS */
 
+#if MEM_USE_POOLS && MEM_STATS
+  /* mem_init() is compiled out with pools, so the heap statistics
+     are set up here: the heap is everything in the malloc pools. */
+  lwip_stats.mem.avail = 0;
+  for (i = MEMP_POOL_FIRST; i <= MEMP_POOL_LAST; ++i) {
+    lwip_stats.mem.avail += (mem_size_t)memp_num[i] * memp_sizes[i];
+  }
+#endif /* MEM_USE_POOLS && MEM_STATS */
+
   memp = LWIP_MEM_ALIGN(memp_memory);
   /* for every pool: */
   for (i = 0; i < MEMP_MAX; ++i) {
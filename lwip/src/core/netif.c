@@ -89,6 +89,7 @@ netif_add(struct netif *netif, struct ip_addr *ipaddr, struct ip_addr *netmask,
   netif->netmask.addr = 0;
   netif->gw.addr = 0;
   netif->flags = 0;
+  netif->chksum_flags = NETIF_CHECKSUM_ENABLE_ALL;
 #if LWIP_DHCP
   /* netif not under DHCP control by default */
   netif->dhcp = NULL;
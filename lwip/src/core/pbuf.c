@@ -493,8 +493,11 @@ pbuf_free(struct pbuf *p)
       q = p->next;
       LWIP_DEBUGF( PBUF_DEBUG | 2, ("pbuf_free: deallocating %p\n", (void *)p));
       type = p->type;
+      /* is this a custom pbuf, owned by a driver? */
+      if ((p->flags & PBUF_FLAG_IS_CUSTOM) != 0) {
+        ((struct pbuf_custom *)p)->custom_free_function(p);
       /* is this a pbuf from the pool? */
-      if (type == PBUF_POOL) {
+      } else if (type == PBUF_POOL) {
         memp_free(MEMP_PBUF_POOL, p);
       /* is this a ROM or RAM referencing pbuf? */
       } else if (type == PBUF_ROM || type == PBUF_REF) {
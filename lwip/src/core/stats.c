@@ -129,6 +129,9 @@ stats_display(void)
 #endif
 #if MEM_STATS
   stats_display_mem(&lwip_stats.mem, "HEAP");
+#if MEM_USE_POOLS
+  LWIP_PLATFORM_DIAG(("  requested: %"U32_F, (u32_t)lwip_stats.mem.requested));
+#endif
 #endif
 #if MEMP_STATS
   for (i = 0; i < MEMP_MAX; i++) {
@@ -485,7 +485,7 @@ err_t
 tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port,
       err_t (* connected)(void *arg, struct tcp_pcb *tpcb, err_t err))
 {
-  u32_t optdata;
+  u8_t optdata[TCP_SYN_OPTLEN_MAX];
   err_t ret;
   u32_t iss;
 
@@ -525,10 +525,16 @@ tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port,
 
   snmp_inc_tcpactiveopens();
   
-  /* Build an MSS option */
-  optdata = TCP_BUILD_MSS_OPTION();
-
-  ret = tcp_enqueue(pcb, NULL, 0, TCP_SYN, 0, (u8_t *)&optdata, 4);
+  /* Offer everything we support; the SYN-ACK tells us what stuck. */
+#if LWIP_WND_SCALE
+  pcb->flags |= TF_WND_SCALE;
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_SACK
+  pcb->flags |= TF_SACK;
+#endif /* LWIP_TCP_SACK */
+
+  ret = tcp_enqueue(pcb, NULL, 0, TCP_SYN, 0, optdata,
+                    tcp_build_syn_options(pcb, optdata));
   if (ret == ERR_OK) { 
     tcp_output(pcb);
   }
@@ -546,7 +552,7 @@ void
 tcp_slowtmr(void)
 {
   struct tcp_pcb *pcb, *pcb2, *prev;
-  u16_t eff_wnd;
+  tcpwnd_size_t eff_wnd;
   u8_t pcb_remove;      /* flag if a PCB should be removed */
   err_t err;
 
@@ -601,7 +607,7 @@ tcp_slowtmr(void)
           /* Double retransmission time-out unless we are trying to
            * connect to somebody (i.e., we are in SYN_SENT). */
           if (pcb->state != SYN_SENT) {
-            pcb->rto = ((pcb->sa >> 3) + pcb->sv) << tcp_backoff[pcb->nrtx];
+            pcb->rto = TCP_RTO_BASE(pcb) << tcp_backoff[pcb->nrtx];
           }
 
           /* Reset the retransmission timer. */
@@ -613,6 +619,9 @@ tcp_slowtmr(void)
           if (pcb->ssthresh < pcb->mss) {
             pcb->ssthresh = pcb->mss * 2;
           }
+#if TCP_SMI_PACING
+          tcp_pace_ssthresh(pcb);
+#endif /* TCP_SMI_PACING */
           pcb->cwnd = pcb->mss;
           LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"U16_F
                                        " ssthresh %"U16_F"\n",
@@ -798,6 +807,14 @@ tcp_fasttmr(void)
       tcp_ack_now(pcb);
       pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
     }
+
+#if TCP_SMI_PACING
+    /* Pick up where pacing stopped us in an earlier burst; there may
+       be no ACK in this one to do it for us. */
+    if (pcb->unsent != NULL && pcb->pace_epoch != tcp_pace_epoch) {
+      tcp_output(pcb);
+    }
+#endif /* TCP_SMI_PACING */
   }
 }
 
@@ -995,7 +1012,7 @@ tcp_alloc(u8_t prio)
     pcb->mss = (TCP_MSS > 536) ? 536 : TCP_MSS;
     pcb->rto = 3000 / TCP_SLOW_INTERVAL;
     pcb->sa = 0;
-    pcb->sv = 3000 / TCP_SLOW_INTERVAL;
+    pcb->sv = 3000 / TCP_RTT_UNIT;
     pcb->rtime = -1;
     pcb->cwnd = 1;
     iss = tcp_next_iss();
@@ -76,6 +76,9 @@ struct tcp_pcb *tcp_input_pcb;
 static err_t tcp_process(struct tcp_pcb *pcb);
 static u8_t tcp_receive(struct tcp_pcb *pcb);
 static void tcp_parseopt(struct tcp_pcb *pcb);
+#if LWIP_TCP_SACK
+static u8_t tcp_parse_sack(struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_SACK */
 
 static err_t tcp_listen_input(struct tcp_pcb_listen *pcb);
 static err_t tcp_timewait_input(struct tcp_pcb *pcb);
@@ -132,7 +135,8 @@ tcp_input(struct pbuf *p, struct netif *inp)
 
 #if CHECKSUM_CHECK_TCP
   /* Verify TCP checksum. */
-  if (inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src),
+  if (NETIF_CHECKSUM_NEEDED(inp, p, NETIF_CHECKSUM_CHECK_TCP) &&
+      inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src),
       (struct ip_addr *)&(iphdr->dest),
       IP_PROTO_TCP, p->tot_len) != 0) {
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packet discarded due to failing checksum 0x%04"X16_F"\n",
@@ -314,7 +318,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
            called when new send buffer space is available, we call it
            now. */
         if (pcb->acked > 0) {
-          TCP_EVENT_SENT(pcb, pcb->acked, err);
+          TCP_EVENT_SENT(pcb, TCPWND16(pcb->acked), err);
         }
       
         if (recv_data != NULL) {
@@ -393,7 +397,7 @@ static err_t
 tcp_listen_input(struct tcp_pcb_listen *pcb)
 {
   struct tcp_pcb *npcb;
-  u32_t optdata;
+  u8_t optdata[TCP_SYN_OPTLEN_MAX];
 
   /* In the LISTEN state, we check for incoming SYN segments,
      creates a new PCB, and responds with a SYN|ACK. */
@@ -448,13 +452,20 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
 #if TCP_CALCULATE_EFF_SEND_MSS
     npcb->mss = tcp_eff_send_mss(npcb->mss, &(npcb->remote_ip));
 #endif /* TCP_CALCULATE_EFF_SEND_MSS */
+#if LWIP_WND_SCALE
+    /* The window in a SYN is never scaled, so it says nothing about how
+       far slow start may usefully go. */
+    if (npcb->flags & TF_WND_SCALE) {
+      npcb->ssthresh = TCP_SND_BUF;
+    }
+#endif /* LWIP_WND_SCALE */
 
     snmp_inc_tcppassiveopens();
 
-    /* Build an MSS option. */
-    optdata = TCP_BUILD_MSS_OPTION();
-    /* Send a SYN|ACK together with the MSS option. */
-    tcp_enqueue(npcb, NULL, 0, TCP_SYN | TCP_ACK, 0, (u8_t *)&optdata, 4);
+    /* Send a SYN|ACK together with the MSS option, and window scale and
+       SACK permitted if the SYN offered them. */
+    tcp_enqueue(npcb, NULL, 0, TCP_SYN | TCP_ACK, 0, optdata,
+                tcp_build_syn_options(npcb, optdata));
     return tcp_output(npcb);
   }
   return ERR_OK;
@@ -551,7 +562,9 @@ tcp_process(struct tcp_pcb *pcb)
       pcb->state = ESTABLISHED;
 
       /* Parse any options in the SYNACK before using pcb->mss since that
-       * can be changed by the received options! */
+       * can be changed by the received options! Window scaling and SACK
+       * were offered in our SYN, but only count if they come back. */
+      pcb->flags &= ~(TF_WND_SCALE | TF_SACK);
       tcp_parseopt(pcb);
 #if TCP_CALCULATE_EFF_SEND_MSS
       pcb->mss = tcp_eff_send_mss(pcb->mss, &(pcb->remote_ip));
@@ -721,15 +734,34 @@ tcp_receive(struct tcp_pcb *pcb)
   u32_t right_wnd_edge;
   u16_t new_tot_len;
   u8_t accepted_inseq = 0;
+  tcpwnd_size_t wnd;
+#if TCP_QUEUE_OOSEQ
+  u8_t had_ooseq;
+#if TCP_OOSEQ_MAX_PBUFS
+  u16_t ooseq_clen;
+#endif /* TCP_OOSEQ_MAX_PBUFS */
+#endif /* TCP_QUEUE_OOSEQ */
+#if LWIP_TCP_SACK
+  u8_t partial_ack = 0;
+  u8_t sacked = 0;
+#endif /* LWIP_TCP_SACK */
 
   if (flags & TCP_ACK) {
     right_wnd_edge = pcb->snd_wnd + pcb->snd_wl1;
+    /* Only the window in a SYN goes unscaled. */
+    wnd = (flags & TCP_SYN) ? tcphdr->wnd : SND_WND_SCALE(pcb, tcphdr->wnd);
+
+#if LWIP_TCP_SACK
+    if ((pcb->flags & TF_SACK) && TCPH_HDRLEN(tcphdr) > 5) {
+      sacked = tcp_parse_sack(pcb);
+    }
+#endif /* LWIP_TCP_SACK */
 
     /* Update window. */
     if (TCP_SEQ_LT(pcb->snd_wl1, seqno) ||
        (pcb->snd_wl1 == seqno && TCP_SEQ_LT(pcb->snd_wl2, ackno)) ||
-       (pcb->snd_wl2 == ackno && tcphdr->wnd > pcb->snd_wnd)) {
-      pcb->snd_wnd = tcphdr->wnd;
+       (pcb->snd_wl2 == ackno && wnd > pcb->snd_wnd)) {
+      pcb->snd_wnd = wnd;
       pcb->snd_wl1 = seqno;
       pcb->snd_wl2 = ackno;
       if (pcb->snd_wnd > 0 && pcb->persist_backoff > 0) {
@@ -738,7 +770,7 @@ tcp_receive(struct tcp_pcb *pcb)
       LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %"U16_F"\n", pcb->snd_wnd));
 #if TCP_WND_DEBUG
     } else {
-      if (pcb->snd_wnd != tcphdr->wnd) {
+      if (pcb->snd_wnd != wnd) {
         LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: no window update lastack %"U32_F" snd_max %"U32_F" ackno %"U32_F" wl1 %"U32_F" seqno %"U32_F" wl2 %"U32_F"\n",
                                pcb->lastack, pcb->snd_max, ackno, pcb->snd_wl1, seqno, pcb->snd_wl2));
       }
@@ -748,7 +780,14 @@ tcp_receive(struct tcp_pcb *pcb)
     if (pcb->lastack == ackno) {
       pcb->acked = 0;
 
+      /* A receiver that keeps growing its buffer moves the right edge
+         on every ACK, duplicates included; SACKing something new is a
+         surer sign that a segment arrived after a hole. */
+#if LWIP_TCP_SACK
+      if (pcb->snd_wl1 + pcb->snd_wnd == right_wnd_edge || sacked){
+#else /* LWIP_TCP_SACK */
       if (pcb->snd_wl1 + pcb->snd_wnd == right_wnd_edge){
+#endif /* LWIP_TCP_SACK */
         ++pcb->dupacks;
         if (pcb->dupacks >= 3 && pcb->unacked != NULL) {
           if (!(pcb->flags & TF_INFR)) {
@@ -772,15 +811,28 @@ tcp_receive(struct tcp_pcb *pcb)
               LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_receive: The minimum value for ssthresh %"U16_F" should be min 2 mss %"U16_F"...\n", pcb->ssthresh, 2*pcb->mss));
               pcb->ssthresh = 2*pcb->mss;
             }
+#if TCP_SMI_PACING
+            tcp_pace_ssthresh(pcb);
+#endif /* TCP_SMI_PACING */
 
             pcb->cwnd = pcb->ssthresh + 3 * pcb->mss;
             pcb->flags |= TF_INFR;
+#if LWIP_TCP_SACK
+            pcb->recover = pcb->snd_max;
+#endif /* LWIP_TCP_SACK */
           } else {
             /* Inflate the congestion window, but not if it means that
                the value overflows. */
-            if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+            if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
               pcb->cwnd += pcb->mss;
             }
+#if LWIP_TCP_SACK
+            /* Each further duplicate means a segment has left the
+               network; spend the slot on the next reported hole. */
+            if (pcb->flags & TF_SACK) {
+              tcp_rexmit_sack(pcb);
+            }
+#endif /* LWIP_TCP_SACK */
           }
         }
       } else {
@@ -790,24 +842,43 @@ tcp_receive(struct tcp_pcb *pcb)
     } else if (TCP_SEQ_BETWEEN(ackno, pcb->lastack+1, pcb->snd_max)){
       /* We come here when the ACK acknowledges new data. */
       
+      /* Update the send buffer space. */
+      pcb->acked = (tcpwnd_size_t)(ackno - pcb->lastack);
+
       /* Reset the "IN Fast Retransmit" flag, since we are no longer
          in fast retransmit. Also reset the congestion window to the
          slow start threshold. */
       if (pcb->flags & TF_INFR) {
-        pcb->flags &= ~TF_INFR;
-        pcb->cwnd = pcb->ssthresh;
+#if LWIP_TCP_SACK
+        if ((pcb->flags & TF_SACK) && TCP_SEQ_LT(ackno, pcb->recover)) {
+          /* A partial ACK: more was lost in the same window.  Stay in
+             recovery, deflate cwnd by what left the network, and let the
+             next hole go straight away (RFC 6675). */
+          partial_ack = 1;
+          if (pcb->cwnd > pcb->acked) {
+            pcb->cwnd -= pcb->acked;
+          } else {
+            pcb->cwnd = 0;
+          }
+          pcb->cwnd += pcb->mss;
+        } else
+#endif /* LWIP_TCP_SACK */
+        {
+          pcb->flags &= ~TF_INFR;
+          pcb->cwnd = pcb->ssthresh;
+        }
       }
 
       /* Reset the number of retransmissions. */
       pcb->nrtx = 0;
 
       /* Reset the retransmission time-out. */
-      pcb->rto = (pcb->sa >> 3) + pcb->sv;
-
-      /* Update the send buffer space. Diff between the two can never exceed 64K? */
-      pcb->acked = (u16_t)(ackno - pcb->lastack);
+      pcb->rto = TCP_RTO_BASE(pcb);
 
       pcb->snd_buf += pcb->acked;
+#if TCP_SMI_PACING
+      tcp_pace_acked(pcb, pcb->acked);
+#endif /* TCP_SMI_PACING */
 
       /* Reset the fast retransmit variables. */
       pcb->dupacks = 0;
@@ -815,14 +886,14 @@ tcp_receive(struct tcp_pcb *pcb)
 
       /* Update the congestion control variables (cwnd and
          ssthresh). */
-      if (pcb->state >= ESTABLISHED) {
+      if (pcb->state >= ESTABLISHED && !(pcb->flags & TF_INFR)) {
         if (pcb->cwnd < pcb->ssthresh) {
-          if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+          if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
             pcb->cwnd += pcb->mss;
           }
           LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"U16_F"\n", pcb->cwnd));
         } else {
-          u16_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
+          tcpwnd_size_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
           if (new_cwnd > pcb->cwnd) {
             pcb->cwnd = new_cwnd;
           }
@@ -869,6 +940,12 @@ tcp_receive(struct tcp_pcb *pcb)
         pcb->rtime = 0;
 
       pcb->polltmr = 0;
+
+#if LWIP_TCP_SACK
+      if (partial_ack) {
+        tcp_rexmit_sack(pcb);
+      }
+#endif /* LWIP_TCP_SACK */
     } else {
       /* Fix bug bug #21582: out of sequence ACK, didn't really ack anything */
       pcb->acked = 0;
@@ -901,8 +978,9 @@ tcp_receive(struct tcp_pcb *pcb)
           pcb->unacked != NULL || pcb->unsent != NULL);
       }
 
-      if (pcb->unsent != NULL) {
-        pcb->snd_nxt = htonl(pcb->unsent->tcphdr->seqno);
+      if (pcb->unsent != NULL &&
+          TCP_SEQ_LT(pcb->snd_nxt, ntohl(pcb->unsent->tcphdr->seqno))) {
+        pcb->snd_nxt = ntohl(pcb->unsent->tcphdr->seqno);
       }
     }
     /* End of ACK for new data processing. */
@@ -916,10 +994,13 @@ tcp_receive(struct tcp_pcb *pcb)
     if (pcb->rttest && TCP_SEQ_LT(pcb->rtseq, ackno)) {
       /* diff between this shouldn't exceed 32K since this are tcp timer ticks
          and a round-trip shouldn't be that long... */
-      m = (s16_t)(tcp_ticks - pcb->rttest);
+      m = (s16_t)(TCP_RTT_NOW() - pcb->rttest);
+#if TCP_SMI_PACING
+      m = tcp_pace_rtt(pcb, m);
+#endif /* TCP_SMI_PACING */
 
-      LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_receive: experienced rtt %"U16_F" ticks (%"U16_F" msec).\n",
-                                  m, m * TCP_SLOW_INTERVAL));
+      LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_receive: experienced rtt %"U16_F" units (%"U16_F" msec).\n",
+                                  m, m * TCP_RTT_UNIT));
 
       /* This is taken directly from VJs original code in his paper */
       m = m - (pcb->sa >> 3);
@@ -929,7 +1010,7 @@ tcp_receive(struct tcp_pcb *pcb)
       }
       m = m - (pcb->sv >> 2);
       pcb->sv += m;
-      pcb->rto = (pcb->sa >> 3) + pcb->sv;
+      pcb->rto = TCP_RTO_BASE(pcb);
 
       LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_receive: RTO %"U16_F" (%"U16_F" milliseconds)\n",
                                   pcb->rto, pcb->rto * TCP_SLOW_INTERVAL));
@@ -1045,6 +1126,7 @@ tcp_receive(struct tcp_pcb *pcb)
            we have to trim the end of the segment and update rcv_nxt
            and pass the data to the application. */
 #if TCP_QUEUE_OOSEQ
+        had_ooseq = (pcb->ooseq != NULL);
         if (pcb->ooseq != NULL &&
                 TCP_SEQ_LEQ(pcb->ooseq->tcphdr->seqno, seqno + inseg.len)) {
           if (pcb->ooseq->len > 0) {
@@ -1153,13 +1235,24 @@ tcp_receive(struct tcp_pcb *pcb)
 #endif /* TCP_QUEUE_OOSEQ */
 
 
-        /* Acknowledge the segment(s). */
-        tcp_ack(pcb);
+        /* Acknowledge the segment(s).  Filling a hole is ACKed at once
+           (RFC 5681 4.2): the sender is in recovery and waiting on us. */
+#if TCP_QUEUE_OOSEQ
+        if (had_ooseq) {
+          tcp_ack_now(pcb);
+        } else
+#endif /* TCP_QUEUE_OOSEQ */
+        {
+          tcp_ack(pcb);
+        }
 
       } else {
         /* We get here if the incoming segment is out-of-sequence. */
         tcp_ack_now(pcb);
 #if TCP_QUEUE_OOSEQ
+#if LWIP_TCP_SACK
+        pcb->ooseq_last = seqno;
+#endif /* LWIP_TCP_SACK */
         /* We queue the segment on the ->ooseq queue. */
         if (pcb->ooseq == NULL) {
           pcb->ooseq = tcp_seg_copy(&inseg);
@@ -1197,7 +1290,7 @@ tcp_receive(struct tcp_pcb *pcb)
                   }
                 }
                 tcp_seg_free(next);
-                if (cseg->next != NULL) {
+                if (cseg != NULL && cseg->next != NULL) {
                   next = cseg->next;
                   if (TCP_SEQ_GT(seqno + cseg->len, next->tcphdr->seqno)) {
                     /* We need to trim the incoming segment. */
@@ -1278,6 +1371,26 @@ tcp_receive(struct tcp_pcb *pcb)
             prev = next;
           }
         }
+#if TCP_OOSEQ_MAX_PBUFS
+        /* Everything on ooseq pins a netif receive buffer (or a chain of
+           pool pbufs), and those are what the next burst arrives in.  Cut
+           the queue back from the far end: that data is the cheapest for
+           the sender to resend and the last we would have needed. */
+        ooseq_clen = 0;
+        for (prev = NULL, next = pcb->ooseq; next != NULL;
+             prev = next, next = next->next) {
+          ooseq_clen += pbuf_clen(next->p);
+          if (ooseq_clen > TCP_OOSEQ_MAX_PBUFS) {
+            tcp_segs_free(next);
+            if (prev == NULL) {
+              pcb->ooseq = NULL;
+            } else {
+              prev->next = NULL;
+            }
+            break;
+          }
+        }
+#endif /* TCP_OOSEQ_MAX_PBUFS */
 #endif /* TCP_QUEUE_OOSEQ */
 
       }
@@ -1303,8 +1416,8 @@ tcp_receive(struct tcp_pcb *pcb)
  * Parses the options contained in the incoming segment. (Code taken
  * from uIP with only small changes.)
  *
- * Called from tcp_listen_input() and tcp_process().
- * Currently, only the MSS option is supported!
+ * Called from tcp_listen_input() and tcp_process(), for SYN segments
+ * only: the MSS, window scale and SACK permitted options are understood.
  *
  * @param pcb the tcp_pcb for which a segment arrived
  */
@@ -1317,7 +1430,7 @@ tcp_parseopt(struct tcp_pcb *pcb)
 
   opts = (u8_t *)tcphdr + TCP_HLEN;
 
-  /* Parse the TCP MSS option, if present. */
+  /* Parse the TCP options, if present. */
   if(TCPH_HDRLEN(tcphdr) > 0x5) {
     for(c = 0; c < (TCPH_HDRLEN(tcphdr) - 5) << 2 ;) {
       opt = opts[c];
@@ -1332,9 +1445,23 @@ tcp_parseopt(struct tcp_pcb *pcb)
         /* An MSS option with the right option length. */
         mss = (opts[c + 2] << 8) | opts[c + 3];
         pcb->mss = mss > TCP_MSS? TCP_MSS: mss;
-
-        /* And we are done processing options. */
-        break;
+        c += 4;
+#if LWIP_WND_SCALE
+      } else if (opt == 0x03 &&
+        opts[c + 1] == 0x03) {
+        /* Window scale.  RFC 7323 says to treat shifts above 14 as 14. */
+        pcb->flags |= TF_WND_SCALE;
+        pcb->snd_scale = LWIP_MIN(opts[c + 2], 14);
+        pcb->rcv_scale = TCP_RCV_SCALE;
+        c += 3;
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_SACK
+      } else if (opt == 0x04 &&
+        opts[c + 1] == 0x02) {
+        /* SACK permitted. */
+        pcb->flags |= TF_SACK;
+        c += 2;
+#endif /* LWIP_TCP_SACK */
       } else {
         if (opts[c + 1] == 0) {
           /* If the length field is zero, the options are malformed
@@ -1349,4 +1476,60 @@ tcp_parseopt(struct tcp_pcb *pcb)
   }
 }
 
+#if LWIP_TCP_SACK
+/**
+ * Marks the segments on the unacked queue that the SACK blocks in the
+ * incoming ACK cover, so that tcp_rexmit_sack() can skip them.  Blocks
+ * below lastack (D-SACK) or not covering a whole segment mark nothing.
+ *
+ * Called from tcp_receive() for every ACK on a connection with TF_SACK.
+ *
+ * @param pcb the tcp_pcb for which an ACK arrived
+ * @return the number of segments newly marked
+ */
+static u8_t
+tcp_parse_sack(struct tcp_pcb *pcb)
+{
+  u8_t c, i, optlen, marked = 0;
+  u8_t *opts;
+  u32_t left, right, segno;
+  struct tcp_seg *seg;
+
+  opts = (u8_t *)tcphdr + TCP_HLEN;
+  optlen = (TCPH_HDRLEN(tcphdr) - 5) << 2;
+
+  for(c = 0; c < optlen;) {
+    if (opts[c] == 0x00) {
+      break;
+    } else if (opts[c] == 0x01) {
+      ++c;
+      continue;
+    }
+    if (c + 1 >= optlen || opts[c + 1] < 2 || c + opts[c + 1] > optlen) {
+      /* Malformed. */
+      break;
+    }
+    if (opts[c] == 0x05) {
+      for (i = c + 2; i + 8 <= c + opts[c + 1]; i += 8) {
+        left = ((u32_t)opts[i] << 24) | ((u32_t)opts[i + 1] << 16) |
+               ((u32_t)opts[i + 2] << 8) | opts[i + 3];
+        right = ((u32_t)opts[i + 4] << 24) | ((u32_t)opts[i + 5] << 16) |
+                ((u32_t)opts[i + 6] << 8) | opts[i + 7];
+        for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+          segno = ntohl(seg->tcphdr->seqno);
+          if (TCP_SEQ_GEQ(segno, left) &&
+              TCP_SEQ_LEQ(segno + TCP_TCPLEN(seg), right) &&
+              !(seg->flags & TF_SEG_SACKED)) {
+            seg->flags |= TF_SEG_SACKED;
+            marked++;
+          }
+        }
+      }
+    }
+    c += opts[c + 1];
+  }
+  return marked;
+}
+#endif /* LWIP_TCP_SACK */
+
 #endif /* LWIP_TCP */
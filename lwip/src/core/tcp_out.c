@@ -59,6 +59,164 @@
 /* Forward declarations.*/
 static void tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb);
 
+#if CHECKSUM_GEN_TCP
+/**
+ * Should lwIP compute the TCP checksum of a segment to dest, or will the
+ * hardware of the interface it goes out on fill it in?
+ */
+static u8_t
+tcp_checksum_gen(struct ip_addr *dest)
+{
+  return NETIF_CHECKSUM_ENABLED(ip_route(dest), NETIF_CHECKSUM_GEN_TCP);
+}
+#endif /* CHECKSUM_GEN_TCP */
+
+#if TCP_CHECKSUM_ON_COPY
+/**
+ * Add the checksum of len more bytes of data to a segment's running sum.
+ * The running sum is kept byte-swapped while the data so far has odd
+ * length, so that chksum (taken from the start of the new data) can
+ * always just be added.
+ */
+static void
+tcp_seg_add_chksum(u16_t chksum, u16_t len, u16_t *seg_chksum,
+                   u8_t *seg_chksum_swapped)
+{
+  u32_t acc;
+
+  acc = (u32_t)chksum + *seg_chksum;
+  acc = (acc >> 16) + (acc & 0xffffUL);
+  acc = (acc >> 16) + (acc & 0xffffUL);
+  if ((len & 1) != 0) {
+    *seg_chksum_swapped = 1 - *seg_chksum_swapped;
+    acc = ((acc & 0xff) << 8) | ((acc & 0xff00UL) >> 8);
+  }
+  *seg_chksum = (u16_t)acc;
+}
+#endif /* TCP_CHECKSUM_ON_COPY */
+
+/**
+ * Insert a segment into a queue that is kept in sequence order.
+ */
+static void
+tcp_seg_insert_ordered(struct tcp_seg **queue, struct tcp_seg *seg)
+{
+  struct tcp_seg **cur_seg = queue;
+
+  while (*cur_seg != NULL &&
+         TCP_SEQ_LT(ntohl((*cur_seg)->tcphdr->seqno), ntohl(seg->tcphdr->seqno))) {
+    cur_seg = &((*cur_seg)->next);
+  }
+  seg->next = *cur_seg;
+  *cur_seg = seg;
+}
+
+/**
+ * Build the options for a SYN or SYN|ACK: always MSS, then window scale
+ * and SACK permitted if they are set in pcb->flags.  tcp_connect() sets
+ * both before sending a SYN; on a SYN|ACK they are only set if the peer's
+ * SYN offered them.
+ *
+ * @param pcb the tcp_pcb the SYN is for
+ * @param opts buffer of at least TCP_SYN_OPTLEN_MAX bytes
+ * @return the length of the options, a multiple of 4
+ */
+u8_t
+tcp_build_syn_options(struct tcp_pcb *pcb, u8_t *opts)
+{
+  u32_t mss = TCP_BUILD_MSS_OPTION();
+  u8_t len = 4;
+
+  SMEMCPY(opts, &mss, 4);
+#if LWIP_WND_SCALE
+  if (pcb->flags & TF_WND_SCALE) {
+    opts[len++] = 0x01;
+    opts[len++] = 0x03;
+    opts[len++] = 0x03;
+    opts[len++] = TCP_RCV_SCALE;
+  }
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_SACK
+  if (pcb->flags & TF_SACK) {
+    opts[len++] = 0x01;
+    opts[len++] = 0x01;
+    opts[len++] = 0x04;
+    opts[len++] = 0x02;
+  }
+#endif /* LWIP_TCP_SACK */
+  LWIP_UNUSED_ARG(pcb);
+  return len;
+}
+
+#if LWIP_TCP_SACK
+static u8_t *
+tcp_put_seqno(u8_t *p, u32_t v)
+{
+  p[0] = (u8_t)(v >> 24);
+  p[1] = (u8_t)(v >> 16);
+  p[2] = (u8_t)(v >> 8);
+  p[3] = (u8_t)v;
+  return p + 4;
+}
+
+/**
+ * Build the SACK option for an ACK from the runs of contiguous data on
+ * ooseq.  RFC 2018 wants the first block to be the one holding the most
+ * recently received segment; the rest follow in sequence order, as many
+ * as fit.
+ *
+ * @param pcb the tcp_pcb, with a non-empty ooseq queue
+ * @param opts buffer of at least TCP_SACK_OPTLEN_MAX bytes
+ * @return the length of the options, a multiple of 4
+ */
+static u8_t
+tcp_build_sack_options(struct tcp_pcb *pcb, u8_t *opts)
+{
+  struct tcp_seg *seg;
+  u32_t left, right;
+  u32_t edges[2 * LWIP_TCP_MAX_SACK_NUM];
+  u8_t n = 1, newest = 0, i;
+  u8_t *p;
+
+  seg = pcb->ooseq;
+  while (seg != NULL) {
+    left = seg->tcphdr->seqno;
+    right = left + TCP_TCPLEN(seg);
+    for (seg = seg->next; seg != NULL && seg->tcphdr->seqno == right;
+         seg = seg->next) {
+      right += TCP_TCPLEN(seg);
+    }
+    if (!newest && TCP_SEQ_GEQ(pcb->ooseq_last, left) &&
+        TCP_SEQ_LT(pcb->ooseq_last, right)) {
+      edges[0] = left;
+      edges[1] = right;
+      newest = 1;
+    } else if (n < LWIP_TCP_MAX_SACK_NUM) {
+      edges[2 * n] = left;
+      edges[2 * n + 1] = right;
+      n++;
+    }
+  }
+
+  /* The newest segment may since have been trimmed off ooseq. */
+  if (n == 1 && !newest) {
+    return 0;
+  }
+  i = newest ? 0 : 1;
+
+  p = opts;
+  *p++ = 0x01;
+  *p++ = 0x01;
+  *p++ = 0x05;
+  *p++ = (u8_t)(2 + 8 * (n - i));
+  for (; i < n; i++) {
+    p = tcp_put_seqno(p, edges[2 * i]);
+    p = tcp_put_seqno(p, edges[2 * i + 1]);
+  }
+  return (u8_t)(p - opts);
+}
+#endif /* LWIP_TCP_SACK */
+
 /**
  * Called by tcp_close() to send a segment including flags but not data.
  *
@@ -137,6 +295,10 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
   u16_t left, seglen;
   void *ptr;
   u16_t queuelen;
+#if TCP_CHECKSUM_ON_COPY
+  u8_t sum_on_copy;
+  u16_t datasum;
+#endif /* TCP_CHECKSUM_ON_COPY */
 
   LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_enqueue(pcb=%p, arg=%p, len=%"U16_F", flags=%"X16_F", apiflags=%"U16_F")\n",
     (void *)pcb, arg, len, (u16_t)flags, (u16_t)apiflags));
@@ -153,6 +315,11 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
   left = len;
   ptr = arg;
 
+#if TCP_CHECKSUM_ON_COPY
+  /* No point summing the data if the hardware is going to. */
+  sum_on_copy = tcp_checksum_gen(&(pcb->remote_ip));
+#endif /* TCP_CHECKSUM_ON_COPY */
+
   /* seqno will be the sequence number of the first segment enqueued
    * by the call to this function. */
   seqno = pcb->snd_lbb;
@@ -195,6 +362,14 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
     }
     seg->next = NULL;
     seg->p = NULL;
+#if TCP_CHECKSUM_ON_COPY
+    seg->chksum = 0;
+    seg->chksum_swapped = 0;
+    seg->chksum_valid = 0;
+#endif /* TCP_CHECKSUM_ON_COPY */
+#if LWIP_TCP_SACK
+    seg->flags = 0;
+#endif /* LWIP_TCP_SACK */
 
     /* first segment of to-be-queued data? */
     if (queue == NULL) {
@@ -233,6 +408,13 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
       LWIP_ASSERT("check that first pbuf can hold the complete seglen",
                   (seg->p->len >= seglen));
       queuelen += pbuf_clen(seg->p);
+#if TCP_CHECKSUM_ON_COPY
+      if (arg != NULL && sum_on_copy) {
+        datasum = LWIP_CHKSUM_COPY(seg->p->payload, ptr, seglen);
+        tcp_seg_add_chksum(datasum, seglen, &seg->chksum, &seg->chksum_swapped);
+        seg->chksum_valid = 1;
+      } else
+#endif /* TCP_CHECKSUM_ON_COPY */
       if (arg != NULL) {
         MEMCPY(seg->p->payload, ptr, seglen);
       }
@@ -340,6 +522,17 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
       goto memerr;
     }
     pbuf_cat(useg->p, queue->p);
+#if TCP_CHECKSUM_ON_COPY
+    if (useg->chksum_valid && queue->chksum_valid) {
+      datasum = queue->chksum;
+      if (queue->chksum_swapped) {
+        datasum = ((datasum & 0xff) << 8) | ((datasum & 0xff00) >> 8);
+      }
+      tcp_seg_add_chksum(datasum, queue->len, &useg->chksum, &useg->chksum_swapped);
+    } else {
+      useg->chksum_valid = 0;
+    }
+#endif /* TCP_CHECKSUM_ON_COPY */
     useg->len += queue->len;
     useg->next = queue->next;
 
@@ -413,7 +606,12 @@ tcp_output(struct tcp_pcb *pcb)
   struct pbuf *p;
   struct tcp_hdr *tcphdr;
   struct tcp_seg *seg, *useg;
-  u32_t wnd;
+  u32_t wnd, snd_nxt;
+  u8_t can_send, send_ack;
+#if LWIP_TCP_SACK
+  u8_t optlen;
+  u8_t opts[TCP_SACK_OPTLEN_MAX];
+#endif /* LWIP_TCP_SACK */
 #if TCP_CWND_DEBUG
   s16_t i = 0;
 #endif /* TCP_CWND_DEBUG */
@@ -440,12 +638,35 @@ tcp_output(struct tcp_pcb *pcb)
    * because the ->unsent queue is empty or because the window does
    * not allow it), construct an empty ACK segment and send it.
    *
-   * If data is to be sent, we will just piggyback the ACK (see below).
+   * If data is to be sent, we will just piggyback the ACK (see below),
+   * unless there are SACK blocks to report: only the empty ACK carries
+   * them, so it goes first and the data follows.
    */
-  if (pcb->flags & TF_ACK_NOW &&
-     (seg == NULL ||
-      ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len > wnd)) {
+#if TCP_SMI_PACING
+  /* Each burst gets a fresh allowance, the first time we get here. */
+  if (pcb->pace_epoch != tcp_pace_epoch) {
+    pcb->pace_epoch = tcp_pace_epoch;
+    pcb->pace_left = tcp_pace_burst(pcb);
+  }
+#endif /* TCP_SMI_PACING */
+
+  can_send = (seg != NULL && tcp_pace_allows(pcb) &&
+              ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd);
+  send_ack = (pcb->flags & TF_ACK_NOW) && !can_send;
+#if LWIP_TCP_SACK
+  optlen = 0;
+  if ((pcb->flags & TF_ACK_NOW) && (pcb->flags & TF_SACK) &&
+      pcb->ooseq != NULL) {
+    optlen = tcp_build_sack_options(pcb, opts);
+    send_ack = 1;
+  }
+#endif /* LWIP_TCP_SACK */
+  if (send_ack) {
+#if LWIP_TCP_SACK
+    p = pbuf_alloc(PBUF_IP, TCP_HLEN + optlen, PBUF_RAM);
+#else /* LWIP_TCP_SACK */
     p = pbuf_alloc(PBUF_IP, TCP_HLEN, PBUF_RAM);
+#endif /* LWIP_TCP_SACK */
     if (p == NULL) {
       LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_output: (ACK) could not allocate pbuf\n"));
       return ERR_BUF;
@@ -460,14 +681,20 @@ tcp_output(struct tcp_pcb *pcb)
     tcphdr->seqno = htonl(pcb->snd_nxt);
     tcphdr->ackno = htonl(pcb->rcv_nxt);
     TCPH_FLAGS_SET(tcphdr, TCP_ACK);
-    tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+    tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
     tcphdr->urgp = 0;
+#if LWIP_TCP_SACK
+    TCPH_HDRLEN_SET(tcphdr, 5 + optlen / 4);
+    SMEMCPY((u8_t *)tcphdr + TCP_HLEN, opts, optlen);
+#else /* LWIP_TCP_SACK */
     TCPH_HDRLEN_SET(tcphdr, 5);
+#endif /* LWIP_TCP_SACK */
 
     tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
-    tcphdr->chksum = inet_chksum_pseudo(p, &(pcb->local_ip), &(pcb->remote_ip),
-          IP_PROTO_TCP, p->tot_len);
+    if (tcp_checksum_gen(&(pcb->remote_ip)))
+      tcphdr->chksum = inet_chksum_pseudo(p, &(pcb->local_ip), &(pcb->remote_ip),
+            IP_PROTO_TCP, p->tot_len);
 #endif
 #if LWIP_NETIF_HWADDRHINT
     {
@@ -486,7 +713,9 @@ tcp_output(struct tcp_pcb *pcb)
 #endif /* LWIP_NETIF_HWADDRHINT*/
     pbuf_free(p);
 
-    return ERR_OK;
+    if (!can_send) {
+      return ERR_OK;
+    }
   }
 
 #if TCP_OUTPUT_DEBUG
@@ -511,7 +740,7 @@ tcp_output(struct tcp_pcb *pcb)
   }
 #endif /* TCP_CWND_DEBUG */
   /* data available and window allows it to be sent? */
-  while (seg != NULL &&
+  while (seg != NULL && tcp_pace_allows(pcb) &&
          ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd) {
     LWIP_ASSERT("RST not expected here!", 
                 (TCPH_FLAGS(seg->tcphdr) & TCP_RST) == 0);
@@ -543,7 +772,15 @@ tcp_output(struct tcp_pcb *pcb)
     }
 
     tcp_output_segment(seg, pcb);
-    pcb->snd_nxt = ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg);
+#if TCP_SMI_PACING
+    pcb->pace_left -= LWIP_MIN(pcb->pace_left, seg->len);
+#endif /* TCP_SMI_PACING */
+    /* A retransmission from the middle of the window must not pull
+       snd_nxt back underneath data that is already out. */
+    snd_nxt = ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg);
+    if (TCP_SEQ_LT(pcb->snd_nxt, snd_nxt)) {
+      pcb->snd_nxt = snd_nxt;
+    }
     if (TCP_SEQ_LT(pcb->snd_max, pcb->snd_nxt)) {
       pcb->snd_max = pcb->snd_nxt;
     }
@@ -557,12 +794,12 @@ tcp_output(struct tcp_pcb *pcb)
       /* unacked list is not empty? */
       } else {
         /* In the case of fast retransmit, the packet should not go to the tail
-         * of the unacked queue, but rather at the head. We need to check for
-         * this case. -STJ Jul 27, 2004 */
+         * of the unacked queue, but rather at the head, or for a SACK hole
+         * somewhere in the middle. We need to check for this case.
+         * -STJ Jul 27, 2004 */
         if (TCP_SEQ_LT(ntohl(seg->tcphdr->seqno), ntohl(useg->tcphdr->seqno))){
-          /* add segment to head of unacked list */
-          seg->next = pcb->unacked;
-          pcb->unacked = seg;
+          /* insert segment into unacked list in sequence order */
+          tcp_seg_insert_ordered(&pcb->unacked, seg);
         } else {
           /* add segment to tail of unacked list */
           useg->next = seg;
@@ -606,8 +843,13 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
    wnd fields remain. */
   seg->tcphdr->ackno = htonl(pcb->rcv_nxt);
 
-  /* advertise our receive window size in this TCP segment */
-  seg->tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  /* advertise our receive window size in this TCP segment; the window
+     in a SYN is never scaled */
+  if (TCPH_FLAGS(seg->tcphdr) & TCP_SYN) {
+    seg->tcphdr->wnd = htons(TCPWND16(pcb->rcv_ann_wnd));
+  } else {
+    seg->tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
+  }
 
   /* If we don't have a local IP address, we get one by
      calling ip_route(). */
@@ -623,8 +865,11 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
   if(pcb->rtime == -1)
     pcb->rtime = 0;
 
-  if (pcb->rttest == 0) {
-    pcb->rttest = tcp_ticks;
+  /* Time only first transmissions (Karn): an ACK for a resent segment
+     cannot say which copy it answers. */
+  if (pcb->rttest == 0 &&
+      !TCP_SEQ_LT(ntohl(seg->tcphdr->seqno), pcb->snd_max)) {
+    pcb->rttest = TCP_RTT_NOW();
     pcb->rtseq = ntohl(seg->tcphdr->seqno);
 
     LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_output_segment: rtseq %"U32_F"\n", pcb->rtseq));
@@ -642,10 +887,29 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
 
   seg->tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
-  seg->tcphdr->chksum = inet_chksum_pseudo(seg->p,
-             &(pcb->local_ip),
-             &(pcb->remote_ip),
-             IP_PROTO_TCP, seg->p->tot_len);
+#if TCP_CHECKSUM_ON_COPY
+  if (seg->chksum_valid && tcp_checksum_gen(&(pcb->remote_ip))) {
+    /* The data was summed when it was copied in; just add the header. */
+    u32_t acc;
+    u16_t datasum = seg->chksum;
+
+    if (seg->chksum_swapped) {
+      datasum = ((datasum & 0xff) << 8) | ((datasum & 0xff00) >> 8);
+    }
+    acc = (u16_t)~inet_chksum_pseudo_partial(seg->p, &(pcb->local_ip),
+             &(pcb->remote_ip), IP_PROTO_TCP, seg->p->tot_len,
+             TCPH_HDRLEN(seg->tcphdr) * 4);
+    acc += datasum;
+    acc = (acc >> 16) + (acc & 0xffffUL);
+    acc = (acc >> 16) + (acc & 0xffffUL);
+    seg->tcphdr->chksum = (u16_t)~acc;
+  } else
+#endif /* TCP_CHECKSUM_ON_COPY */
+  if (tcp_checksum_gen(&(pcb->remote_ip)))
+    seg->tcphdr->chksum = inet_chksum_pseudo(seg->p,
+               &(pcb->local_ip),
+               &(pcb->remote_ip),
+               IP_PROTO_TCP, seg->p->tot_len);
 #endif
   TCP_STATS_INC(tcp.xmit);
 
@@ -707,14 +971,15 @@ tcp_rst(u32_t seqno, u32_t ackno,
   tcphdr->seqno = htonl(seqno);
   tcphdr->ackno = htonl(ackno);
   TCPH_FLAGS_SET(tcphdr, TCP_RST | TCP_ACK);
-  tcphdr->wnd = htons(TCP_WND);
+  tcphdr->wnd = htons(TCPWND16(TCP_WND));
   tcphdr->urgp = 0;
   TCPH_HDRLEN_SET(tcphdr, 5);
 
   tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
-  tcphdr->chksum = inet_chksum_pseudo(p, local_ip, remote_ip,
-              IP_PROTO_TCP, p->tot_len);
+  if (tcp_checksum_gen(remote_ip))
+    tcphdr->chksum = inet_chksum_pseudo(p, local_ip, remote_ip,
+                IP_PROTO_TCP, p->tot_len);
 #endif
   TCP_STATS_INC(tcp.xmit);
   snmp_inc_tcpoutrsts();
@@ -740,8 +1005,17 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
     return;
   }
 
-  /* Move all unacked segments to the head of the unsent queue */
-  for (seg = pcb->unacked; seg->next != NULL; seg = seg->next);
+  /* Move all unacked segments to the head of the unsent queue.  After a
+     timeout SACK information is not to be trusted (RFC 2018): resend it
+     all, and leave fast recovery. */
+  for (seg = pcb->unacked; ; seg = seg->next) {
+#if LWIP_TCP_SACK
+    seg->flags = 0;
+#endif /* LWIP_TCP_SACK */
+    if (seg->next == NULL) {
+      break;
+    }
+  }
   /* concatenate unsent queue after unacked queue */
   seg->next = pcb->unsent;
   /* unsent queue is the concatenated queue (of unacked, unsent) */
@@ -750,6 +1024,7 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
   pcb->unacked = NULL;
 
   pcb->snd_nxt = ntohl(pcb->unsent->tcphdr->seqno);
+  pcb->flags &= ~TF_INFR;
   /* increment number of retransmissions */
   ++pcb->nrtx;
 
@@ -776,13 +1051,15 @@ tcp_rexmit(struct tcp_pcb *pcb)
     return;
   }
 
-  /* Move the first unacked segment to the unsent queue */
+  /* Move the first unacked segment to the unsent queue.  snd_nxt stays
+     put: tcp_output() only ever moves it forward. */
   seg = pcb->unacked->next;
   pcb->unacked->next = pcb->unsent;
   pcb->unsent = pcb->unacked;
   pcb->unacked = seg;
-
-  pcb->snd_nxt = ntohl(pcb->unsent->tcphdr->seqno);
+#if LWIP_TCP_SACK
+  pcb->unsent->flags |= TF_SEG_REXMIT;
+#endif /* LWIP_TCP_SACK */
 
   ++pcb->nrtx;
 
@@ -794,6 +1071,57 @@ tcp_rexmit(struct tcp_pcb *pcb)
   tcp_output(pcb);
 }
 
+#if LWIP_TCP_SACK
+/**
+ * Requeue the lowest segment the peer is known to be missing
+ *
+ * Called by tcp_receive() for each duplicate or partial ACK during fast
+ * recovery.  A segment is missing if it is the first unacked one, or if
+ * the peer has SACKed something above it.  Each segment goes at most once
+ * per recovery; a second loss is left to the retransmission timer.
+ *
+ * @param pcb the tcp_pcb in fast recovery
+ * @return 1 if a segment was requeued, 0 if there was no hole to fill
+ */
+u8_t
+tcp_rexmit_sack(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg, *prev, *hole, *hole_prev;
+  u32_t sacked = pcb->lastack;
+
+  hole = hole_prev = NULL;
+  for (prev = NULL, seg = pcb->unacked; seg != NULL;
+       prev = seg, seg = seg->next) {
+    if (seg->flags & TF_SEG_SACKED) {
+      sacked = ntohl(seg->tcphdr->seqno);
+    } else if (hole == NULL && !(seg->flags & TF_SEG_REXMIT)) {
+      hole = seg;
+      hole_prev = prev;
+    }
+  }
+
+  if (hole == NULL ||
+      (hole != pcb->unacked &&
+       !TCP_SEQ_LT(ntohl(hole->tcphdr->seqno), sacked))) {
+    return 0;
+  }
+
+  if (hole_prev == NULL) {
+    pcb->unacked = hole->next;
+  } else {
+    hole_prev->next = hole->next;
+  }
+  tcp_seg_insert_ordered(&pcb->unsent, hole);
+  hole->flags |= TF_SEG_REXMIT;
+
+  LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_rexmit_sack: %"U32_F" below %"U32_F"\n",
+                             ntohl(hole->tcphdr->seqno), sacked));
+  snmp_inc_tcpretranssegs();
+  /* tcp_input() calls tcp_output() once the ACK is processed. */
+  return 1;
+}
+#endif /* LWIP_TCP_SACK */
+
 /**
  * Send keepalive packets to keep a connection active although
  * no data is sent over it.
@@ -831,14 +1159,15 @@ tcp_keepalive(struct tcp_pcb *pcb)
   tcphdr->seqno = htonl(pcb->snd_nxt - 1);
   tcphdr->ackno = htonl(pcb->rcv_nxt);
   TCPH_FLAGS_SET(tcphdr, 0);
-  tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
   tcphdr->urgp = 0;
   TCPH_HDRLEN_SET(tcphdr, 5);
 
   tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
-  tcphdr->chksum = inet_chksum_pseudo(p, &pcb->local_ip, &pcb->remote_ip,
-                                      IP_PROTO_TCP, p->tot_len);
+  if (tcp_checksum_gen(&pcb->remote_ip))
+    tcphdr->chksum = inet_chksum_pseudo(p, &pcb->local_ip, &pcb->remote_ip,
+                                        IP_PROTO_TCP, p->tot_len);
 #endif
   TCP_STATS_INC(tcp.xmit);
 
@@ -914,7 +1243,7 @@ tcp_zero_window_probe(struct tcp_pcb *pcb)
   tcphdr->seqno = seg->tcphdr->seqno;
   tcphdr->ackno = htonl(pcb->rcv_nxt);
   TCPH_FLAGS_SET(tcphdr, 0);
-  tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
   tcphdr->urgp = 0;
   TCPH_HDRLEN_SET(tcphdr, 5);
 
@@ -923,8 +1252,9 @@ tcp_zero_window_probe(struct tcp_pcb *pcb)
 
   tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
-  tcphdr->chksum = inet_chksum_pseudo(p, &pcb->local_ip, &pcb->remote_ip,
-                                      IP_PROTO_TCP, p->tot_len);
+  if (tcp_checksum_gen(&pcb->remote_ip))
+    tcphdr->chksum = inet_chksum_pseudo(p, &pcb->local_ip, &pcb->remote_ip,
+                                        IP_PROTO_TCP, p->tot_len);
 #endif
   TCP_STATS_INC(tcp.xmit);
 
@@ -0,0 +1,232 @@
+/**
+ * @file
+ * Transmission Control Protocol, pacing for a stack that runs in bursts
+ *
+ * NetWatch only gets to run, and so only sends and receives, once per
+ * SMI.  Seen from the peer, we answer in bursts at the SMI rate with
+ * silence in between, and that upsets the usual congestion control in
+ * three ways:
+ *
+ * - An ACK that arrived just after one SMI is not seen until the next,
+ *   so every RTT sample is rounded up to a whole number of SMI periods.
+ *   Samples here are taken in milliseconds and corrected by half a
+ *   period, which is the average amount by which they are late.
+ *
+ * - A whole cwnd goes out back to back at the start of an SMI, and on a
+ *   path slower than the local link that is what fills the bottleneck
+ *   queue and gets dropped.  When the RTT spans several SMI periods,
+ *   each burst is limited to that period's share of cwnd (with some
+ *   headroom, so that cwnd can still grow), which spreads the window
+ *   out over the RTT as the ACK clock would have.
+ *
+ * - A loss from one of those bursts says little about the capacity of
+ *   the path, so halving cwnd for it only makes throughput sawtooth.
+ *   Following Westwood+, we keep an estimate of the rate at which the
+ *   peer is acknowledging data, and after a loss ssthresh is not set
+ *   below the bandwidth-delay product that rate implies.
+ *
+ * tcp_pace_tick() must be called at the start of each SMI, before any
+ * input is processed.
+ */
+
+/*
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include "lwip/opt.h"
+
+#if LWIP_TCP && TCP_SMI_PACING /* don't build if not configured for use in lwipopts.h */
+
+#include "lwip/tcp.h"
+#include "lwip/def.h"
+
+/** Period assumed until we have measured one, in milliseconds */
+#define TCP_PACE_PERIOD_INIT  64
+/** Gaps longer than this (ms) are pauses, not the SMI period */
+#define TCP_PACE_PERIOD_MAX   1000
+/** Longest RTT sample we take, in ms; sa holds eight times this in 16 bits */
+#define TCP_PACE_RTT_MAX      4000
+/** Least retransmission time-out, in slow timer ticks */
+#define TCP_PACE_RTO_MIN      2
+
+/** Start of the current SMI, in milliseconds */
+u32_t tcp_pace_now;
+/** Number of the current SMI, for telling whether an allowance is stale */
+u32_t tcp_pace_epoch;
+
+/* Average time between SMIs, in ms, times 8. */
+static u32_t tcp_pace_period8 = TCP_PACE_PERIOD_INIT << 3;
+
+static u32_t
+tcp_pace_period(void)
+{
+  u32_t period = tcp_pace_period8 >> 3;
+  return period ? period : 1;
+}
+
+/* The time one round of sending takes: the RTT, but never less than a
+   period, since we cannot send again before the next SMI in any case. */
+static u32_t
+tcp_pace_round(struct tcp_pcb *pcb)
+{
+  return LWIP_MAX((u32_t)(pcb->sa >> 3), tcp_pace_period());
+}
+
+/**
+ * Start a new burst.
+ *
+ * @param now the time, in milliseconds
+ */
+void
+tcp_pace_tick(u32_t now)
+{
+  u32_t gap;
+
+  if (tcp_pace_epoch != 0) {
+    gap = now - tcp_pace_now;
+    if (gap <= TCP_PACE_PERIOD_MAX) {
+      tcp_pace_period8 += gap - (tcp_pace_period8 >> 3);
+    }
+  }
+  tcp_pace_now = now;
+  tcp_pace_epoch++;
+}
+
+/**
+ * Correct a raw RTT sample for the time the ACK spent waiting for us to
+ * notice it.
+ *
+ * @param pcb the tcp_pcb the sample is for
+ * @param m the raw sample, in milliseconds
+ * @return the sample to feed the RTT estimator
+ */
+s16_t
+tcp_pace_rtt(struct tcp_pcb *pcb, s16_t m)
+{
+  s32_t rtt = (s32_t)m - (s32_t)(tcp_pace_period() / 2);
+
+  if (rtt < 1) {
+    rtt = 1;
+  } else if (rtt > TCP_PACE_RTT_MAX) {
+    rtt = TCP_PACE_RTT_MAX;
+  }
+  if (pcb->rtt_min == 0 || rtt < pcb->rtt_min) {
+    pcb->rtt_min = (u16_t)rtt;
+  }
+  return (s16_t)rtt;
+}
+
+/**
+ * Work out the retransmission time-out from the millisecond estimator.
+ *
+ * The ACK may be seen up to a period late, and the slow timer itself
+ * only runs once per SMI, so a period is added before rounding up.
+ *
+ * @param pcb the tcp_pcb to calculate for
+ * @return the time-out before backoff, in slow timer ticks
+ */
+s16_t
+tcp_pace_rto(struct tcp_pcb *pcb)
+{
+  u32_t ms = (u32_t)((pcb->sa >> 3) + pcb->sv) + tcp_pace_period();
+  u32_t ticks = (ms + TCP_SLOW_INTERVAL - 1) / TCP_SLOW_INTERVAL;
+
+  return (s16_t)LWIP_MAX(ticks, TCP_PACE_RTO_MIN);
+}
+
+/**
+ * Account for newly acknowledged data in the delivery rate estimate.
+ *
+ * A sample is taken once per round, and samples are smoothed with a
+ * gain of 1/8.  A round that took much longer than it should have means
+ * we were idle or stalled rather than limited by the path, so it is
+ * not counted.
+ *
+ * @param pcb the tcp_pcb that received the ACK
+ * @param acked how many bytes it acknowledged
+ */
+void
+tcp_pace_acked(struct tcp_pcb *pcb, tcpwnd_size_t acked)
+{
+  u32_t round, elapsed, sample;
+
+  if (pcb->bw_start == 0) {
+    pcb->bw_start = tcp_pace_now;
+    pcb->bw_acked = 0;
+    return;
+  }
+
+  pcb->bw_acked += acked;
+  elapsed = tcp_pace_now - pcb->bw_start;
+  round = tcp_pace_round(pcb);
+  if (elapsed < round) {
+    return;
+  }
+
+  if (elapsed <= 4 * round) {
+    sample = pcb->bw_acked / elapsed;
+    if (pcb->bw == 0) {
+      pcb->bw = sample;
+    } else {
+      pcb->bw = pcb->bw - (pcb->bw >> 3) + (sample >> 3);
+    }
+  }
+  pcb->bw_start = tcp_pace_now;
+  pcb->bw_acked = 0;
+}
+
+/**
+ * Called once ssthresh has been cut after a loss: do not let it go below
+ * what the path has been shown to carry.
+ *
+ * @param pcb the tcp_pcb that saw the loss
+ */
+void
+tcp_pace_ssthresh(struct tcp_pcb *pcb)
+{
+  u32_t bdp;
+
+  if (pcb->bw == 0 || pcb->rtt_min == 0) {
+    return;
+  }
+  bdp = pcb->bw * LWIP_MAX((u32_t)pcb->rtt_min, tcp_pace_period());
+  bdp = LWIP_MIN(bdp, pcb->snd_wnd);
+  if (bdp > pcb->ssthresh) {
+    pcb->ssthresh = (tcpwnd_size_t)bdp;
+  }
+}
+
+/**
+ * How much a connection may send in one SMI: cwnd spread evenly over a
+ * round, doubled in slow start and with a quarter again in congestion
+ * avoidance so that cwnd is not held back from growing.  The allowance
+ * is worked out the first time the connection sends in each SMI, and
+ * cwnd still applies on top of it.  Until there is an RTT sample to go
+ * on, there is no limit.
+ *
+ * @param pcb the tcp_pcb to calculate for
+ * @return the allowance, in bytes
+ */
+tcpwnd_size_t
+tcp_pace_burst(struct tcp_pcb *pcb)
+{
+  u32_t burst;
+
+  if (pcb->rtt_min == 0) {
+    return (tcpwnd_size_t)-1;
+  }
+
+  burst = pcb->cwnd * tcp_pace_period() / tcp_pace_round(pcb);
+  if (pcb->cwnd < pcb->ssthresh) {
+    burst *= 2;
+  } else {
+    burst += burst / 4;
+  }
+  burst = LWIP_MAX(burst, 2 * (u32_t)pcb->mss);
+  return (tcpwnd_size_t)LWIP_MIN(burst, (tcpwnd_size_t)-1);
+}
+
+#endif /* LWIP_TCP && TCP_SMI_PACING */
@@ -5,6 +5,7 @@
 #include <vga-overlay.h>
 #include <output.h>
 #include <minilib.h>
+#include <chksum.h>
 
 typedef uint8_t u8_t;
 typedef uint16_t u16_t;
@@ -29,6 +30,9 @@ typedef uint32_t mem_ptr_t;
 #define LWIP_PLATFORM_HTONS(x) htons(x)
 #define LWIP_PLATFORM_HTONL(x) htonl(x)
 
+#define LWIP_CHKSUM(dataptr, len) chksum(dataptr, len)
+#define LWIP_CHKSUM_COPY(dst, src, len) chksum_copy(dst, src, len)
+
 #define LWIP_PLATFORM_DIAG(x) outputf x
 #define LWIP_PLATFORM_ASSERT(x) dologf("ASSERT FAILED: %s\n", (x));
 
@@ -41,6 +41,16 @@
 extern "C" {
 #endif
 
+/** LWIP_CHKSUM_COPY: copy len bytes from src to dst and return their
+ * (non-inverted) checksum, as LWIP_CHKSUM would; define it in cc.h to do
+ * both in one pass. */
+#if LWIP_CHECKSUM_ON_COPY
+u16_t lwip_chksum_copy(void *dst, const void *src, u16_t len);
+#ifndef LWIP_CHKSUM_COPY
+#define LWIP_CHKSUM_COPY(dst, src, len) lwip_chksum_copy(dst, src, len)
+#endif
+#endif
+
 u16_t inet_chksum(void *dataptr, u16_t len);
 u16_t inet_chksum_pbuf(struct pbuf *p);
 u16_t inet_chksum_pseudo(struct pbuf *p,
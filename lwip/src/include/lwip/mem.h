@@ -65,8 +65,9 @@ typedef size_t mem_size_t;
 
 /* MEM_SIZE would have to be aligned, but using 64000 here instead of
  * 65535 leaves some room for alignment...
+ * With pools, the statistics count the total over all of them.
  */
-#if MEM_SIZE > 64000l
+#if MEM_SIZE > 64000l || MEM_USE_POOLS
 typedef u32_t mem_size_t;
 #else
 typedef u16_t mem_size_t;
@@ -79,6 +79,27 @@ extern "C" {
 /** if set, the netif has IGMP capability */
 #define NETIF_FLAG_IGMP         0x40U
 
+/** Checksums that lwIP generates or checks in software on this netif (see
+ *  netif->chksum_flags).  A driver whose hardware fills in a checksum on
+ *  transmit clears the GEN bit.  A driver whose hardware verifies a checksum
+ *  on receive clears the CHECK bit, and marks each packet that passed with
+ *  PBUF_FLAG_CHKSUM_OK; anything left unmarked is still checked here. */
+#define NETIF_CHECKSUM_GEN_IP       0x01U
+#define NETIF_CHECKSUM_GEN_UDP      0x02U
+#define NETIF_CHECKSUM_GEN_TCP      0x04U
+#define NETIF_CHECKSUM_CHECK_IP     0x08U
+#define NETIF_CHECKSUM_CHECK_UDP    0x10U
+#define NETIF_CHECKSUM_CHECK_TCP    0x20U
+#define NETIF_CHECKSUM_ENABLE_ALL   0x3FU
+
+/** Does lwIP have to do this checksum itself? (a NULL netif means yes) */
+#define NETIF_CHECKSUM_ENABLED(netif, chksumflag) \
+  (((netif) == NULL) || (((netif)->chksum_flags & (chksumflag)) != 0))
+/** Does received packet p still need its checksum checked in software? */
+#define NETIF_CHECKSUM_NEEDED(netif, p, chksumflag) \
+  (NETIF_CHECKSUM_ENABLED(netif, chksumflag) || \
+   (((p)->flags & PBUF_FLAG_CHKSUM_OK) == 0))
+
 /** Generic data structure used for all lwIP network interfaces.
  *  The following fields should be filled in by the initialization
  *  function for the device driver: hwaddr_len, hwaddr[], mtu, flags */
@@ -137,6 +158,8 @@ struct netif {
   u16_t mtu;
   /** flags (see NETIF_FLAG_ above) */
   u8_t flags;
+  /** checksums handled in software (see NETIF_CHECKSUM_ above) */
+  u8_t chksum_flags;
   /** descriptive abbreviation */
   char name[2];
   /** number of this interface */
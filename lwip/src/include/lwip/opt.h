@@ -665,6 +665,64 @@
 #define TCP_QUEUE_OOSEQ                 1
 #endif
 
+/**
+ * TCP_OOSEQ_MAX_PBUFS: The maximum number of pbufs queued on ooseq per pcb.
+ * Out-of-sequence data is dropped from the top of the queue once this is
+ * exceeded, so that a long hole cannot pin every receive buffer the netif
+ * has.  0 means no limit.  Only valid for TCP_QUEUE_OOSEQ==1.
+ */
+#ifndef TCP_OOSEQ_MAX_PBUFS
+#define TCP_OOSEQ_MAX_PBUFS             0
+#endif
+
+/**
+ * LWIP_WND_SCALE==1: Enable the RFC 1323/7323 window scale option.  This
+ * lets TCP_WND and TCP_SND_BUF grow past 64K; the receive window is
+ * announced shifted right by TCP_RCV_SCALE.
+ */
+#ifndef LWIP_WND_SCALE
+#define LWIP_WND_SCALE                  0
+#endif
+
+/**
+ * TCP_RCV_SCALE: The shift count we offer in our window scale option
+ * (0..14).  Only valid for LWIP_WND_SCALE==1.
+ */
+#ifndef TCP_RCV_SCALE
+#define TCP_RCV_SCALE                   0
+#endif
+
+/**
+ * LWIP_TCP_SACK==1: Enable RFC 2018 selective acknowledgement.  As a
+ * receiver, ACKs sent while segments are queued on ooseq carry SACK
+ * blocks describing them; as a sender, holes reported by the peer are
+ * retransmitted during fast recovery without waiting for the RTO.
+ * Requires TCP_QUEUE_OOSEQ==1.
+ */
+#ifndef LWIP_TCP_SACK
+#define LWIP_TCP_SACK                   0
+#endif
+
+/**
+ * LWIP_TCP_MAX_SACK_NUM: The maximum number of SACK blocks we put in one
+ * ACK (1..4).
+ */
+#ifndef LWIP_TCP_MAX_SACK_NUM
+#define LWIP_TCP_MAX_SACK_NUM           4
+#endif
+
+/**
+ * TCP_SMI_PACING==1: The stack only runs (and so only sends) in short
+ * bursts at a fixed cadence; see tcp_pace.c.  RTT samples are taken in
+ * milliseconds and corrected for that cadence, each connection sends at
+ * most a paced share of cwnd per burst, and ssthresh after a loss is set
+ * from the measured delivery rate.  The port must call tcp_pace_tick()
+ * at the start of every burst, and tcp_fasttmr() at the end of it.
+ */
+#ifndef TCP_SMI_PACING
+#define TCP_SMI_PACING                  0
+#endif
+
 /**
  * TCP_MSS: TCP Maximum segment size. (default is 128, a *very*
  * conservative default.)
@@ -1397,6 +1455,15 @@
 #define CHECKSUM_CHECK_TCP              1
 #endif
 
+/**
+ * LWIP_CHECKSUM_ON_COPY==1: Calculate the checksum of data as tcp_write()
+ * copies it (TCP_WRITE_FLAG_COPY), with LWIP_CHKSUM_COPY, so that only the
+ * header has to be summed when the segment goes out.
+ */
+#ifndef LWIP_CHECKSUM_ON_COPY
+#define LWIP_CHECKSUM_ON_COPY           0
+#endif
+
 /*
    ---------------------------------------
    ---------- Debugging options ----------
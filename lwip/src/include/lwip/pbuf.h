@@ -60,6 +60,12 @@ typedef enum {
 
 /** indicates this packet's data should be immediately passed to the application */
 #define PBUF_FLAG_PUSH 0x01U
+/** indicates this pbuf belongs to a driver: it is a struct pbuf_custom, and
+    pbuf_free hands it back through custom_free_function */
+#define PBUF_FLAG_IS_CUSTOM 0x02U
+/** indicates the driver's hardware has verified this packet's IP header and
+    TCP/UDP checksums (see NETIF_CHECKSUM_NEEDED) */
+#define PBUF_FLAG_CHKSUM_OK 0x04U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -95,6 +101,14 @@ struct pbuf {
   
 };
 
+/** A pbuf whose memory is managed by its owner.  Use type PBUF_REF for
+    data elsewhere; or, if the data follows the struct in memory, PBUF_POOL,
+    so that pbuf_header() can move the payload back towards it. */
+struct pbuf_custom {
+  struct pbuf pbuf;
+  void (*custom_free_function)(struct pbuf *p);
+};
+
 /* Initializes the pbuf module. This call is empty for now, but may not be in future. */
 #define pbuf_init()
 
@@ -88,6 +88,9 @@ struct stats_mem {
   mem_size_t used;
   mem_size_t max;
   mem_size_t err;
+  /* Bytes actually asked for; with MEM_USE_POOLS, used - requested is
+     what is lost to rounding up to a pool size. */
+  mem_size_t requested;
 };
 
 struct stats_syselem {
@@ -77,7 +77,7 @@ void             tcp_err     (struct tcp_pcb *pcb,
                               void (* err)(void *arg, err_t err));
 
 #define          tcp_mss(pcb)      ((pcb)->mss)
-#define          tcp_sndbuf(pcb)   ((pcb)->snd_buf)
+#define          tcp_sndbuf(pcb)   (TCPWND16((pcb)->snd_buf))
 
 #if TCP_LISTEN_BACKLOG
 #define          tcp_accepted(pcb) (((struct tcp_pcb_listen *)(pcb))->accepts_pending--)
@@ -116,6 +116,9 @@ void             tcp_setprio (struct tcp_pcb *pcb, u8_t prio);
    intervals (instead of calling tcp_tmr()). */
 void             tcp_slowtmr (void);
 void             tcp_fasttmr (void);
+#if TCP_SMI_PACING
+void             tcp_pace_tick (u32_t now);
+#endif /* TCP_SMI_PACING */
 
 
 /* Only used by IP to pass a TCP segment to TCP: */
@@ -129,14 +132,19 @@ void             tcp_rexmit_rto  (struct tcp_pcb *pcb);
  * This is the Nagle algorithm: inhibit the sending of new TCP
  * segments when new outgoing data arrives from the user if any
  * previously transmitted data on the connection remains
- * unacknowledged.
+ * unacknowledged.  It does not apply in fast recovery, where the
+ * segment at the head of unsent is usually a retransmission.
  */
 #define tcp_do_output_nagle(tpcb) ((((tpcb)->unacked == NULL) || \
-                            ((tpcb)->flags & TF_NODELAY) || \
+                            ((tpcb)->flags & (TF_NODELAY | TF_INFR)) || \
                             (((tpcb)->unsent != NULL) && ((tpcb)->unsent->next != NULL))) ? \
                                 1 : 0)
 #define tcp_output_nagle(tpcb) (tcp_do_output_nagle(tpcb) ? tcp_output(tpcb) : ERR_OK)
 
+#define          tcp_nagle_disable(pcb)   ((pcb)->flags |= TF_NODELAY)
+#define          tcp_nagle_enable(pcb)    ((pcb)->flags &= ~TF_NODELAY)
+#define          tcp_nagle_disabled(pcb)  (((pcb)->flags & TF_NODELAY) != 0)
+
 
 /** This returns a TCP header option for MSS in an u32_t */
 #define TCP_BUILD_MSS_OPTION()  htonl(((u32_t)2 << 24) | \
@@ -144,6 +152,25 @@ void             tcp_rexmit_rto  (struct tcp_pcb *pcb);
                                 (((u32_t)TCP_MSS / 256) << 8) | \
                                 (TCP_MSS & 255))
 
+/* Window and send buffer sizes need more than 16 bits once the window
+ * scale option lets them grow past 64K. */
+#if LWIP_WND_SCALE
+typedef u32_t tcpwnd_size_t;
+#define RCV_WND_SCALE(pcb, wnd) ((wnd) >> (pcb)->rcv_scale)
+#define SND_WND_SCALE(pcb, wnd) ((tcpwnd_size_t)(wnd) << (pcb)->snd_scale)
+#else
+typedef u16_t tcpwnd_size_t;
+#define RCV_WND_SCALE(pcb, wnd) (wnd)
+#define SND_WND_SCALE(pcb, wnd) (wnd)
+#endif /* LWIP_WND_SCALE */
+/** Clamp a window-sized quantity to what fits in a u16_t */
+#define TCPWND16(x) ((u16_t)LWIP_MIN((x), 0xFFFF))
+
+/** Room for the options we put on a SYN: MSS, window scale, SACK permitted */
+#define TCP_SYN_OPTLEN_MAX 12
+/** Room for the SACK option on an ACK: two NOPs, kind, length, blocks */
+#define TCP_SACK_OPTLEN_MAX (4 + 8 * LWIP_TCP_MAX_SACK_NUM)
+
 #define TCP_SEQ_LT(a,b)     ((s32_t)((a)-(b)) < 0)
 #define TCP_SEQ_LEQ(a,b)    ((s32_t)((a)-(b)) <= 0)
 #define TCP_SEQ_GT(a,b)     ((s32_t)((a)-(b)) > 0)
@@ -283,6 +310,8 @@ struct tcp_pcb {
 #define TF_ACK_DELAY   (u8_t)0x01U   /* Delayed ACK. */
 #define TF_ACK_NOW     (u8_t)0x02U   /* Immediate ACK. */
 #define TF_INFR        (u8_t)0x04U   /* In fast recovery. */
+#define TF_WND_SCALE   (u8_t)0x08U   /* Window scale option negotiated. */
+#define TF_SACK        (u8_t)0x10U   /* SACK permitted by both ends. */
 #define TF_FIN         (u8_t)0x20U   /* Connection was closed locally (FIN segment enqueued). */
 #define TF_NODELAY     (u8_t)0x40U   /* Disable Nagle algorithm */
 #define TF_NAGLEMEMERR (u8_t)0x80U /* nagle enabled, memerr, try to output to prevent delayed ACK to happen */
@@ -291,8 +320,8 @@ struct tcp_pcb {
      as we have to do some math with them */
   /* receiver variables */
   u32_t rcv_nxt;   /* next seqno expected */
-  u16_t rcv_wnd;   /* receiver window */
-  u16_t rcv_ann_wnd; /* announced receive window */
+  tcpwnd_size_t rcv_wnd;   /* receiver window */
+  tcpwnd_size_t rcv_ann_wnd; /* announced receive window */
 
   /* Timers */
   u32_t tmr;
@@ -304,9 +333,9 @@ struct tcp_pcb {
   u16_t mss;   /* maximum segment size */
   
   /* RTT (round trip time) estimation variables */
-  u32_t rttest; /* RTT estimate in 500ms ticks */
+  u32_t rttest; /* when rtseq was sent, in TCP_RTT_UNIT */
   u32_t rtseq;  /* sequence number being timed */
-  s16_t sa, sv; /* @todo document this */
+  s16_t sa, sv; /* smoothed RTT * 8 and mean deviation * 4, in TCP_RTT_UNIT */
 
   s16_t rto;    /* retransmission time-out */
   u8_t nrtx;    /* number of retransmissions */
@@ -316,20 +345,31 @@ struct tcp_pcb {
   u8_t dupacks;
   
   /* congestion avoidance/control variables */
-  u16_t cwnd;  
-  u16_t ssthresh;
+  tcpwnd_size_t cwnd;
+  tcpwnd_size_t ssthresh;
+#if LWIP_TCP_SACK
+  u32_t recover;   /* snd_max when fast recovery began. */
+#endif /* LWIP_TCP_SACK */
+#if TCP_SMI_PACING
+  u16_t rtt_min;   /* Lowest corrected RTT sample (ms), 0 until we have one. */
+  u32_t bw;        /* Delivery rate estimate, bytes per ms. */
+  u32_t bw_start;  /* tcp_pace_now when the current rate sample began */
+  tcpwnd_size_t bw_acked; /* ... and what has been acked since. */
+  u32_t pace_epoch;       /* The burst that pace_left belongs to. */
+  tcpwnd_size_t pace_left; /* What we may still send in this burst. */
+#endif /* TCP_SMI_PACING */
 
   /* sender variables */
   u32_t snd_nxt,   /* next seqno to be sent */
     snd_max;       /* Highest seqno sent. */
-  u16_t snd_wnd;   /* sender window */
+  tcpwnd_size_t snd_wnd;   /* sender window */
   u32_t snd_wl1, snd_wl2, /* Sequence and acknowledgement numbers of last
                              window update. */
     snd_lbb;       /* Sequence number of next byte to be buffered. */
 
-  u16_t acked;
+  tcpwnd_size_t acked;
   
-  u16_t snd_buf;   /* Available buffer space for sending (in bytes). */
+  tcpwnd_size_t snd_buf;   /* Available buffer space for sending (in bytes). */
 #define TCP_SNDQUEUELEN_OVERFLOW (0xffff-3)
   u16_t snd_queuelen; /* Available buffer space for sending (in tcp_segs). */
   
@@ -340,6 +380,15 @@ struct tcp_pcb {
 #if TCP_QUEUE_OOSEQ  
   struct tcp_seg *ooseq;    /* Received out of sequence segments. */
 #endif /* TCP_QUEUE_OOSEQ */
+#if LWIP_TCP_SACK
+  u32_t ooseq_last;         /* seqno of the latest addition to ooseq, which
+                               the first SACK block must cover. */
+#endif /* LWIP_TCP_SACK */
+
+#if LWIP_WND_SCALE
+  u8_t snd_scale;  /* shift applied to windows the peer announces */
+  u8_t rcv_scale;  /* shift applied to windows we announce */
+#endif /* LWIP_WND_SCALE */
 
   struct pbuf *refused_data; /* Data previously received but not yet taken by upper layer */
 
@@ -489,12 +538,25 @@ err_t lwip_tcp_event(void *arg, struct tcp_pcb *pcb,
 #endif /* LWIP_EVENT_API */
 
 /* This structure represents a TCP segment on the unsent and unacked queues */
+/* Summing data as it is copied is only worth it if we are summing at all. */
+#define TCP_CHECKSUM_ON_COPY  (LWIP_CHECKSUM_ON_COPY && CHECKSUM_GEN_TCP)
+
 struct tcp_seg {
   struct tcp_seg *next;    /* used when putting segements on a queue */
   struct pbuf *p;          /* buffer containing data + TCP header */
   void *dataptr;           /* pointer to the TCP data in the pbuf */
   u16_t len;               /* the TCP length of this segment */
   struct tcp_hdr *tcphdr;  /* the TCP header */
+#if TCP_CHECKSUM_ON_COPY
+  u16_t chksum;            /* sum of the data, if chksum_valid */
+  u8_t chksum_swapped;     /* chksum is byte-swapped (odd data length so far) */
+  u8_t chksum_valid;
+#endif /* TCP_CHECKSUM_ON_COPY */
+#if LWIP_TCP_SACK
+  u8_t flags;
+#define TF_SEG_SACKED  (u8_t)0x01U /* Covered by a SACK block from the peer. */
+#define TF_SEG_REXMIT  (u8_t)0x02U /* Retransmitted in this fast recovery. */
+#endif /* LWIP_TCP_SACK */
 };
 
 /* Internal functions and global variables: */
@@ -523,6 +585,10 @@ err_t tcp_enqueue(struct tcp_pcb *pcb, void *dataptr, u16_t len,
                 u8_t *optdata, u8_t optlen);
 
 void tcp_rexmit_seg(struct tcp_pcb *pcb, struct tcp_seg *seg);
+u8_t tcp_build_syn_options(struct tcp_pcb *pcb, u8_t *opts);
+#if LWIP_TCP_SACK
+u8_t tcp_rexmit_sack(struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_SACK */
 
 void tcp_rst(u32_t seqno, u32_t ackno,
        struct ip_addr *local_ip, struct ip_addr *remote_ip,
@@ -540,6 +606,28 @@ u16_t tcp_eff_send_mss(u16_t sendmss, struct ip_addr *addr);
 extern struct tcp_pcb *tcp_input_pcb;
 extern u32_t tcp_ticks;
 
+/* RTT samples are taken in ticks of the slow timer unless pacing has a
+ * millisecond clock to offer.  TCP_RTO_BASE gives the retransmission
+ * timeout, before backoff, in slow timer ticks. */
+#if TCP_SMI_PACING
+extern u32_t tcp_pace_now;
+extern u32_t tcp_pace_epoch;
+#define TCP_RTT_UNIT 1
+#define TCP_RTT_NOW() tcp_pace_now
+#define TCP_RTO_BASE(pcb) tcp_pace_rto(pcb)
+#define tcp_pace_allows(pcb) ((pcb)->pace_left != 0)
+s16_t tcp_pace_rtt(struct tcp_pcb *pcb, s16_t m);
+s16_t tcp_pace_rto(struct tcp_pcb *pcb);
+void tcp_pace_acked(struct tcp_pcb *pcb, tcpwnd_size_t acked);
+void tcp_pace_ssthresh(struct tcp_pcb *pcb);
+tcpwnd_size_t tcp_pace_burst(struct tcp_pcb *pcb);
+#else /* TCP_SMI_PACING */
+#define TCP_RTT_UNIT TCP_SLOW_INTERVAL
+#define TCP_RTT_NOW() tcp_ticks
+#define TCP_RTO_BASE(pcb) (((pcb)->sa >> 3) + (pcb)->sv)
+#define tcp_pace_allows(pcb) 1
+#endif /* TCP_SMI_PACING */
+
 #if TCP_DEBUG || TCP_INPUT_DEBUG || TCP_OUTPUT_DEBUG
 void tcp_debug_print(struct tcp_hdr *tcphdr);
 void tcp_debug_print_flags(u8_t flags);
@@ -17,16 +17,42 @@ extern void _memcpy(void *dest, const void *src, int bytes);
 
 /* Lots of tricks from http://lists.gnu.org/archive/html/lwip-users/2006-11/msg00007.html */
 
-#define MEM_SIZE	(128*1024)
+/* mem_malloc() takes fixed-size elements from the pools in lwippools.h
+ * rather than carving up one heap, so that it cannot fragment. */
+#define MEM_USE_POOLS	1
+#define MEMP_USE_CUSTOM_POOLS	1
 #define TCP_MSS         1460
 #define TCP_WND		24000
-#define TCP_SND_BUF     (16 * TCP_MSS)
-#define TCP_SND_QUEUELEN 16
 
-#define MEMP_NUM_PBUF	256
-#define PBUF_POOL_SIZE  128
+/* What we can keep in flight is bounded by the 1600-byte class in
+ * lwippools.h, which has to fit the old heap budget, so neither window
+ * gets anywhere near 64K and the window scale option (still in the
+ * stack) is left off.  Each segment may take two pbufs (header plus
+ * zero-copy data). */
+#define LWIP_WND_SCALE	0
+#define TCP_SND_BUF     (24 * TCP_MSS)
+#define TCP_SND_QUEUELEN (2 * TCP_SND_BUF / TCP_MSS)
+
+/* A loss inside one SMI's worth of packets leaves the rest of the burst
+ * on ooseq; SACK tells the sender exactly which segment to resend, so
+ * it does not have to wait out an RTO.  ooseq is capped so that a hole
+ * cannot tie up all of the NIC drivers' spare receive buffers. */
+#define LWIP_TCP_SACK	1
+#define TCP_OOSEQ_MAX_PBUFS 6
+#define MEMP_NUM_TCP_SEG (TCP_SND_QUEUELEN + TCP_OOSEQ_MAX_PBUFS)
+
+/* We only send once per SMI; see tcp_pace.c. */
+#define TCP_SMI_PACING	1
+
+#define MEMP_NUM_PBUF	64
+/* The NIC drivers bring their own full-size receive buffers; the pool is
+ * only for small packets that get copied out of them, and for big ones
+ * once the drivers' spares are all out. */
+#define PBUF_POOL_SIZE  24
 #define PBUF_POOL_BUFSIZE 512
 
+#define LWIP_CHECKSUM_ON_COPY 1
+
 #define LWIP_STATS 1
 #define LWIP_STATS_DISPLAY 1
 #define U16_F "u"
@@ -0,0 +1,28 @@
+/* Size classes for mem_malloc() (see MEM_USE_POOLS in lwipopts.h).
+ *
+ * Each element carries a 4-byte header, so a class holds requests of up
+ * to (size - 4) bytes.  The 128 class is for the header pbufs of
+ * zero-copy TCP segments, and the 1600 class is for full-MSS copied
+ * ones; both are sized for a full TCP_SND_BUF in flight.  The 4096 class
+ * is for the HTTP screenshot and trace dump state.  Classes must be
+ * listed in increasing order of size.
+ *
+ * Budget: these replace the old 128K MEM_SIZE heap, which also used to
+ * hold RFB's blockbufs.  That 128K is now split between the classes
+ * below (80K with headers) and the RFB arena in net/rfb.c (about 46K);
+ * growing either means shrinking the other.  See the SMRAM map in
+ * netwatch/netwatch-large.lds for where the rest goes.
+ */
+
+#if MEM_USE_POOLS
+
+LWIP_MALLOC_MEMPOOL_START
+LWIP_MALLOC_MEMPOOL(64, 64)
+LWIP_MALLOC_MEMPOOL(32, 128)
+LWIP_MALLOC_MEMPOOL(32, 256)
+LWIP_MALLOC_MEMPOOL(16, 512)
+LWIP_MALLOC_MEMPOOL(24, 1600)
+LWIP_MALLOC_MEMPOOL(4, 4096)
+LWIP_MALLOC_MEMPOOL_END
+
+#endif
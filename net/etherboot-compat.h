@@ -30,8 +30,22 @@ struct nic {
 	
 	unsigned char hwaddr[6];
 
-	int (*recv) (struct nic *nic);
-	void (*transmit) (struct nic *nic, struct pbuf *p);
+	/* NETIF_CHECKSUM_* bits that the hardware takes care of. */
+	unsigned int csum_offload;
+
+	/* Takes at most budget packets off the receive ring, passing them to
+	 * eth_recv(), and returns how many it took. */
+	int (*recv) (struct nic *nic, int budget);
+	/* Queues p (taking a reference), or returns -1 if there is no room. */
+	int (*transmit) (struct nic *nic, struct pbuf *p);
+	/* Optional; reclaims finished buffers and starts anything queued.
+	 * Called between receive batches, and at the end of each pass over
+	 * the scheduler's tasks. */
+	void (*tx_flush) (struct nic *nic);
+	/* Optional; how many received packets are waiting, and how many
+	 * transmit slots are in use, out of rx_ring and tx_ring. */
+	void (*pending) (struct nic *nic, int *rx, int *tx);
+	int rx_ring, tx_ring;
 };
 
 #define virt_to_bus(x) memory_v2p((void *)(x))
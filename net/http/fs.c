@@ -33,15 +33,29 @@
 #include "fs.h"
 #include "fsdata.h"
 #include "fsdata.c"
+#include "png.h"
+#include "tracedump.h"
+#include "profdump.h"
 #include <io.h>
 #include <minilib.h>
 #include <paging.h>
 #include <demap.h>
 #include <output.h>
 #include <state.h>
+#include <profile.h>
+#include "../net.h"
+#include "lwip/memp.h"
+#include "lwip/stats.h"
 
 static char http_output_buffer[1280];
 
+#if LWIP_STATS
+static const char * const memp_names[MEMP_MAX] = {
+#define LWIP_MEMPOOL(name,num,size,desc) desc,
+#include "lwip/memp_std.h"
+};
+#endif
+
 /*-----------------------------------------------------------------------------------*/
 
 void handle_regs(struct fs_file *file)
@@ -132,6 +146,55 @@ void handle_backtrace(struct fs_file *file)
   file->len = len;
 }
 
+/* The counters that the simulator prints every few seconds, for the
+ * real thing. */
+void handle_stats(struct fs_file *file)
+{
+  int len;
+
+  len = snprintf(http_output_buffer, sizeof(http_output_buffer),
+    "HTTP/1.0 200 OK\r\n"
+    "Content-Type: text/plain\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "eth_poll: %u polls, %u packets, %u drained, %u tx full, "
+    "%u out of time, %u rx nearly full\n",
+    eth_poll_stats.polls, eth_poll_stats.packets, eth_poll_stats.drained,
+    eth_poll_stats.tx_full, eth_poll_stats.out_of_time,
+    eth_poll_stats.rx_nearly_full);
+  len += snprintf(http_output_buffer + len, sizeof(http_output_buffer) - len,
+    "eth_recv dropped: %u runt, %u ethertype, %u IP not for us, "
+    "%u ARP not for us\n",
+    eth_drop_stats.runt, eth_drop_stats.ethertype,
+    eth_drop_stats.ip_not_us, eth_drop_stats.arp_not_us);
+#if LWIP_STATS
+  {
+    int i;
+
+    /* With MEM_USE_POOLS, used - requested is what rounding up to a
+       pool size costs. */
+    len += snprintf(http_output_buffer + len, sizeof(http_output_buffer) - len,
+      "heap: %u/%u used (%u asked for), %u max, %u failed\n",
+      lwip_stats.mem.used, lwip_stats.mem.avail, lwip_stats.mem.requested,
+      lwip_stats.mem.max, lwip_stats.mem.err);
+    for (i = 0; i < MEMP_MAX; i++) {
+      struct stats_mem *m = &lwip_stats.memp[i];
+
+      if (!m->avail)
+        continue;
+      if (len > sizeof(http_output_buffer) - 64)
+        break;
+      len += snprintf(http_output_buffer + len, sizeof(http_output_buffer) - len,
+        "memp %s: %u/%u used, %u max, %u failed\n",
+        memp_names[i], m->used, m->avail, m->max, m->err);
+    }
+  }
+#endif
+
+  file->data = http_output_buffer;
+  file->len = len;
+}
+
 void handle_reboot(struct fs_file *file)
 {
   outb(0xCF9, 0x4);
@@ -145,6 +208,10 @@ int
 fs_open(const char *name, struct fs_file *file)
 {
   const struct fsdata_file *f;
+
+  file->fill = NULL;
+  file->close = NULL;
+  file->priv = NULL;
   
   /* /registers.html is CGI */
   if (!strcmp(name, "/registers.html"))
@@ -162,6 +229,38 @@ fs_open(const char *name, struct fs_file *file)
     handle_reboot(file);
     return 1;
   }
+  if (!strcmp(name, "/stats.txt"))
+  {
+    handle_stats(file);
+    return 1;
+  }
+  if (!strcmp(name, "/screenshot.png") && png_open(file))
+  {
+    return 1;
+  }
+  if (!strcmp(name, "/trace.txt") && trace_open(file, 0))
+  {
+    return 1;
+  }
+  if (!strcmp(name, "/trace.bin") && trace_open(file, 1))
+  {
+    return 1;
+  }
+  if (!strcmp(name, "/profile.txt") && prof_open(file, 0))
+  {
+    return 1;
+  }
+  if (!strcmp(name, "/profile.bin") && prof_open(file, 1))
+  {
+    return 1;
+  }
+  if (!strcmp(name, "/profile-reset"))
+  {
+    prof_reset();
+    file->data = "Profile cleared.";
+    file->len = 16;
+    return 1;
+  }
 
   for(f = FS_ROOT;
       f != NULL;
@@ -177,3 +276,12 @@ fs_open(const char *name, struct fs_file *file)
   return 0;
 }
 /*-----------------------------------------------------------------------------------*/
+void
+fs_close(struct fs_file *file)
+{
+  if (file->close)
+    file->close(file);
+  file->fill = NULL;
+  file->close = NULL;
+}
+/*-----------------------------------------------------------------------------------*/
@@ -35,10 +35,17 @@
 struct fs_file {
   const char *data;
   int len;
+  /* Generated files: once data has been sent, fill is called to replace
+     data and len with the next piece, and returns 0 when there is no
+     more.  close is called when the connection goes away. */
+  int (*fill)(struct fs_file *file);
+  void (*close)(struct fs_file *file);
+  void *priv;
 };
 
 /* file must be allocated by caller and will be filled in
    by the function. */
 int fs_open(const char *name, struct fs_file *file);
+void fs_close(struct fs_file *file);
 
 #endif /* __FS_H__ */
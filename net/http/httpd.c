@@ -32,7 +32,9 @@
 
 #include <minilib.h>
 #include <output.h>
+#include <trace.h>
 #include <tables.h>
+#include <sched.h>
 #include "lwip/debug.h"
 
 #include "lwip/stats.h"
@@ -47,8 +49,31 @@ struct http_state {
   u32_t left;
   const char *file;
   u8_t retries;
+  u8_t wake;
+  struct fs_file fs;
+  struct tcp_pcb *pcb;
+  struct http_state *next;
 };
 
+/* Generating the data (a screenshot, say) can take a while, so it is
+   not done in the TCP callbacks but from http_respond, which the
+   scheduler can put off until the next SMI.  The callbacks only set wake
+   on the connections that they have given something to do. */
+static struct http_state *http_conns;
+
+static void
+unlink_conn(struct http_state *hs)
+{
+  struct http_state **p;
+
+  for (p = &http_conns; *p != NULL; p = &(*p)->next) {
+    if (*p == hs) {
+      *p = hs->next;
+      return;
+    }
+  }
+}
+
 /*-----------------------------------------------------------------------------------*/
 static void
 conn_err(void *arg, err_t err)
@@ -58,6 +83,10 @@ conn_err(void *arg, err_t err)
   LWIP_UNUSED_ARG(err);
 
   hs = arg;
+  if (hs == NULL)
+    return;
+  unlink_conn(hs);
+  fs_close(&hs->fs);
   mem_free(hs);
 }
 /*-----------------------------------------------------------------------------------*/
@@ -67,41 +96,79 @@ close_conn(struct tcp_pcb *pcb, struct http_state *hs)
   tcp_arg(pcb, NULL);
   tcp_sent(pcb, NULL);
   tcp_recv(pcb, NULL);
+  /* lwIP may take a while to get the tail of the file across and close
+     the connection (much longer if it is lossy); leave it to it, rather
+     than have http_poll abort it. */
+  tcp_poll(pcb, NULL, 0);
+  unlink_conn(hs);
+  fs_close(&hs->fs);
   mem_free(hs);
   tcp_close(pcb);
 }
 /*-----------------------------------------------------------------------------------*/
-static void
+/* Pull the next piece of a generated file, if the current one is used up.
+   Returns 0 if there is nothing left to send. */
+static int
+fill_data(struct http_state *hs)
+{
+  if (hs->left > 0)
+    return 1;
+  if (hs->fs.fill == NULL || !hs->fs.fill(&hs->fs))
+    return 0;
+  hs->file = hs->fs.data;
+  hs->left = hs->fs.len;
+  return 1;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Returns 1 if it stopped at the scheduler's deadline rather than for
+   want of buffer space or data. */
+static int
 send_data(struct tcp_pcb *pcb, struct http_state *hs)
 {
   err_t err;
   u16_t len;
+  int written = 0;
+  /* Generated data lives in a buffer that the next fill will reuse. */
+  u8_t flags = hs->fs.fill ? TCP_WRITE_FLAG_COPY : 0;
 
-  /* We cannot send more data than space available in the send
-     buffer. */     
-  if (tcp_sndbuf(pcb) < hs->left) {
-    len = tcp_sndbuf(pcb);
-  } else {
-    len = hs->left;
-    LWIP_ASSERT((len == hs->left), "hs->left did not fit into u16_t!");
-  }
-  
-  outputf("send_data trying %d bytes", len);
+  while (tcp_sndbuf(pcb) > 0) {
+    /* Only ever stop before a fill, which is where the time goes. */
+    if (hs->left == 0 && written && sched_expired())
+      return 1;
+    if (!fill_data(hs))
+      break;
 
-  do {
-    err = tcp_write(pcb, hs->file, len, 0);
-    if (err == ERR_MEM) {
-      outputf("Insufficient memory to send %d", len);
-      len /= 2;
+    /* We cannot send more data than space available in the send
+       buffer. */     
+    if (tcp_sndbuf(pcb) < hs->left) {
+      len = tcp_sndbuf(pcb);
+    } else {
+      len = hs->left;
+      LWIP_ASSERT((len == hs->left), "hs->left did not fit into u16_t!");
+    }
+    
+    TRACE(TRACE_DEBUG, "send_data trying %d bytes", len);
+
+    do {
+      err = tcp_write(pcb, hs->file, len, flags);
+      if (err == ERR_MEM) {
+        TRACE(TRACE_DEBUG, "Insufficient memory to send %d", len);
+        len /= 2;
+      }
+    } while (err == ERR_MEM && len > 1);  
+    
+    if (err == ERR_OK) {
+      hs->file += len;
+      hs->left -= len;
+      written = 1;
+    } else {
+      /* Running out of memory is routine; http_sent will try again. */
+      if (err != ERR_MEM)
+        TRACE(TRACE_WARN, "send_data: error %s len %d %d", lwip_strerr(err), len, tcp_sndbuf(pcb));
+      break;
     }
-  } while (err == ERR_MEM && len > 1);  
-  
-  if (err == ERR_OK) {
-    hs->file += len;
-    hs->left -= len;
-      } else {
-    outputf("send_data: error %s len %d %d\n", lwip_strerr(err), len, tcp_sndbuf(pcb));
   }
+  return 0;
 }
 /*-----------------------------------------------------------------------------------*/
 static err_t
@@ -122,7 +189,8 @@ http_poll(void *arg, struct tcp_pcb *pcb)
       tcp_abort(pcb);
       return ERR_ABRT;
     }
-    send_data(pcb, hs);
+    if (hs->file != NULL)
+      hs->wake = 1;
   }
 
   return ERR_OK;
@@ -138,12 +206,7 @@ http_sent(void *arg, struct tcp_pcb *pcb, u16_t len)
   hs = arg;
 
   hs->retries = 0;
-  
-  if (hs->left > 0) {    
-    send_data(pcb, hs);
-  } else {
-    close_conn(pcb, hs);
-  }
+  hs->wake = 1;
 
   return ERR_OK;
 }
@@ -184,12 +247,13 @@ http_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
           fs_open("/404.html", &file);
         }
 
+        hs->fs = file;
         hs->file = file.data;
         LWIP_ASSERT((file.len >= 0), "File length must be positive!");
         hs->left = file.len;
         
         pbuf_free(p);
-        send_data(pcb, hs);
+        hs->wake = 1;
 
         /* Tell TCP that we wish be to informed of data that has been
            successfully sent by a call to the http_sent() function. */
@@ -232,6 +296,13 @@ http_accept(void *arg, struct tcp_pcb *pcb, err_t err)
   hs->file = NULL;
   hs->left = 0;
   hs->retries = 0;
+  hs->fs.fill = NULL;
+  hs->fs.close = NULL;
+  hs->fs.priv = NULL;
+  hs->wake = 0;
+  hs->pcb = pcb;
+  hs->next = http_conns;
+  http_conns = hs;
   
   /* Tell TCP that this is the structure we wish to be passed for our
      callbacks. */
@@ -247,6 +318,38 @@ http_accept(void *arg, struct tcp_pcb *pcb, err_t err)
   return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
+/* Once the whole file has been handed to TCP, the next wake (when some of
+   it has been acknowledged) closes the connection. */
+static int
+http_respond(int first)
+{
+  struct http_state *hs, *next;
+  int more = 0;
+
+  LWIP_UNUSED_ARG(first);
+
+  for (hs = http_conns; hs != NULL; hs = next) {
+    next = hs->next;
+    if (!hs->wake)
+      continue;
+    hs->wake = 0;
+
+    if (!fill_data(hs)) {
+      close_conn(hs->pcb, hs);
+      continue;
+    }
+    if (send_data(hs->pcb, hs)) {
+      hs->wake = 1;
+      more = 1;
+    }
+    tcp_output(hs->pcb);
+  }
+
+  return more;
+}
+
+TASK(http_respond, 7, PROF_HTTPD);
+/*-----------------------------------------------------------------------------------*/
 void
 httpd_init(void)
 {
@@ -0,0 +1,413 @@
+/* png.c
+ * Streaming PNG encoder for framebuffer screenshots
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <minilib.h>
+#include <output.h>
+#include <stdint.h>
+#include <fb.h>
+#include "lwip/mem.h"
+
+#include "fs.h"
+#include "png.h"
+
+/* The image is produced a little at a time, as httpd asks for more data,
+ * so that memory use does not depend on the screen resolution.  Each call
+ * to png_fill() encodes as many scanline segments as fit in one output
+ * buffer, and wraps them up as one PNG IDAT chunk inside one HTTP/1.1
+ * chunk.
+ *
+ * Scanlines use the Sub filter, which turns flat areas into runs of zero
+ * bytes.  The zlib stream is a single fixed-Huffman deflate block in which
+ * the only matches are at distance 1, so that no window has to be kept;
+ * that is enough to squeeze the long runs out of a typical console screen.
+ */
+
+#define PNG_SEG_PIXELS	128
+#define PNG_OUT_SIZE	2048
+
+/* "xxxx\r\n" in front of each HTTP chunk. */
+#define PNG_CHUNK_HDR	6
+
+/* Worst case for one segment: a filter byte plus three 9-bit literals per
+ * pixel, plus a pending run and some bits left over. */
+#define PNG_SEG_WORST	(((PNG_SEG_PIXELS * 3 + 1) * 9) / 8 + 16)
+
+/* End of stream: EOB, Adler-32, IDAT CRC, IEND, and the chunk trailers. */
+#define PNG_TAIL	(2 + 4 + 4 + 12 + 2 + 5)
+
+#define ADLER_MOD	65521
+#define ADLER_NMAX	5552
+
+static const char png_http_header[] =
+	"HTTP/1.1 200 OK\r\n"
+	"Content-Type: image/png\r\n"
+	"Transfer-Encoding: chunked\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+static const uint8_t png_signature[8] = {
+	0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+};
+
+/* Deflate length codes 257..285. */
+static const uint16_t _len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t _len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+/* Fixed Huffman codes, already bit-reversed for an LSB-first stream. */
+static uint16_t _lit_code[288];
+static uint8_t _lit_bits[288];
+
+/* PNG wants the reflected CRC-32, which is not what lib/crc32.c does. */
+static uint32_t _crc_table[256];
+
+static int _tables_built = 0;
+
+enum png_phase {
+	PNG_HEADER,
+	PNG_ROWS,
+	PNG_DONE
+};
+
+struct png_state {
+	enum png_phase phase;
+	int width, height;
+	int row, col;
+	uint8_t left[3];	/* Previous pixel, for the Sub filter. */
+
+	/* Deflate state. */
+	uint32_t bitbuf;
+	int nbits;
+	int last;		/* Last byte emitted, or -1. */
+	int run;		/* Pending repeats of 'last'. */
+
+	uint32_t adler_a, adler_b;
+	int adler_n;
+
+	uint8_t *out;
+	uint32_t pixels[PNG_SEG_PIXELS];
+	uint8_t buf[PNG_OUT_SIZE];
+};
+
+static uint16_t _reverse(uint16_t code, int bits)
+{
+	uint16_t r = 0;
+
+	while (bits--)
+	{
+		r = (r << 1) | (code & 1);
+		code >>= 1;
+	}
+	return r;
+}
+
+static void _build_tables()
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 288; i++)
+	{
+		if (i < 144)
+		{
+			_lit_bits[i] = 8;
+			_lit_code[i] = _reverse(0x30 + i, 8);
+		} else if (i < 256) {
+			_lit_bits[i] = 9;
+			_lit_code[i] = _reverse(0x190 + i - 144, 9);
+		} else if (i < 280) {
+			_lit_bits[i] = 7;
+			_lit_code[i] = _reverse(i - 256, 7);
+		} else {
+			_lit_bits[i] = 8;
+			_lit_code[i] = _reverse(0xC0 + i - 280, 8);
+		}
+	}
+
+	for (i = 0; i < 256; i++)
+	{
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : (c >> 1);
+		_crc_table[i] = c;
+	}
+
+	_tables_built = 1;
+}
+
+static uint32_t _crc(const uint8_t *p, int len)
+{
+	uint32_t c = 0xFFFFFFFF;
+
+	while (len--)
+		c = _crc_table[(c ^ *(p++)) & 0xFF] ^ (c >> 8);
+	return c ^ 0xFFFFFFFF;
+}
+
+static uint8_t *_put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+	return p + 4;
+}
+
+/* Start a PNG chunk; returns the start, to be handed to _chunk_end. */
+static uint8_t *_chunk_begin(struct png_state *ps, const char *type)
+{
+	uint8_t *start = ps->out;
+
+	memcpy(ps->out + 4, type, 4);
+	ps->out += 8;
+	return start;
+}
+
+static void _chunk_end(struct png_state *ps, uint8_t *start)
+{
+	_put32(start, ps->out - start - 8);
+	ps->out = _put32(ps->out, _crc(start + 4, ps->out - start - 4));
+}
+
+static void _bits(struct png_state *ps, uint32_t v, int n)
+{
+	ps->bitbuf |= v << ps->nbits;
+	ps->nbits += n;
+	while (ps->nbits >= 8)
+	{
+		*(ps->out++) = ps->bitbuf;
+		ps->bitbuf >>= 8;
+		ps->nbits -= 8;
+	}
+}
+
+static void _sym(struct png_state *ps, int sym)
+{
+	_bits(ps, _lit_code[sym], _lit_bits[sym]);
+}
+
+static void _flush_run(struct png_state *ps)
+{
+	int i;
+
+	if (ps->run < 3)
+	{
+		while (ps->run)
+		{
+			_sym(ps, ps->last);
+			ps->run--;
+		}
+		return;
+	}
+
+	for (i = 28; _len_base[i] > ps->run; i--)
+		;
+	_sym(ps, 257 + i);
+	_bits(ps, ps->run - _len_base[i], _len_extra[i]);
+	_bits(ps, 0, 5);	/* Distance code 0: distance 1. */
+	ps->run = 0;
+}
+
+static void _byte(struct png_state *ps, uint8_t b)
+{
+	ps->adler_a += b;
+	ps->adler_b += ps->adler_a;
+	if (++ps->adler_n == ADLER_NMAX)
+	{
+		ps->adler_a %= ADLER_MOD;
+		ps->adler_b %= ADLER_MOD;
+		ps->adler_n = 0;
+	}
+
+	if (b == ps->last)
+	{
+		if (++ps->run == 258)
+			_flush_run(ps);
+		return;
+	}
+
+	_flush_run(ps);
+	_sym(ps, b);
+	ps->last = b;
+}
+
+/* Encode up to PNG_SEG_PIXELS of the current scanline. */
+static void _segment(struct png_state *ps)
+{
+	int n = ps->width - ps->col;
+	int i;
+	uint32_t px;
+	uint8_t r, g, b;
+
+	if (n > PNG_SEG_PIXELS)
+		n = PNG_SEG_PIXELS;
+
+	if (ps->col == 0)
+	{
+		_byte(ps, 1);	/* Filter type: Sub */
+		ps->left[0] = ps->left[1] = ps->left[2] = 0;
+	}
+
+	/* If the mode has shrunk underneath us, the rest is black. */
+	if (fb && fb->curmode.xres >= ps->width && fb->curmode.yres >= ps->height)
+		fb->copy_pixels((char *)ps->pixels, ps->col, ps->row, n, 1);
+	else
+		memset(ps->pixels, 0, n * 4);
+
+	for (i = 0; i < n; i++)
+	{
+		px = ps->pixels[i];
+		r = px;
+		g = px >> 8;
+		b = px >> 16;
+		_byte(ps, r - ps->left[0]);
+		_byte(ps, g - ps->left[1]);
+		_byte(ps, b - ps->left[2]);
+		ps->left[0] = r;
+		ps->left[1] = g;
+		ps->left[2] = b;
+	}
+
+	ps->col += n;
+	if (ps->col == ps->width)
+	{
+		ps->col = 0;
+		ps->row++;
+	}
+}
+
+static void _header(struct png_state *ps)
+{
+	uint8_t *c;
+
+	memcpy(ps->out, png_signature, sizeof(png_signature));
+	ps->out += sizeof(png_signature);
+
+	c = _chunk_begin(ps, "IHDR");
+	ps->out = _put32(ps->out, ps->width);
+	ps->out = _put32(ps->out, ps->height);
+	*(ps->out++) = 8;	/* Bit depth */
+	*(ps->out++) = 2;	/* Color type: RGB */
+	*(ps->out++) = 0;	/* Compression: deflate */
+	*(ps->out++) = 0;	/* Filter method */
+	*(ps->out++) = 0;	/* No interlace */
+	_chunk_end(ps, c);
+}
+
+static int png_fill(struct fs_file *file)
+{
+	struct png_state *ps = file->priv;
+	uint8_t *end = ps->buf + PNG_OUT_SIZE;
+	uint8_t *idat;
+	char hdr[PNG_CHUNK_HDR + 1];
+	int len;
+
+	if (ps->phase == PNG_DONE)
+		return 0;
+
+	ps->out = ps->buf + PNG_CHUNK_HDR;
+
+	if (ps->phase == PNG_HEADER)
+		_header(ps);
+
+	idat = _chunk_begin(ps, "IDAT");
+
+	if (ps->phase == PNG_HEADER)
+	{
+		*(ps->out++) = 0x78;	/* zlib: deflate, 32K window */
+		*(ps->out++) = 0x01;
+		_bits(ps, 1, 1);	/* BFINAL */
+		_bits(ps, 1, 2);	/* BTYPE: fixed Huffman */
+		ps->phase = PNG_ROWS;
+	}
+
+	while (ps->row < ps->height && (end - ps->out) >= PNG_SEG_WORST + PNG_TAIL)
+		_segment(ps);
+
+	if (ps->row == ps->height)
+	{
+		_flush_run(ps);
+		_sym(ps, 256);
+		if (ps->nbits)
+			_bits(ps, 0, 8 - ps->nbits);
+		ps->out = _put32(ps->out, ((ps->adler_b % ADLER_MOD) << 16)
+		                          | (ps->adler_a % ADLER_MOD));
+		_chunk_end(ps, idat);
+		_chunk_end(ps, _chunk_begin(ps, "IEND"));
+		ps->phase = PNG_DONE;
+	} else
+		_chunk_end(ps, idat);
+
+	len = ps->out - ps->buf - PNG_CHUNK_HDR;
+	snprintf(hdr, sizeof(hdr), "%04x\r\n", len);
+	memcpy(ps->buf, hdr, PNG_CHUNK_HDR);
+
+	memcpy(ps->out, "\r\n", 2);
+	ps->out += 2;
+	if (ps->phase == PNG_DONE)
+	{
+		memcpy(ps->out, "0\r\n\r\n", 5);
+		ps->out += 5;
+	}
+
+	file->data = (const char *)ps->buf;
+	file->len = ps->out - ps->buf;
+	return 1;
+}
+
+static void png_close(struct fs_file *file)
+{
+	mem_free(file->priv);
+	file->priv = NULL;
+}
+
+int png_open(struct fs_file *file)
+{
+	struct png_state *ps;
+
+	if (!fb)
+		return 0;
+
+	if (!_tables_built)
+		_build_tables();
+
+	ps = mem_malloc(sizeof(*ps));
+	if (!ps)
+	{
+		outputf("png: out of memory");
+		return 0;
+	}
+
+	ps->phase = PNG_HEADER;
+	ps->width = fb->curmode.xres;
+	ps->height = fb->curmode.yres;
+	ps->row = ps->col = 0;
+	ps->bitbuf = 0;
+	ps->nbits = 0;
+	ps->last = -1;
+	ps->run = 0;
+	ps->adler_a = 1;
+	ps->adler_b = 0;
+	ps->adler_n = 0;
+
+	outputf("png: screenshot %dx%d", ps->width, ps->height);
+
+	file->data = png_http_header;
+	file->len = sizeof(png_http_header) - 1;
+	file->fill = png_fill;
+	file->close = png_close;
+	file->priv = ps;
+	return 1;
+}
@@ -0,0 +1,20 @@
+/* png.h
+ * Streaming PNG encoder declarations
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#ifndef _PNG_H
+#define _PNG_H
+
+#include "fs.h"
+
+/* Set up file to stream a PNG of the current screen, as a complete HTTP
+ * response with chunked encoding.  Returns 0 if there is no framebuffer. */
+extern int png_open(struct fs_file *file);
+
+#endif
@@ -0,0 +1,164 @@
+/* profdump.c
+ * HTTP access to the phase profiler
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <minilib.h>
+#include <output.h>
+#include <stdint.h>
+#include <profile.h>
+#include <timer.h>
+#include "lwip/mem.h"
+
+#include "fs.h"
+#include "profdump.h"
+
+/* The counters go on changing while the response is sent, over however
+ * many SMIs that takes, so we work from a copy taken at open time. */
+
+#define PROF_LINE_MAX	640	/* Room for a full histogram. */
+
+static const char prof_text_header[] =
+	"HTTP/1.0 200 OK\r\n"
+	"Content-Type: text/plain\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+static const char prof_bin_header[] =
+	"HTTP/1.0 200 OK\r\n"
+	"Content-Type: application/octet-stream\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+struct prof_snapshot {
+	struct prof_dump_hdr hdr;
+	struct prof_stats stats[PROF_MAX];
+};
+
+struct prof_state {
+	int next;		/* Phase to print next; PROF_MAX when done. */
+	struct prof_snapshot snap;
+	char buf[PROF_LINE_MAX];
+};
+
+/* A 64-by-32 division, since there is no libgcc to do it for us.  The
+ * quotients we want (means, mostly) always fit in 32 bits; anything
+ * bigger comes back as ~0. */
+static uint32_t _div64(uint64_t n, uint32_t d)
+{
+	uint32_t hi = n >> 32, lo = n, r;
+
+	if (d == 0 || hi >= d)
+		return ~0;
+	asm("divl %4" : "=a" (lo), "=d" (r) : "a" (lo), "d" (hi), "rm" (d));
+	return lo;
+}
+
+/* part as tenths of a percent of whole; both are shifted down until
+ * the multiplication cannot overflow. */
+static int _permille(uint64_t part, uint64_t whole)
+{
+	while (whole >= (1 << 22))
+	{
+		part >>= 1;
+		whole >>= 1;
+	}
+	if (whole == 0)
+		return 0;
+	return (uint32_t)part * 1000 / (uint32_t)whole;
+}
+
+static int prof_fill_text(struct fs_file *file)
+{
+	struct prof_state *ps = file->priv;
+	struct prof_stats *s, *total;
+	int len = 0, b, pm, idle;
+
+	if (ps->next >= PROF_MAX)
+		return 0;
+
+	total = &ps->snap.stats[PROF_TOTAL];
+	if (ps->next == 0)
+	{
+		idle = _permille(ps->snap.stats[PROF_IDLE].count, total->count);
+		len += snprintf(ps->buf, PROF_LINE_MAX,
+			"# %d SMIs, %d.%d%% idle, %d TSC cycles per ms\n"
+			"# phase      count       mean        max  share log2(cycles):count\n",
+			total->count, idle / 10, idle % 10,
+			ps->snap.hdr.tsc_per_ms);
+	}
+
+	s = &ps->snap.stats[ps->next++];
+	pm = _permille(s->total, total->total);
+	len += snprintf(ps->buf + len, PROF_LINE_MAX - len,
+		"%-12s %10u %10u %10u %3d.%d%%",
+		s->name, s->count, s->count ? _div64(s->total, s->count) : 0,
+		s->max, pm / 10, pm % 10);
+	for (b = 0; b < PROF_BUCKETS; b++)
+		if (s->hist[b] && len < PROF_LINE_MAX - 16)
+			len += snprintf(ps->buf + len, PROF_LINE_MAX - len,
+			                " %d:%u", b, s->hist[b]);
+	ps->buf[len++] = '\n';
+
+	file->data = ps->buf;
+	file->len = len;
+	return 1;
+}
+
+static int prof_fill_bin(struct fs_file *file)
+{
+	struct prof_state *ps = file->priv;
+
+	if (ps->next >= PROF_MAX)
+		return 0;
+	ps->next = PROF_MAX;
+
+	file->data = (const char *)&ps->snap;
+	file->len = sizeof(ps->snap);
+	return 1;
+}
+
+static void prof_close(struct fs_file *file)
+{
+	mem_free(file->priv);
+	file->priv = NULL;
+}
+
+int prof_open(struct fs_file *file, int binary)
+{
+	struct prof_state *ps;
+
+	ps = mem_malloc(sizeof(*ps));
+	if (!ps)
+	{
+		outputf("profile: out of memory");
+		return 0;
+	}
+
+	ps->next = 0;
+	memcpy(ps->snap.hdr.magic, "NWPF", 4);
+	ps->snap.hdr.phases = PROF_MAX;
+	ps->snap.hdr.buckets = PROF_BUCKETS;
+	ps->snap.hdr.recsize = sizeof(struct prof_stats);
+	ps->snap.hdr.tsc_per_ms = tsc_per_ms;
+	memcpy(ps->snap.stats, prof_stats, sizeof(prof_stats));
+
+	if (binary)
+	{
+		file->data = prof_bin_header;
+		file->len = sizeof(prof_bin_header) - 1;
+		file->fill = prof_fill_bin;
+	} else {
+		file->data = prof_text_header;
+		file->len = sizeof(prof_text_header) - 1;
+		file->fill = prof_fill_text;
+	}
+	file->close = prof_close;
+	file->priv = ps;
+	return 1;
+}
@@ -0,0 +1,31 @@
+/* profdump.h
+ * HTTP access to the phase profiler
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#ifndef _PROFDUMP_H
+#define _PROFDUMP_H
+
+#include <stdint.h>
+#include "fs.h"
+
+/* Set up file to send a snapshot of the profiler's counters as a complete
+ * HTTP response: a table, or (if binary) a struct prof_dump_hdr followed
+ * by one struct prof_stats per phase, in enum prof_phase order.  Returns
+ * 0 if out of memory. */
+extern int prof_open(struct fs_file *file, int binary);
+
+struct prof_dump_hdr {
+	char magic[4];		/* "NWPF" */
+	uint32_t phases;	/* Records that follow. */
+	uint32_t buckets;	/* PROF_BUCKETS */
+	uint32_t recsize;	/* sizeof(struct prof_stats) */
+	uint32_t tsc_per_ms;	/* For converting cycles to time. */
+};
+
+#endif
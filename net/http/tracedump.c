@@ -0,0 +1,159 @@
+/* tracedump.c
+ * HTTP access to the trace ring
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <minilib.h>
+#include <output.h>
+#include <stdint.h>
+#include <trace.h>
+#include "lwip/mem.h"
+
+#include "fs.h"
+#include "tracedump.h"
+
+/* The ring keeps filling while we send it, so each fill re-checks how far
+ * behind trace_head we are and skips over anything that has been
+ * overwritten in the meantime. */
+
+#define TRACE_OUT_SIZE	2048
+#define TRACE_LINE_MAX	128
+
+static const char trace_text_header[] =
+	"HTTP/1.0 200 OK\r\n"
+	"Content-Type: text/plain\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+static const char trace_bin_header[] =
+	"HTTP/1.0 200 OK\r\n"
+	"Content-Type: application/octet-stream\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+struct trace_state {
+	int sent_hdr;
+	uint32_t next, end;
+	uint32_t lost;
+	char buf[TRACE_OUT_SIZE];
+};
+
+/* Move ts->next past anything the producer has lapped. */
+static void _catch_up(struct trace_state *ts)
+{
+	uint32_t oldest = trace_head - TRACE_RING_SIZE;
+
+	if (trace_head > TRACE_RING_SIZE && (int32_t)(ts->next - oldest) < 0)
+	{
+		ts->lost += oldest - ts->next;
+		ts->next = oldest;
+	}
+}
+
+static int trace_fill_text(struct fs_file *file)
+{
+	struct trace_state *ts = file->priv;
+	struct trace_rec rec;
+	int len = 0;
+
+	_catch_up(ts);
+	if (ts->lost)
+	{
+		len += snprintf(ts->buf, TRACE_LINE_MAX, "... %d lost\n", ts->lost);
+		ts->lost = 0;
+	}
+
+	while (ts->next != ts->end && len <= TRACE_OUT_SIZE - TRACE_LINE_MAX)
+	{
+		rec = trace_ring[ts->next & (TRACE_RING_SIZE - 1)];
+		ts->next++;
+		len += trace_format(ts->buf + len, TRACE_LINE_MAX - 1, &rec);
+		ts->buf[len++] = '\n';
+	}
+
+	if (len == 0)
+		return 0;
+
+	file->data = ts->buf;
+	file->len = len;
+	return 1;
+}
+
+static int trace_fill_bin(struct fs_file *file)
+{
+	struct trace_state *ts = file->priv;
+	struct trace_dump_hdr *hdr;
+	int len = 0;
+
+	_catch_up(ts);
+
+	if (!ts->sent_hdr)
+	{
+		hdr = (struct trace_dump_hdr *)ts->buf;
+		memcpy(hdr->magic, "NWTR", 4);
+		hdr->count = ts->end - ts->next;
+		hdr->recsize = sizeof(struct trace_rec);
+		hdr->lost = ts->lost;
+		len = sizeof(*hdr);
+		ts->sent_hdr = 1;
+	}
+
+	/* Overwritten records go out anyway, so that count stays right; the
+	 * host can tell from the TSCs where the seam is. */
+	while (ts->next != ts->end && len + sizeof(struct trace_rec) <= TRACE_OUT_SIZE)
+	{
+		memcpy(ts->buf + len, &trace_ring[ts->next & (TRACE_RING_SIZE - 1)],
+		       sizeof(struct trace_rec));
+		len += sizeof(struct trace_rec);
+		ts->next++;
+	}
+
+	if (len == 0)
+		return 0;
+
+	file->data = ts->buf;
+	file->len = len;
+	return 1;
+}
+
+static void trace_close(struct fs_file *file)
+{
+	mem_free(file->priv);
+	file->priv = NULL;
+}
+
+int trace_open(struct fs_file *file, int binary)
+{
+	struct trace_state *ts;
+
+	ts = mem_malloc(sizeof(*ts));
+	if (!ts)
+	{
+		outputf("trace: out of memory");
+		return 0;
+	}
+
+	ts->sent_hdr = 0;
+	ts->end = trace_head;
+	ts->next = (ts->end > TRACE_RING_SIZE) ? ts->end - TRACE_RING_SIZE : 0;
+	ts->lost = 0;
+
+	if (binary)
+	{
+		file->data = trace_bin_header;
+		file->len = sizeof(trace_bin_header) - 1;
+		file->fill = trace_fill_bin;
+	} else {
+		file->data = trace_text_header;
+		file->len = sizeof(trace_text_header) - 1;
+		file->fill = trace_fill_text;
+	}
+	file->close = trace_close;
+	file->priv = ts;
+	return 1;
+}
@@ -0,0 +1,30 @@
+/* tracedump.h
+ * HTTP access to the trace ring
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#ifndef _TRACEDUMP_H
+#define _TRACEDUMP_H
+
+#include <stdint.h>
+#include "fs.h"
+
+/* Set up file to send whatever is in the trace ring, oldest first, as a
+ * complete HTTP response: formatted text, or (if binary) the raw records
+ * behind a struct trace_dump_hdr, for decoding on the host against
+ * aseg.elf.  Returns 0 if out of memory. */
+extern int trace_open(struct fs_file *file, int binary);
+
+struct trace_dump_hdr {
+	char magic[4];		/* "NWTR" */
+	uint32_t count;		/* Records that follow. */
+	uint32_t recsize;	/* sizeof(struct trace_rec) */
+	uint32_t lost;		/* Records overwritten before we got to them. */
+};
+
+#endif
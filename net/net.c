@@ -10,10 +10,13 @@
 
 #include <pci.h>
 #include <smram.h>
+#include <smi.h>
 #include <pci-bother.h>
 #include <output.h>
 #include <minilib.h>
 #include <tables.h>
+#include <timer.h>
+#include <sched.h>
 #include <lwip/init.h>
 #include "net.h"
 
@@ -34,56 +37,263 @@ static struct netif _netif;
 
 extern struct pci_driver a3c90x_driver;
 
-void eth_recv(struct nic *nic, struct pbuf *p)
+/* Anything that lwIP would only throw away is dropped here instead, before
+ * it gets anywhere near etharp or ip_input: other ethertypes, IP for
+ * somebody else, and ARP that does not mention our address.  Until we have
+ * an address (while DHCP is running), all IP and ARP goes through.
+ */
+struct eth_drop_stats eth_drop_stats;
+
+static int _classify(struct pbuf *p)
 {
-	struct eth_hdr *ethhdr;
-	
-	LINK_STATS_INC(link.recv);
-	
-	ethhdr = p->payload;
-	
+	struct eth_hdr *ethhdr = p->payload;
+	struct ethip_hdr *iphdr;
+	struct etharp_hdr *arphdr;
+	struct ip_addr dest;
+
+	if (p->len < sizeof(struct eth_hdr))
+	{
+		eth_drop_stats.runt++;
+		return 0;
+	}
+
 	switch (htons(ethhdr->type)) {
 	case ETHTYPE_IP:
+		if (ip_addr_isany(&_netif.ip_addr))
+			return 1;
+		if (p->len < sizeof(struct ethip_hdr))
+		{
+			eth_drop_stats.runt++;
+			return 0;
+		}
+		iphdr = p->payload;
+		memcpy(&dest, &iphdr->ip.dest, sizeof(dest));
+		if (ip_addr_cmp(&dest, &_netif.ip_addr)
+		    || ip_addr_isbroadcast(&dest, &_netif))
+			return 1;
+		eth_drop_stats.ip_not_us++;
+		return 0;
+
 	case ETHTYPE_ARP:
-		if (_netif.input(p, &_netif) != ERR_OK)
+		if (ip_addr_isany(&_netif.ip_addr))
+			return 1;
+		if (p->len < sizeof(struct etharp_hdr))
 		{
-			LWIP_DEBUGF(NETIF_DEBUG, ("netdev_input: IP input error\n"));
-			pbuf_free(p);
+			eth_drop_stats.runt++;
+			return 0;
 		}
-		break;
-		
+		arphdr = p->payload;
+		memcpy(&dest, &arphdr->dipaddr, sizeof(dest));
+		if (ip_addr_cmp(&dest, &_netif.ip_addr))
+			return 1;
+		eth_drop_stats.arp_not_us++;
+		return 0;
+
 	default:
-		outputf("Unhandled packet type %04x input", ethhdr->type);
+		eth_drop_stats.ethertype++;
+		return 0;
+	}
+}
+
+void eth_recv(struct nic *nic, struct pbuf *p)
+{
+	LINK_STATS_INC(link.recv);
+	
+	if (!_classify(p))
+	{
+		LINK_STATS_INC(link.drop);
 		pbuf_free(p);
-		break;
+		return;
+	}
+
+	if (_netif.input(p, &_netif) != ERR_OK)
+	{
+		LWIP_DEBUGF(NETIF_DEBUG, ("netdev_input: IP input error\n"));
+		pbuf_free(p);
+	}
+}
+
+/* eth_poll() is the first of the scheduler's tasks, so that the others
+ * see whatever came in on this SMI.  How long it may go on receiving is
+ * a share of the time since the last SMI, as measured by the TSC, so it
+ * scales with the SMI rate and needs no calibration; it also stops at
+ * the scheduler's deadline, although it will always take a few packets.
+ * Both limits are lifted if the receive ring is close to overflowing,
+ * since anything the card drops costs more to recover than it would
+ * have to take now.  Packets come off the ring a few at a time, with the
+ * transmit ring flushed in between, so that replies go out (and their
+ * slots come back) while we are still receiving; if the transmit ring
+ * fills up regardless, there is no point taking more.  If packets are
+ * left on the ring, the scheduler brings us back once the other tasks
+ * have had a go, if there is time, or else on the next SMI.
+ */
+#define ETH_POLL_SHARE	8	/* At most 1/8th of the time between SMIs, */
+#define ETH_POLL_MIN	8	/* ... but always take at least this many. */
+#define ETH_POLL_BATCH	4
+
+struct eth_poll_stats eth_poll_stats;
+
+/* The lwIP timers run off the TSC clock rather than counting SMIs, so that
+ * they keep to their intervals whatever the SMI rate is.  There is no
+ * fast timer as such: tcp_fasttmr() runs after every receive burst, so
+ * that the ACKs lwIP has been holding back go out in this SMI (one per
+ * connection per burst) rather than up to a quarter second later.  TCP
+ * pacing is told about every SMI, so that it can learn the period.
+ */
+static int _timers_started = 0;
+static unsigned long slow, dhcp_fine, dhcp_coarse;
+
+static void _timers(unsigned long now)
+{
+	if (!_timers_started)
+	{
+		slow = dhcp_fine = dhcp_coarse = now;
+		_timers_started = 1;
+	}
+
+#if TCP_SMI_PACING
+	tcp_pace_tick(now);
+#endif
+
+	if ((now - slow) >= TCP_SLOW_INTERVAL)
+	{
+		slow = now;
+		tcp_slowtmr();
+	}
+	if ((now - dhcp_fine) >= DHCP_FINE_TIMER_MSECS)
+	{
+		dhcp_fine = now;
+		dhcp_fine_tmr();
+	}
+	if ((now - dhcp_coarse) >= DHCP_COARSE_TIMER_MSECS)
+	{
+		dhcp_coarse = now;
+		dhcp_coarse_tmr();
 	}
 }
 
-void eth_poll()
+static int eth_poll(int first)
 {
-	static int ticks = 0;
-	int i = 15;	/* Don't process more than 15 packets at a time; we don't want the host to get TOO badly slowed down... */
+	static unsigned long lastpoll = 0, share = 0;
+	unsigned long start, allowance;
+	int n, taken = 0, rx, tx, more = 0;
 	
 	if (!_nic)
-		return;
+		return 0;
 	
 	smram_tseg_set_state(SMRAM_TSEG_OPEN);
 	
-	if ((ticks % 1000) == 0)	/* About a minute */
-		dhcp_coarse_tmr();
-	if ((ticks % 8) == 0)	/* About 500msec*/
-		dhcp_fine_tmr();
-	if ((ticks % 4) == 0)	/* About 250msec*/
-		tcp_tmr();
-	ticks++;
+	start = rdtsc();
+	if (first)
+	{
+		_timers(timer_ms());
+		share = (start - lastpoll) / ETH_POLL_SHARE;
+		lastpoll = start;
+	}
+
+	allowance = sched_left();
+	if (allowance > share)
+		allowance = share;
 
-	while (i > 0)
+	if (_nic->pending)
 	{
-		int n = _nic->recv(_nic);
-		i -= n;
-		if (n == 0)
+		_nic->pending(_nic, &rx, &tx);
+		if (rx >= _nic->rx_ring * 3 / 4)
+		{
+			allowance = share * 2;
+			eth_poll_stats.rx_nearly_full++;
+		}
+	}
+
+	eth_poll_stats.polls++;
+	for (;;)
+	{
+		n = _nic->recv(_nic, ETH_POLL_BATCH);
+		taken += n;
+		if (n < ETH_POLL_BATCH)
+		{
+			eth_poll_stats.drained++;
 			break;
+		}
+
+		if (_nic->tx_flush)
+			_nic->tx_flush(_nic);
+
+		if (taken < ETH_POLL_MIN)
+			continue;
+		if (_nic->pending)
+		{
+			_nic->pending(_nic, &rx, &tx);
+			if (tx >= _nic->tx_ring)
+			{
+				eth_poll_stats.tx_full++;
+				more = 1;
+				break;
+			}
+		}
+		if ((rdtsc() - start) >= allowance)
+		{
+			eth_poll_stats.out_of_time++;
+			more = 1;
+			break;
+		}
 	}
+	eth_poll_stats.packets += taken;
+
+	tcp_fasttmr();
+
+	return more;
+}
+
+TASK(eth_poll, 1, PROF_ETH_POLL);
+
+/* Whatever the tasks queued for transmission goes out in one go at the
+ * end of each pass. */
+static int eth_flush(int first)
+{
+	if (_nic && _nic->tx_flush)
+		_nic->tx_flush(_nic);
+	return 0;
+}
+
+TASK(eth_flush, 9, PROF_ETH_FLUSH);
+
+/* Whether an SMI can skip the network side altogether: nothing on the
+ * receive ring, no TCP connection that timers or the other tasks might
+ * have work for (listening ones don't count), and no DHCP timer that
+ * has anything to do.  Transmit descriptors still outstanding are fine;
+ * they get reclaimed whenever something is next sent.  This only looks;
+ * if the SMI is then skipped, eth_skip() must be called instead.
+ */
+int eth_idle()
+{
+	int rx, tx;
+
+	if (!_nic || !_nic->pending || !_timers_started)
+		return 0;
+
+	if (tcp_active_pcbs || tcp_tw_pcbs)
+		return 0;
+
+	_nic->pending(_nic, &rx, &tx);
+	if (rx)
+		return 0;
+
+	if (_netif.dhcp && _netif.dhcp->state != DHCP_BOUND)
+		return 0;
+	if ((timer_ms() - dhcp_coarse) >= DHCP_COARSE_TIMER_MSECS)
+		return 0;
+
+	return 1;
+}
+
+/* TCP pacing has to hear about every SMI, or it would take the gap to
+ * the next busy one for the SMI period. */
+void eth_skip()
+{
+#if TCP_SMI_PACING
+	tcp_pace_tick(timer_ms());
+#endif
 }
 
 static err_t _transmit(struct netif *netif, struct pbuf *p)
@@ -92,7 +302,11 @@ static err_t _transmit(struct netif *netif, struct pbuf *p)
 
 //	outputf("NIC: Transmit packet");
 
-	nic->transmit(nic, p);
+	if (nic->transmit(nic, p) < 0)
+	{
+		LINK_STATS_INC(link.memerr);
+		return ERR_MEM;
+	}
 
 	LINK_STATS_INC(link.xmit);
 
@@ -120,6 +334,7 @@ static err_t _init(struct netif *netif)
 	netif->mtu = 1500;
 	netif->hwaddr_len = ETHARP_HWADDR_LEN;
 	netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP;
+	netif->chksum_flags = NETIF_CHECKSUM_ENABLE_ALL & ~nic->csum_offload;
 	
 	return ERR_OK;
 }
@@ -138,6 +353,22 @@ int eth_register(struct nic *nic)
 	return 0;
 }
 
+/* Only one NIC ever gets registered, so rather than every driver keeping
+ * a receive pool of its own in SMRAM, whichever one probes first takes
+ * this.  ETH_RX_ARENA_SIZE is set by the biggest customer (e1000's 2K
+ * buffers); it is part of the SMRAM map in netwatch/netwatch-large.lds.
+ */
+static unsigned char _rx_arena[ETH_RX_ARENA_SIZE] __attribute__ ((aligned(2048)));
+static int _rx_arena_taken = 0;
+
+void *eth_rx_arena(unsigned int size)
+{
+	if (_rx_arena_taken || size > sizeof(_rx_arena))
+		return 0;
+	_rx_arena_taken = 1;
+	return _rx_arena;
+}
+
 typedef void(*thunk_t)();
 
 TABLE(thunk_t, protocols);
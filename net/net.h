@@ -14,9 +14,37 @@
 #include "etherboot-compat.h"
 #include <lwip/pbuf.h>
 
+/* How each call to eth_poll() ended: with the receive ring empty, or with packets
+ * left on it because the transmit ring was full or time ran out. */
+struct eth_poll_stats {
+	unsigned long polls;
+	unsigned long packets;
+	unsigned long drained;
+	unsigned long tx_full;
+	unsigned long out_of_time;
+	unsigned long rx_nearly_full;	/* Polls that got extra time. */
+};
+
+extern struct eth_poll_stats eth_poll_stats;
+
+/* Frames thrown away by eth_recv() before they reach lwIP, by reason. */
+struct eth_drop_stats {
+	unsigned long runt;
+	unsigned long ethertype;	/* Neither IP nor ARP. */
+	unsigned long ip_not_us;
+	unsigned long arp_not_us;
+};
+
+extern struct eth_drop_stats eth_drop_stats;
+
+/* Receive buffers for the NIC driver that comes up; see eth_rx_arena(). */
+#define ETH_RX_ARENA_SIZE	(50 * 1024)
+
 extern void eth_init();
+extern void *eth_rx_arena(unsigned int size);
 extern void eth_recv(struct nic *nic, struct pbuf *p);
-extern void eth_poll();
 extern int eth_register(struct nic *nic);
+extern int eth_idle();	/* Nothing to do on this SMI? */
+extern void eth_skip();	/* ... so it was not done. */
 
 #endif
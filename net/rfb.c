@@ -11,9 +11,11 @@
 #include <stdint.h>
 #include <minilib.h>
 #include <output.h>
+#include <trace.h>
 #include <fb.h>
 #include <keyboard.h>
 #include <tables.h>
+#include <sched.h>
 
 #include "lwip/tcp.h"
 #include "lwip/stats.h"
@@ -21,6 +23,7 @@
 #define RFB_PORT		5900
 
 #define SET_PIXEL_FORMAT	0
+#define SET_COLOUR_MAP_ENTRIES	1
 #define SET_ENCODINGS		2
 #define FB_UPDATE_REQUEST	3
 #define KEY_EVENT		4
@@ -29,8 +32,11 @@
 
 #define RFB_BUF_SIZE	1536
 
-#define SCREEN_CHUNKS_X 8
-#define SCREEN_CHUNKS_Y 8
+/* The screen goes out in SCREEN_CHUNKS_X by SCREEN_CHUNKS_Y pieces, and
+ * each client needs a blockbuf big enough for one of them; the finer the
+ * grid, the smaller the arena below. */
+#define SCREEN_CHUNKS_X 16
+#define SCREEN_CHUNKS_Y 16
 
 struct pixel_format {
 	uint8_t bpp;
@@ -91,6 +97,13 @@ struct text_event_pkt {
 	char text[];
 };
 
+struct colour_map_header {
+	uint8_t msgtype;
+	uint8_t padding;
+	uint16_t first_colour;
+	uint16_t ncolours;
+};
+
 struct update_header {
 	uint8_t msgtype;
 	uint8_t padding;
@@ -142,11 +155,62 @@ struct rfb_state {
 	int chunk_actually_sent;
 	int try_in_a_bit;
 
+	/* Client asked for 8bpp with a colour map; if the screen is
+	 * FB_PAL8, we send it indices straight out of video memory, and
+	 * otherwise pixels cut down to a fixed 3-3-2 colour map. */
+	int pal8;
+	int palette_sent;
+	uint32_t palette_hash;
+	int chunk_bytespp;
+
 	char * blockbuf;
+	int blockbuf_size;
+
+	/* fb_modegen as of the last time we looked at the mode. */
+	unsigned int modegen;
+
+	/* Sending is done from rfb_update, after the network has been
+	 * polled; wake says that something has happened since that might
+	 * let it go further. */
+	struct tcp_pcb *pcb;
+	int wake;
 };
 
 static struct server_init_message server_info;
 
+/* Client state and the chunk buffer come out of a fixed arena, not the
+ * lwIP heap: the blockbuf alone is bigger than most of what lwIP has to
+ * work with, and taking it from the heap would fragment it for everyone.
+ * The arena is sized for RFB_MAX_CLIENTS at up to RFB_MAX_XRES by
+ * RFB_MAX_YRES: two clients at 1280x1024 come to about 46K, which is
+ * RFB's share of what used to be the 128K lwIP heap (see lwippools.h and
+ * the SMRAM map in netwatch/netwatch-large.lds). */
+#ifndef RFB_MAX_CLIENTS
+#define RFB_MAX_CLIENTS	2
+#endif
+#ifndef RFB_MAX_XRES
+#define RFB_MAX_XRES	1280
+#endif
+#ifndef RFB_MAX_YRES
+#define RFB_MAX_YRES	1024
+#endif
+
+#define RFB_BLOCKBUF_SIZE \
+	(((RFB_MAX_XRES + SCREEN_CHUNKS_X - 1) / SCREEN_CHUNKS_X) \
+	 * ((RFB_MAX_YRES + SCREEN_CHUNKS_Y - 1) / SCREEN_CHUNKS_Y) * 4)
+
+/* A slot is free while its blockbuf pointer is null. */
+static struct rfb_state rfb_states[RFB_MAX_CLIENTS];
+static char rfb_blockbufs[RFB_MAX_CLIENTS][RFB_BLOCKBUF_SIZE];
+
+static int ceildiv(int a, int b) {
+	int res = a / b;
+	if (a % b != 0) {
+		res++;
+	}
+	return res;
+}
+
 static void init_server_info() {
 	server_info.name_length = htonl(8);
 	memcpy(server_info.name_string, "NetWatch", 8);
@@ -159,6 +223,7 @@ static void update_server_info() {
 		server_info.fb_height = htons(fb->curmode.yres);
 		switch (fb->curmode.format) {
 		case FB_RGB888:
+		case FB_PAL8:	/* copy_pixels expands it for us. */
 			server_info.fmt.bpp = 32;
 			server_info.fmt.depth = 24;
 			server_info.fmt.big_endian = 0;
@@ -199,18 +264,109 @@ static int advance_chunk(struct rfb_state *state) {
 	return 0;
 }
 
-static int ceildiv(int a, int b) {
-	int res = a / b;
-	if (a % b != 0) {
-		res++;
+	
+static int blockbuf_size() {
+	return ceildiv(fb->curmode.xres, SCREEN_CHUNKS_X)
+	       * ceildiv(fb->curmode.yres, SCREEN_CHUNKS_Y) * 4;
+}
+
+/* The screen mode changed underneath us: everything needs to be sent
+ * again, and the chunks may have gotten bigger.  Returns 0 if they no
+ * longer fit in the blockbuf. */
+static int mode_changed(struct rfb_state *state) {
+	if (blockbuf_size() > state->blockbuf_size) {
+		outputf("RFB: %dx%d is too big for the blockbuf",
+		        fb->curmode.xres, fb->curmode.yres);
+		return 0;
 	}
-	return res;
+
+	/* XXX: clients are not told about the new size. */
+	update_server_info();
+	memset(state->checksums, 0, sizeof(state->checksums));
+	state->palette_sent = 0;
+	state->modegen = fb_modegen;
+	return 1;
 }
-	
-static void send_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
+
+static int use_pal8(struct rfb_state *state) {
+	return state->pal8 && fb->curmode.format == FB_PAL8 && fb->copy_indices;
+}
+
+/* For colour map clients looking at a screen that has no palette of its
+ * own: index bits 0-2 are red, 3-5 green, and 6-7 blue. */
+static uint32_t rgb332_palette[256];
+
+static const uint32_t *get_rgb332_palette(uint32_t *hash) {
+	int i;
+
+	if (!rgb332_palette[255]) {
+		for (i = 0; i < 256; i++)
+			rgb332_palette[i] = ((i & 7) * 255 / 7)
+			                  | (((i >> 3) & 7) * 255 / 7) << 8
+			                  | ((i >> 6) * 255 / 3) << 16;
+	}
+	*hash = 0x332;
+	return rgb332_palette;
+}
+
+/* In place: each RGB888 pixel becomes one byte, at the front of buf. */
+static void pixels_to_rgb332(char *buf, int npixels) {
+	const uint32_t *in = (const uint32_t *)buf;
+	uint8_t *out = (uint8_t *)buf;
+	uint32_t p;
+	int i;
+
+	for (i = 0; i < npixels; i++) {
+		p = in[i];
+		out[i] = ((p >> 5) & 0x07) | ((p >> 10) & 0x38) | ((p >> 16) & 0xC0);
+	}
+}
+
+/* Make sure that the client has the current palette.  Returns 0 if it
+ * could not be sent yet. */
+static int send_colour_map(struct tcp_pcb *pcb, struct rfb_state *state) {
+	static struct {
+		struct colour_map_header hdr;
+		uint16_t entries[256][3];
+	} __attribute__((packed)) msg;
+	const uint32_t *pal;
+	uint32_t hash;
+	int i;
+
+	if (use_pal8(state))
+		pal = fb->getpalette(&hash);
+	else
+		pal = get_rgb332_palette(&hash);
+	if (state->palette_sent && hash == state->palette_hash)
+		return 1;
+
+	msg.hdr.msgtype = SET_COLOUR_MAP_ENTRIES;
+	msg.hdr.padding = 0;
+	msg.hdr.first_colour = htons(0);
+	msg.hdr.ncolours = htons(256);
+	for (i = 0; i < 256; i++) {
+		msg.entries[i][0] = htons((pal[i] & 0xFF) * 257);
+		msg.entries[i][1] = htons(((pal[i] >> 8) & 0xFF) * 257);
+		msg.entries[i][2] = htons(((pal[i] >> 16) & 0xFF) * 257);
+	}
+
+	if (tcp_write(pcb, &msg, sizeof(msg), TCP_WRITE_FLAG_COPY) != ERR_OK)
+		return 0;
+
+	outputf("RFB: sent colour map");
+	state->palette_sent = 1;
+	state->palette_hash = hash;
+	return 1;
+}
+
+/* Send as much as TCP will take, one chunk at a time, stopping at the
+ * scheduler's deadline once something has been done.  Returns 1 if it
+ * stopped for the deadline, and so has more to do right away. */
+static int send_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
 	struct update_header hdr;
 	int bytes_left;
 	int totaldim;
+	int chunks = 0;
 	err_t err;
 
 	while(1) {
@@ -221,18 +377,25 @@ static void send_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
 			/* Nothing to do */
 
 			if (state->update_requested) {
-				outputf("RFB send: update requested");
+				TRACE(TRACE_DEBUG, "RFB send: update requested");
 				state->update_requested = 0;
 				state->chunk_actually_sent = 0;
 				state->send_state = SST_HEADER;
 			} else {
-				return;
+				return 0;
 			}
 	
 			/* FALL THROUGH to SST_HEADER */
 
 		case SST_HEADER:
 
+			if (chunks && sched_expired())
+				return 1;
+			chunks++;
+
+			if (state->modegen != fb_modegen && !mode_changed(state))
+				return 0;
+
 			/* Calculate the width and height for this chunk, remembering
 			 * that if SCREEN_CHUNKS_[XY] do not evenly divide the width and
 			 * height, we may need to have shorter chunks at the edge of
@@ -253,14 +416,35 @@ static void send_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
 				state->chunk_height -= (totaldim - fb->curmode.yres);
 			}
 
-			/* Do we _actually_ need to send this chunk? */
-			if (fb->checksum_rect) {
+			/* Colour map clients get indices, but they need the
+			 * palette to go with them first. */
+			state->chunk_bytespp = 4;
+			if (state->pal8) {
+				if (!send_colour_map(pcb, state))
+					return 0;
+				state->chunk_bytespp = 1;
+			}
+
+			/* Do we _actually_ need to send this chunk?  If the
+			 * driver can copy and checksum in one go, snag the
+			 * data now, so the framebuffer only gets read once. */
+			if (fb->copy_checksum && state->chunk_bytespp == 4) {
+				state->chunk_checksum = fb->copy_checksum(state->blockbuf,
+								state->chunk_xpos, state->chunk_ypos,
+								state->chunk_width, state->chunk_height);
+
+				if (state->chunk_checksum == state->checksums[state->chunk_xnum][state->chunk_ynum]) {
+					if (advance_chunk(state))
+						return 0;
+					continue;
+				}
+			} else if (fb->checksum_rect) {
 				state->chunk_checksum = fb->checksum_rect(state->chunk_xpos, state->chunk_ypos,
 								state->chunk_width, state->chunk_height);
 
 				if (state->chunk_checksum == state->checksums[state->chunk_xnum][state->chunk_ynum]) {
 					if (advance_chunk(state))
-						return;
+						return 0;
 					continue;
 				}
 				/* Checksum gets set in data block, AFTER the data has been sent. */
@@ -282,30 +466,41 @@ static void send_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
 
 			if (err != ERR_OK) {
 				if (err != ERR_MEM)
-					outputf("RFB: header send error %d", err);
+					TRACE(TRACE_WARN, "RFB: header send error %d", err);
 
 				/* Try again later. */
-				return;
+				return 0;
 			}
 
 			state->send_state = SST_DATA;
 
-			/* Snag the data. */
-			fb->copy_pixels(state->blockbuf,
-				state->chunk_xpos, state->chunk_ypos,
-				state->chunk_width, state->chunk_height);
+			/* Snag the data, unless we already have it. */
+			if (state->chunk_bytespp == 1 && use_pal8(state))
+				fb->copy_indices(state->blockbuf,
+					state->chunk_xpos, state->chunk_ypos,
+					state->chunk_width, state->chunk_height);
+			else if (state->chunk_bytespp == 1) {
+				fb->copy_pixels(state->blockbuf,
+					state->chunk_xpos, state->chunk_ypos,
+					state->chunk_width, state->chunk_height);
+				pixels_to_rgb332(state->blockbuf,
+					state->chunk_width * state->chunk_height);
+			} else if (!fb->copy_checksum)
+				fb->copy_pixels(state->blockbuf,
+					state->chunk_xpos, state->chunk_ypos,
+					state->chunk_width, state->chunk_height);
 
 			/* FALL THROUGH to SST_DATA */
 
 		case SST_DATA:
 
-			bytes_left = 4 * state->chunk_width * state->chunk_height - state->chunk_bytes_sent;
+			bytes_left = state->chunk_bytespp * state->chunk_width * state->chunk_height - state->chunk_bytes_sent;
 
 			if (bytes_left == 0) {
 				state->send_state = SST_HEADER;
 				state->checksums[state->chunk_xnum][state->chunk_ynum] = state->chunk_checksum;
 				if (advance_chunk(state))
-					return;
+					return 0;
 				break;
 			}
 
@@ -321,24 +516,21 @@ static void send_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
 				state->chunk_bytes_sent += bytes_left;
 			} else {
 				if (err != ERR_MEM)
-					outputf("RFB: send error %d", err);
+					TRACE(TRACE_WARN, "RFB: send error %d", err);
 
-				return;
+				return 0;
 			}
 				
 			if (tcp_sndbuf(pcb) == 0) {
-				return;
+				return 0;
 			}
 		}
 	}
-	
-	if (tcp_output(pcb) != ERR_OK)
-		outputf("RFB: tcp_output bailed in send_fsm?");
 }
 
 static err_t rfb_sent(void *arg, struct tcp_pcb *pcb, uint16_t len) {
 	struct rfb_state *state = arg;
-	send_fsm(pcb, state);
+	state->wake = 1;
 	return ERR_OK;
 }
 
@@ -350,7 +542,7 @@ static err_t rfb_poll(void *arg, struct tcp_pcb *pcb) {
 			state->update_requested = 1;
 		}
 	}
-	send_fsm(pcb, state);
+	state->wake = 1;
 /*
 	stats_display();
 */
@@ -362,8 +554,8 @@ static void close_conn(struct tcp_pcb *pcb, struct rfb_state *state) {
 	tcp_arg(pcb, NULL);
 	tcp_sent(pcb, NULL);
 	tcp_recv(pcb, NULL);
-	mem_free(state->blockbuf);
-	mem_free(state);
+	tcp_poll(pcb, NULL, 0);	/* rfb_poll would be handed a NULL state. */
+	state->blockbuf = NULL;	/* Frees the slot. */
 	tcp_close(pcb);
 	outputf("close_conn: done");
 }
@@ -445,12 +637,19 @@ static enum fsm_result recv_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
 			/* SetPixelFormat */
 			if (state->writepos < (sizeof(struct pixel_format) + 4))
 				return NEEDMORE;
-			outputf("RFB: SetPixelFormat");
-/*
 			struct pixel_format * new_fmt =
 				(struct pixel_format *)(&state->data[4]);
-*/
-			/* XXX ... */
+
+			TRACE(TRACE_INFO, "RFB: SetPixelFormat %dbpp%s", new_fmt->bpp,
+			        new_fmt->true_color ? "" : " colour map");
+
+			/* The only format we convert to is an 8bpp colour
+			 * map: the screen's own palette in FB_PAL8 modes, or
+			 * 3-3-2 in any other.  Anything else gets our native
+			 * format regardless.  XXX ... */
+			state->pal8 = (new_fmt->bpp == 8 && !new_fmt->true_color);
+			state->palette_sent = 0;
+			memset(state->checksums, 0, sizeof(state->checksums));
 
 			state->readpos += sizeof(struct pixel_format) + 4;
 			return OK;
@@ -462,11 +661,11 @@ static enum fsm_result recv_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
 
 			pktsize = sizeof(struct set_encs_req) + (4 * ntohs(req->num));
 
-			outputf("RFB: SetEncodings [%d]", ntohs(req->num));
+			TRACE(TRACE_INFO, "RFB: SetEncodings [%d]", ntohs(req->num));
 			if (state->writepos < pktsize) return NEEDMORE;
 
 			for (i = 0; i < ntohs(req->num); i++) {
-				outputf("RFB: Encoding: %d", ntohl(req->encodings[i]));
+				TRACE(TRACE_DEBUG, "RFB: Encoding: %d", ntohl(req->encodings[i]));
 				/* XXX ... */
 			}
 
@@ -476,7 +675,7 @@ static enum fsm_result recv_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
 		case FB_UPDATE_REQUEST:
 			if (state->writepos < sizeof(struct fb_update_req))
 				return NEEDMORE;
-			outputf("RFB: UpdateRequest");
+			TRACE(TRACE_DEBUG, "RFB: UpdateRequest");
 
 			state->update_requested = 1;
 			memcpy(&state->client_interest_area, state->data,
@@ -491,7 +690,7 @@ static enum fsm_result recv_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
 
 			struct key_event_pkt * p = (struct key_event_pkt *)state->data;
 
-			outputf("RFB: Key: %d (%c)", htonl(p->keysym), (htonl(p->keysym) & 0xFF));
+			TRACE(TRACE_DEBUG, "RFB: Key: %d (%c)", htonl(p->keysym), (htonl(p->keysym) & 0xFF));
 			kbd_inject_keysym(htonl(p->keysym), p->downflag);
 
 			state->readpos += sizeof(struct key_event_pkt);
@@ -500,7 +699,7 @@ static enum fsm_result recv_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
 		case POINTER_EVENT:
 			if (state->writepos < sizeof(struct pointer_event_pkt))
 				return NEEDMORE;
-			outputf("RFB: Pointer");
+			TRACE(TRACE_DEBUG, "RFB: Pointer");
 
 			/* XXX stub */
 
@@ -510,7 +709,7 @@ static enum fsm_result recv_fsm(struct tcp_pcb *pcb, struct rfb_state *state) {
 		case CLIENT_CUT_TEXT:
 			if (state->writepos < sizeof(struct text_event_pkt))
 				return NEEDMORE;
-			outputf("RFB: Cut Text");
+			TRACE(TRACE_DEBUG, "RFB: Cut Text");
 
 			struct text_event_pkt * pkt =
 				(struct text_event_pkt *)state->data;
@@ -563,7 +762,7 @@ static err_t rfb_recv(void *arg, struct tcp_pcb *pcb,
 
 	copylen = pbuf_copy_partial(p, state->data + state->writepos, p->tot_len, 0);
 
-	outputf("RFB: Processing %d, wp %d, cp %d", p->tot_len, state->writepos, copylen);
+	TRACE(TRACE_DEBUG, "RFB: Processing %d, wp %d, cp %d", p->tot_len, state->writepos, copylen);
 
 	state->writepos += p->tot_len;
 
@@ -573,7 +772,7 @@ static err_t rfb_recv(void *arg, struct tcp_pcb *pcb,
 	while (1) {
 		switch (recv_fsm(pcb, state)) {
 		case NEEDMORE:
-			outputf("RFB FSM: blocking");
+			TRACE(TRACE_DEBUG, "RFB FSM: blocking");
 			goto doneprocessing;
 
 		case OK:
@@ -601,60 +800,100 @@ doneprocessing:
 
 	/* Kick off a send. */
 	if (state->send_state == SST_IDLE && state->update_requested) {
-		send_fsm(pcb, state);
+		state->wake = 1;
 	}
 
 	return ERR_OK;
 }	
 		
+/* The pcb is already gone by the time this is called; all that is left
+ * to do is to give the slot back, or it would be lost for good. */
+static void rfb_err(void *arg, err_t err) {
+	struct rfb_state *state = arg;
+
+	LWIP_UNUSED_ARG(err);
+
+	outputf("rfb_err: connection lost");
+	if (state)
+		state->blockbuf = NULL;
+}
+
 static err_t rfb_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
-	struct rfb_state *state;
-	char * blockbuf;
+	struct rfb_state *state = NULL;
+	int i;
 
 	LWIP_UNUSED_ARG(arg);
 	LWIP_UNUSED_ARG(err);
 
-	state = (struct rfb_state *)mem_malloc(sizeof(struct rfb_state));
+	for (i = 0; i < RFB_MAX_CLIENTS; i++)
+		if (!rfb_states[i].blockbuf)
+		{
+			state = &rfb_states[i];
+			break;
+		}
 
 	if (!state)
 	{
-		outputf("rfb_accept: out of memory\n");
+		outputf("rfb_accept: all %d client slots in use", RFB_MAX_CLIENTS);
 		return ERR_MEM;
 	}
 
-	memset(state, 0, sizeof(struct rfb_state));
-
-	blockbuf = mem_malloc(ceildiv(fb->curmode.xres, SCREEN_CHUNKS_X)
-	                    * ceildiv(fb->curmode.yres, SCREEN_CHUNKS_Y) * 4);
-
-	if (!blockbuf)
+	if (blockbuf_size() > RFB_BLOCKBUF_SIZE)
 	{
-		outputf("rfb_accept: out of memory allocating blockbuf\n");
-		mem_free(state);
+		outputf("rfb_accept: %dx%d is too big for the blockbuf",
+		        fb->curmode.xres, fb->curmode.yres);
 		return ERR_MEM;
 	}
 
-	state->blockbuf = blockbuf;
+	memset(state, 0, sizeof(struct rfb_state));
+
+	state->blockbuf = rfb_blockbufs[i];
+	state->blockbuf_size = RFB_BLOCKBUF_SIZE;
+	state->modegen = fb_modegen;
 	state->state = ST_BEGIN;
 	state->send_state = SST_IDLE;
+	state->pcb = pcb;
 
-	/* XXX: update_server_info() should be called from the 64ms timer, and deal
-	 * with screen resizes appropriately. */
+	/* Mode changes after this are picked up in send_fsm. */
 	update_server_info();
 
+	/* Small updates, and someone waiting on each one. */
+	tcp_nagle_disable(pcb);
+
 	tcp_arg(pcb, state);
 	tcp_recv(pcb, rfb_recv);
 	tcp_sent(pcb, rfb_sent);
 	tcp_poll(pcb, rfb_poll, 1);
-/*
 	tcp_err(pcb, rfb_err);
-*/
 	tcp_write(pcb, "RFB 003.008\n", 12, 0);
 	tcp_output(pcb);
 
 	return ERR_OK;
 }
 
+static int rfb_update(int first) {
+	struct rfb_state *state;
+	int i, more = 0;
+
+	LWIP_UNUSED_ARG(first);
+
+	for (i = 0; i < RFB_MAX_CLIENTS; i++) {
+		state = &rfb_states[i];
+		if (!state->blockbuf || !state->wake)
+			continue;
+
+		state->wake = send_fsm(state->pcb, state);
+		more |= state->wake;
+
+		if (tcp_output(state->pcb) != ERR_OK)
+			TRACE(TRACE_WARN, "RFB: tcp_output bailed in rfb_update?");
+	}
+
+	return more;
+}
+
+TASK(rfb_update, 5, PROF_RFB);
+
 static void rfb_init() {
 	struct tcp_pcb *pcb;
 
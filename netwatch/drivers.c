@@ -11,12 +11,16 @@
 #include <pci.h>
 
 extern struct pci_driver a3c90x_driver;
+extern struct pci_driver e1000_driver;
 extern struct pci_driver tnt2_driver;
+extern struct pci_driver bochs_driver;
 
 struct pci_driver *drivers[] =
 {
 	&a3c90x_driver,
+	&e1000_driver,
 	&tnt2_driver,
+	&bochs_driver,
 	0
 };
 
@@ -9,6 +9,8 @@
 	org 0xA8000
 [bits 16]
 entry:
+	rdtsc				; Note the time, for smi_entry() to
+	mov ebx, eax			; work out how long getting there took.
 	mov ax, 0xA800			; Take us out of flat unreal mode,
 	mov ds, ax			; and put us in true real mode.
 	mov es, ax
@@ -17,6 +19,7 @@ entry:
 	mov ss, ax
 	jmp 0xA800:(entry2-0xA8000)	; Long jump to a correct cs.
 entry2:
+	mov [(dataptr-0xA8000)+12], ebx	; entry_tsc
 	lgdt [(gdtr-0xA8000)]		; Set up a new GDT.
 	mov eax, 0x1
 	mov cr0, eax			; ... and enter pmode!
@@ -57,4 +60,6 @@ gdt:
 dataptr:
 	; 4 bytes of stack top
 	; 4 bytes of C entry point
+	; 4 bytes of entry_initialized
+	; 4 bytes of entry_tsc
 	; These show up 
@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <minilib.h>
 #include <output.h>
+#include <trace.h>
 
 static unsigned char kbd_inj_buffer[128];
 static int kbd_inj_start = 0;
@@ -212,7 +213,7 @@ void kbd_inject_scancode (unsigned char sc)
 		if (!sc) return;
 	}
 
-	outputf("Buffering %02x", sc);
+	TRACE(TRACE_DEBUG, "Buffering %02x", sc);
 	kbd_inj_buffer[kbd_inj_end] = sc;
 	kbd_inj_end += 1;
 	kbd_inj_end %= sizeof(kbd_inj_buffer);
@@ -271,10 +272,10 @@ unsigned char kbd_get_injected_scancode()
 		b = kbd_inj_buffer[kbd_inj_start];
 		kbd_inj_start += 1;
 		kbd_inj_start %= sizeof(kbd_inj_buffer);
-		outputf("Injecting %02x", b);
+		TRACE(TRACE_DEBUG, "Injecting %02x", b);
 		return b;
 	} else {
-		outputf("Not injecting");
+		TRACE(TRACE_DEBUG, "Not injecting");
 		return 0;
 	}
 }
@@ -141,14 +141,16 @@ void pci_dump() {
 
 void timer_handler(smi_event_t ev)
 {
+#if DEBUG80
 	static unsigned int ticks = 0;
+#endif
 	
 	smi_disable_event(SMI_EVENT_FAST_TIMER);
 	smi_enable_event(SMI_EVENT_FAST_TIMER);
 	
 	_try_inject();
 	
-	outb(0x80, (ticks++) & 0xFF);
+	DBG(ticks++ & 0xFF);
 	
 	if (!fb || fb->curmode.text)
 		outlog();
@@ -60,6 +60,7 @@ void ps_switch_stack (void (*call)(), int stack);
 
 static int initialized = 0;
 static int paging_enb = 0;
+static int pt_rebuilt = 0;
 static unsigned long *pd;
 
 extern int _bss, _bssend, _end;
@@ -169,6 +170,25 @@ static void pt_setup(int tseg_start, int tseg_size) {
 		addmap(0x1F0000 + i * 0x1000, tseg_start + i * 0x1000);
 }
 
+/* The page tables are in TSEG, so once built they stay put; each entry
+ * only checks the mappings that everything else depends on, before
+ * trusting them.  (Anything added since by addmap() is left alone.)
+ * The processor sets the accessed and dirty bits as it goes, so those
+ * are not compared. */
+#define PT_CHECK(ent, addr) \
+	(((ent) & ~(PTE_ACCESSED | PTE_DIRTY)) \
+	 == ((addr) | PTE_PRESENT | PTE_READ_WRITE))
+
+static int pt_valid(int tseg_start) {
+	unsigned long *pagedirectory = (unsigned long *) tseg_start;
+	unsigned long *pagetable = (unsigned long *) (tseg_start + 0x1000);
+
+	return PT_CHECK(pagedirectory[0], tseg_start + 0x1000)
+	    && PT_CHECK(pagetable[PTE_FOR(0x200000)], tseg_start + 0x2000)
+	    && PT_CHECK(pagetable[PTE_FOR(0x2FF000)], tseg_start + 0x101000)
+	    && PT_CHECK(pagetable[PTE_FOR(0x1F0000)], tseg_start);
+}
+
 void init_and_run(void)
 {
 	DBG(0x0A);
@@ -178,6 +198,8 @@ void init_and_run(void)
 		DBG(0x0B);
 		smi_init();
 		initialized = 1;
+		/* Setting up is not what entry_tsc is there to measure. */
+		entry_tsc = rdtsc();
 	}
 	
 	DBG(0x0C);
@@ -192,14 +214,19 @@ void c_entry(void)
 
 	DBG(0x01);
 
-	if (!initialized)
+	if (!initialized || !pt_valid(0x1FF80000))
+	{
+		if (initialized)
+			pt_rebuilt++;
 		pt_setup(0x1FF80000, 0x80000);
+	}
 
 	DBG(0x02);
 
-	/* Enable paging. */
+	/* Enable paging.  SMM entry leaves CR4 clear, so there is nothing
+	 * in it to keep. */
 	set_cr3((unsigned long)pd);
-	set_cr4(get_cr4() | CR4_PSE | CR4_OSFXSR);	/* ITT, we 4MByte page. */ 
+	set_cr4(CR4_PSE | CR4_OSFXSR);	/* ITT, we 4MByte page. */ 
 	set_cr0(get_cr0() | CR0_PG);
 
 	DBG(0x03);
@@ -226,6 +253,12 @@ void c_entry(void)
 		DBG(0x07);
 	}
 
+	if (pt_rebuilt)
+	{
+		outputf("paging: page tables damaged; rebuilt");
+		pt_rebuilt = 0;
+	}
+
 	DBG(0x08);
 	traps_install();
 	
@@ -18,6 +18,9 @@
 #include <fb.h>
 #include <output.h>
 #include <msr.h>
+#include <profile.h>
+#include <sched.h>
+#include <keyboard.h>
 #include "../net/net.h"
 #include "vga-overlay.h"
 
@@ -28,6 +31,10 @@ unsigned char vgasave = 0;
 unsigned long lastentry = 0;
 unsigned long lastlength = 0;
 
+/* Set once a full SMI has run, and so the chipset code has found (and
+ * remembered) everything it needs from PCI config space. */
+static int _warm = 0;
+
 unsigned long rdtsc()
 {
 	unsigned long tsc;
@@ -38,6 +45,35 @@ unsigned long rdtsc()
 	return tsc;
 }
 
+/* Most timer SMIs have nothing to do: nobody is connected, nothing has
+ * come in, and there are no keys waiting to go to the host.  Those are
+ * dealt with here, before any of the saving and restoring, without going
+ * near PCI config space, the UART or the screen.  Everything looked at
+ * is in memory or chipset I/O space, apart from the NIC's receive
+ * descriptors, which the card writes back to our memory.
+ *
+ * Skipping an SMI also skips timer_handler() and serial_leave(), so
+ * anything either of them still has to do makes it a full one: keys to
+ * inject, log lines not yet put on the screen, and serial output, which
+ * only goes out a FIFO's worth per SMI. */
+static int _idle(void)
+{
+	if (!_warm)
+		return 0;
+	if (kbd_has_injected_scancode())
+		return 0;
+	if ((!fb || fb->curmode.text) && log_pending())
+		return 0;
+	if (serial_pending())
+		return 0;
+	if (!eth_idle())
+		return 0;
+	if (!smi_poll_idle())
+		return 0;
+	eth_skip();
+	return 1;
+}
+
 void smi_entry(void)
 {
 	char statstr[512];
@@ -47,15 +83,26 @@ void smi_entry(void)
 	WRMSR(0x202, (RDMSR(0x202) & ~(0xFFULL)) | 0x06ULL);
 
 	entrytime = rdtsc();
+	PROF_BEGIN_AT(entry_tsc);
+	PROF_MARK(PROF_ENTRY);
+
+	if (_idle())
+	{
+		counter++;
+		PROF_MARK(PROF_IDLE);
+		PROF_END();
+		goto done;
+	}
 
 	pcisave = inl(0xCF8);
 	vgasave = inb(0x3D4);
 	pci_unbother_all();
 	
-	serial_init();
+	serial_enter();
+	PROF_MARK(PROF_UNBOTHER);
 
-	if (fb)
-        	fb->getvmode(fb->priv);
+	fb_checkmode();
+	PROF_MARK(PROF_GETVMODE);
 
 	counter++;
 	if (!fb || fb->curmode.text)
@@ -76,16 +123,23 @@ void smi_entry(void)
 		
         	sprintf(statstr, "NetWatch! %08x %08x, %2d.%d%%", smi_status(), counter, pct/10, pct%10);
 		strblit(statstr, 0, 0, 0);
+		PROF_MARK(PROF_STATUS);
 	}
 	
-	eth_poll();
+	sched_run();
 	
 	smi_poll();
+	PROF_MARK(PROF_SMI_POLL);
 	
+	serial_leave();
 	pci_bother_all();
 	outl(0xCF8, pcisave);
 	outb(0x3D4, vgasave);
+	PROF_MARK(PROF_REBOTHER);
+	PROF_END();
+	_warm = 1;
 	
+done:
 	lastentry = entrytime;
 	entrytime = rdtsc();
 	if (entrytime < lastentry)
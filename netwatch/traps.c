@@ -132,6 +132,7 @@ struct x86_gate {
 };
 
 static struct x86_gate idt[64];
+static int idt_built = 0;
 
 struct pseudo_descriptor {
         short pad;
@@ -139,15 +140,15 @@ struct pseudo_descriptor {
         unsigned long linear_base;
 } __attribute__((packed));
 
-void traps_install(void) {
-        DBG(0xCA);
-	int i;
+static struct pseudo_descriptor idtr = {
+	.limit = sizeof(idt) - 1,
+	.linear_base = (unsigned long)idt,
+};
 
-        struct pseudo_descriptor pdesc;
-	pdesc.limit = sizeof(idt) - 1;
-	pdesc.linear_base = (int)&idt; //v2p(&idt);
+static void idt_build(void) {
+	int i;
 
-       	DBG(0xCB);
+	DBG(0xCB);
 
 	for (i = 0; i < 32; i++)
 		WRAPPER_INSTALL(idt, TRAP, fault_other, i);
@@ -171,7 +172,41 @@ void traps_install(void) {
 	WRAPPER_INSTALL(idt, TRAP, fault_ac, T_ALIGNMENT_CHECK);
 	WRAPPER_INSTALL(idt, TRAP, fault_machine, T_MACHINE_CHECK);
 
+	idt_built = 1;
+}
+
+static int gate_is(int n, const struct x86_gate *want) {
+	return idt[n].filler[0] == want->filler[0]
+	    && idt[n].filler[1] == want->filler[1];
+}
+
+/* Spot-check the gates we are most likely to need. */
+static int idt_valid(void) {
+	struct x86_gate want[1];
+
+	WRAPPER_INSTALL(want, TRAP, fault_page, 0);
+	if (!gate_is(T_PAGE_FAULT, want))
+		return 0;
+	WRAPPER_INSTALL(want, TRAP, fault_gp, 0);
+	if (!gate_is(T_GENERAL_PROTECTION, want))
+		return 0;
+	return 1;
+}
+
+/* The IDT lives in TSEG, where nothing but us can get at it, so it is
+ * built on the first SMI and only checked after that.  IDTR is not kept
+ * across SMM entry, though, so it has to be loaded every time. */
+void traps_install(void) {
+        DBG(0xCA);
+
+	if (!idt_built)
+		idt_build();
+	else if (!idt_valid()) {
+		outputf("traps: IDT damaged; rebuilding");
+		idt_build();
+	}
+
         DBG(0xCC);
-	asm volatile("lidt %0" : : "m" (pdesc.limit));
+	asm volatile("lidt %0" : : "m" (idtr.limit));
         DBG(0xCE);
 }
@@ -21,6 +21,7 @@
 
 static char logents[LOGLEN][41] = {{0}};
 static int prodptr = 0;
+static int shownptr = 0;	/* prodptr as of the last outlog() */
 static int flush_imm = 0;
 
 #define VRAM_BASE		0xA0000UL
@@ -53,12 +54,12 @@ static char * vga_base()
 void strblit(char *src, int row, int col, int fill)
 {
 	char *destp = vga_base() + row * 80 * 2 + col * 2;
-	outb(0x80, 0x3C);
+	DBG(0x3C);
 	smram_state_t old_state = smram_save_state();
-	outb(0x80, 0x3D);
+	DBG(0x3D);
 
 	smram_aseg_set_state(SMRAM_ASEG_SMMCODE);
-	outb(0x80, 0x3E);
+	DBG(0x3E);
 
 	while (*src)
 	{
@@ -74,13 +75,14 @@ void strblit(char *src, int row, int col, int fill)
 			col++;
 		}
 
-	outb(0x80, 0x3F);
+	DBG(0x3F);
 	smram_restore_state(old_state);
-	outb(0x80, 0x40);
+	DBG(0x40);
 }
 
 void outlog()
 {
+	shownptr = prodptr;
 /*
 	int y;
 
@@ -89,6 +91,13 @@ void outlog()
 */
 }
 
+/* Has anything been logged that outlog() has not been given a chance to
+ * put up? */
+int log_pending()
+{
+	return shownptr != prodptr;
+}
+
 void dolog(const char *s)
 {
 	strcpy(logents[prodptr], s);
@@ -97,6 +106,7 @@ void dolog(const char *s)
 		serial_tx(*(s++));
 	serial_tx('\r');
 	serial_tx('\n');
+	serial_flush();
 	if (flush_imm)
 		outlog();
 }
@@ -114,6 +124,7 @@ void dologf(const char *fmt, ...)
 		serial_tx(*(s++));
 	serial_tx('\r');
 	serial_tx('\n');
+	serial_flush();
 	va_end(va);
 	prodptr = (prodptr + 1) % LOGLEN;
 	if (flush_imm)
@@ -0,0 +1,479 @@
+/* bench.c
+ * Host benchmarks and equivalence checks for hot NetWatch routines
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <io.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <minilib.h>
+#include <output.h>
+#include <smram.h>
+#include <text.h>
+#include <fb.h>
+#include <chksum.h>
+#include <video_defines.h>
+
+#include "linux.h"
+#include "sim.h"
+
+/* Runs the real code from the tree against what it replaced, on the
+ * simulator's build flags, and prints cycles per call.  Anything that is
+ * supposed to give the same answer as before is checked for that, too;
+ * the exit status is nonzero if it doesn't.
+ *
+ *	make bench && ./netwatch-bench
+ *
+ * The old routines are copied in here as they were, so that there is
+ * something to compare against after the tree has moved on.
+ */
+
+#define RUNS	512
+
+static int _failed = 0;
+
+static void _printf(const char *fmt, ...)
+{
+	char buf[256];
+	va_list va;
+
+	va_start(va, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, va);
+	va_end(va);
+	sys_write(1, buf, strlen(buf));
+}
+
+static void _check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		_printf("FAIL: %s\n", what);
+		_failed = 1;
+	}
+}
+
+static uint32_t _seed = 1;
+
+static uint32_t _rand()
+{
+	_seed = _seed * 1103515245 + 12345;
+	return _seed >> 8;
+}
+
+static inline uint32_t _rdtsc()
+{
+	uint32_t lo;
+
+	asm volatile("rdtsc" : "=a" (lo) : : "edx");
+	return lo;
+}
+
+/* Best of RUNS, to keep interrupts and the like out of it. */
+#define TIME(best, stmt) do { \
+	int _r; \
+	uint32_t _t; \
+	(best) = ~0U; \
+	for (_r = 0; _r < RUNS; _r++) \
+	{ \
+		_t = _rdtsc(); \
+		stmt; \
+		_t = _rdtsc() - _t; \
+		if (_t < (best)) \
+			(best) = _t; \
+	} \
+} while (0)
+
+/* The same, for things that take long enough that the host being busy
+ * for a while can spoil every run of one of them: the old and the new
+ * code take turns, so that both see the same spells. */
+#define TIME_BOTH(old, old_stmt, new, new_stmt) do { \
+	int _r; \
+	uint32_t _t; \
+	(old) = (new) = ~0U; \
+	for (_r = 0; _r < RUNS; _r++) \
+	{ \
+		_t = _rdtsc(); \
+		old_stmt; \
+		_t = _rdtsc() - _t; \
+		if (_t < (old)) \
+			(old) = _t; \
+		_t = _rdtsc(); \
+		new_stmt; \
+		_t = _rdtsc() - _t; \
+		if (_t < (new)) \
+			(new) = _t; \
+	} \
+} while (0)
+
+/*** What the code under test expects of its surroundings ***/
+
+void dolog(const char *s)
+{
+	_printf("%s\n", s);
+}
+
+void dologf(const char *fmt, ...)
+{
+	char buf[256];
+	va_list va;
+
+	va_start(va, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, va);
+	va_end(va);
+	dolog(buf);
+}
+
+void putbytes(const char *s, int len)
+{
+	sys_write(1, s, len);
+}
+
+void (*output)(const char *s) = dolog;
+void (*outputf)(const char *s, ...) = dologf;
+
+struct fbdevice *fb = 0;
+unsigned int fb_frame = 0;
+
+smram_state_t smram_save_state()
+{
+	return 0;
+}
+
+void smram_restore_state(smram_state_t state)
+{
+}
+
+int smram_aseg_set_state(int open)
+{
+	return 0;
+}
+
+void *p2v(unsigned long phys)
+{
+	return (void *)phys;
+}
+
+/* Just enough of a VGA for text.c: the CRTC and the sequencer, as
+ * register files.  Everything else reads as all ones. */
+static unsigned char _crtc[0x20], _seq[0x08];
+static unsigned char _crtc_idx, _seq_idx;
+
+unsigned long sim_in(unsigned short port, int size)
+{
+	switch (port)
+	{
+	case CRTC_IDX_REG:	return _crtc_idx;
+	case CRTC_DATA_REG:	return _crtc[_crtc_idx & 0x1F];
+	case 0x3C4:		return _seq_idx;
+	case 0x3C5:		return _seq[_seq_idx & 0x07];
+	}
+	return 0xFFFFFFFF;
+}
+
+void sim_out(unsigned short port, unsigned long val, int size)
+{
+	switch (port)
+	{
+	case CRTC_IDX_REG:	_crtc_idx = val; break;
+	case CRTC_DATA_REG:	_crtc[_crtc_idx & 0x1F] = val; break;
+	case 0x3C4:		_seq_idx = val; break;
+	case 0x3C5:		_seq[_seq_idx & 0x07] = val; break;
+	}
+}
+
+/*** Text mode rendering ***/
+
+/* Set the CRTC up for a cols x rows text mode with the given cell
+ * width, and VRAM rows pad words wider than the screen, and fill the
+ * screen with cells whose character is a function of where they are. */
+static void _text_mode(int cols, int rows, int cell_w, int pad)
+{
+	unsigned char *vram = (unsigned char *)CONSOLE_MEM_BASE;
+	int yres = rows * 16 - 1;
+	int stride = cols * 2 + pad * 4;
+	int r, c;
+
+	_seq[0x01] = (cell_w == 8) ? 0x01 : 0x00;
+	_crtc[0x01] = cols - 1;
+	_crtc[0x12] = yres & 0xFF;
+	_crtc[0x07] = ((yres >> 7) & 0x02) | ((yres >> 3) & 0x40);
+	_crtc[0x13] = cols / 2 + pad;
+	_crtc[CRTC_START_ADDR_MSB_IDX] = 0;
+	_crtc[CRTC_START_ADDR_MSB_IDX + 1] = 0;
+
+	for (r = 0; r < rows; r++)
+		for (c = 0; c < cols; c++)
+		{
+			vram[r * stride + c * 2] = (r * 7 + c) & 0xFF;
+			vram[r * stride + c * 2 + 1] = 0x07;
+		}
+}
+
+/* text_render before it went to precomputed tables; 9-dot, 80 columns. */
+static unsigned char _old_font[256 * 32];
+
+static void _old_text_render(char *buf, int x, int y, int w, int h)
+{
+	unsigned char *video = (unsigned char *)CONSOLE_MEM_BASE;
+	unsigned int textx = x / 9;
+	unsigned int texty = y / 16;
+	unsigned int cx, cy;
+	unsigned char ch, at, font;
+
+	for (cy = y; cy < (y + h); cy++)
+	{
+		cx = x;
+		texty = cy / 16;
+		textx = cx / 9;
+		ch = video[texty * 160 + textx * 2];
+		at = video[texty * 160 + textx * 2 + 1];
+		font = _old_font[ch * 32 + cy % 16];
+		for (cx = x; cx < (x + w); cx++)
+		{
+			unsigned int pos = cx % 8;
+			if (pos == 0)
+			{
+				textx = cx / 8;
+				ch = video[texty * 160 + textx * 2];
+				at = video[texty * 160 + textx * 2 + 1];
+				font = _old_font[ch * 32 + cy % 16];
+			}
+			if (pos == 8)
+				pos = 7;
+			if ((font >> (7 - pos)) & 1)
+			{
+				*(buf++) = (at & 0x01) ? 0xFF : 0x00;
+				*(buf++) = (at & 0x02) ? 0xFF : 0x00;
+				*(buf++) = (at & 0x04) ? 0xFF : 0x00;
+			} else {
+				*(buf++) = (at & 0x10) ? 0xFF : 0x00;
+				*(buf++) = (at & 0x20) ? 0xFF : 0x00;
+				*(buf++) = (at & 0x40) ? 0xFF : 0x00;
+			}
+			*(buf++) = 0;
+		}
+	}
+}
+
+/* Big enough for 132x60 cells of 8 pixels, or 80x25 of 9. */
+static uint32_t _pixels[132 * 8 * 60 * 16];
+
+/* With the font set so that each glyph's rows are its own code, the
+ * character in any cell can be read back off the rendered pixels.  In
+ * 9-dot modes, the 9th pixel is background, except that the line-drawing
+ * characters repeat the 8th. */
+static int _text_readback(int cols, int rows, int cell_w)
+{
+	int xres = cols * cell_w, r, c, line, i, bits, ch;
+
+	for (r = 0; r < rows; r++)
+		for (c = 0; c < cols; c++)
+			for (line = 0; line < 16; line += 5)
+			{
+				const uint32_t *px = _pixels + (r * 16 + line) * xres + c * cell_w;
+				ch = (r * 7 + c) & 0xFF;
+				for (bits = 0, i = 0; i < 8; i++)
+					bits = (bits << 1) | (px[i] != 0);
+				if (bits != ch)
+					return 0;
+				if (cell_w == 9 && px[8] != (((ch & 0xE0) == 0xC0) ? px[7] : 0))
+					return 0;
+			}
+	return 1;
+}
+
+/* However text_render is asked for a rectangle, it has to come out the
+ * same as that part of the whole screen. */
+static uint32_t _whole[80 * 9 * 25 * 16];
+
+static int _text_rects(int xres, int yres)
+{
+	int n, x, y, w, h, i;
+
+	fb_frame++;
+	text_render((char *)_whole, 0, 0, xres, yres);
+	for (n = 0; n < 1000; n++)
+	{
+		x = _rand() % xres;
+		y = _rand() % yres;
+		w = xres - x;
+		if (n % 2 && w > 50)
+			w = 50;	/* Mostly narrow, like RFB's tiles */
+		w = 1 + _rand() % w;
+		h = 1 + _rand() % (yres - y);
+		text_render((char *)_pixels, x, y, w, h);
+		for (i = 0; i < w * h; i++)
+			if (_pixels[i] != _whole[(y + i / w) * xres + x + i % w])
+				return 0;
+	}
+	return 1;
+}
+
+static void _bench_text()
+{
+	unsigned char *font = (unsigned char *)CONSOLE_MEM_BASE;
+	uint32_t old, new;
+	int i, cell_w;
+
+	/* text_init() takes the font from plane 2, which is all that
+	 * 0xB8000 is here. */
+	for (i = 0; i < 256 * 32; i++)
+		font[i] = i / 32;
+	text_init();
+	memcpy(_old_font, font, sizeof(_old_font));
+
+	_text_mode(80, 25, 9, 0);
+	{
+		struct vmode mode;
+		text_getvmode(&mode);
+		_check(mode.xres == 720 && mode.yres == 400, "text: 80x25 geometry");
+	}
+	TIME_BOTH(old, _old_text_render((char *)_pixels, 0, 0, 720, 400),
+	          new, { fb_frame++; text_render((char *)_pixels, 0, 0, 720, 400); });
+	_printf("text_render 720x400:  old %8u  new %8u cycles  (%u.%ux)\n",
+	        old, new, old / new, old * 10 / new % 10);
+	_check(_text_readback(80, 25, 9), "text: 80x25 9-dot cells read back");
+
+	/* The same rectangles that rfb.c asks for, a tile at a time, all
+	 * in one SMI. */
+	TIME_BOTH(old, for (i = 0; i < 720 * 400 / (48 * 48); i++)
+		_old_text_render((char *)_pixels, (i % 15) * 48, (i / 15) * 48, 48, 48),
+	          new, { fb_frame++; for (i = 0; i < 720 * 400 / (48 * 48); i++)
+		text_render((char *)_pixels, (i % 15) * 48, (i / 15) * 48, 48, 48); });
+	_printf("text_render 48x48 x%d: old %8u  new %8u cycles  (%u.%ux)\n",
+	        720 * 400 / (48 * 48), old, new, old / new, old * 10 / new % 10);
+
+	/* Wider modes have a wider row in VRAM, too; and the row in VRAM
+	 * may be wider than the screen. */
+	_text_mode(132, 43, 8, 0);
+	{
+		struct vmode mode;
+		text_getvmode(&mode);
+		_check(mode.xres == 1056 && mode.yres == 688, "text: 132x43 geometry");
+	}
+	fb_frame++;
+	text_render((char *)_pixels, 0, 0, 1056, 688);
+	_check(_text_readback(132, 43, 8), "text: 132x43 cells read back");
+
+	_text_mode(80, 25, 8, 8);
+	{
+		struct vmode mode;
+		text_getvmode(&mode);
+	}
+	fb_frame++;
+	text_render((char *)_pixels, 0, 0, 640, 400);
+	_check(_text_readback(80, 25, 8), "text: 80x25 cells read back");
+
+	/* Now in all sorts of colors, so that runs of cells differ. */
+	for (cell_w = 9; cell_w >= 8; cell_w--)
+	{
+		unsigned char *vram = (unsigned char *)CONSOLE_MEM_BASE;
+		struct vmode mode;
+
+		_text_mode(80, 25, cell_w, 0);
+		text_getvmode(&mode);
+		for (i = 0; i < 80 * 25; i++)
+			if (_rand() % 4 == 0)
+				vram[i * 2 + 1] = _rand() & 0x7F;
+		_check(_text_rects(mode.xres, mode.yres),
+		       "text: rectangles match the whole screen");
+	}
+}
+
+/*** Internet checksum ***/
+
+/* lwIP's lwip_standard_chksum (LWIP_CHKSUM_ALGORITHM 1), which is what
+ * LWIP_CHKSUM was before lib/chksum.c. */
+static uint16_t _old_chksum(const void *dataptr, uint16_t len)
+{
+	const uint8_t *octetptr = dataptr;
+	uint32_t acc = 0;
+	uint16_t src;
+
+	while (len > 1)
+	{
+		src = (*octetptr) << 8;
+		octetptr++;
+		src |= (*octetptr);
+		octetptr++;
+		acc += src;
+		len -= 2;
+	}
+	if (len > 0)
+	{
+		src = (*octetptr) << 8;
+		acc += src;
+	}
+	acc = (acc >> 16) + (acc & 0x0000ffffUL);
+	if ((acc & 0xffff0000) != 0)
+		acc = (acc >> 16) + (acc & 0x0000ffffUL);
+	return (uint16_t)((acc << 8) | (acc >> 8));
+}
+
+static uint8_t _ckbuf[2048 + 64], _ckdst[2048 + 64];
+static volatile uint16_t _ckout;	/* So that no sum is optimised away. */
+
+static void _bench_chksum()
+{
+	uint32_t old, new;
+	int i, off, doff, len, n;
+	uint16_t want;
+
+	/* Every length up to a jumbo frame's worth, at every alignment of
+	 * source and destination, on random data, and then some all-ones
+	 * buffers to make the carries work. */
+	for (n = 0; n < 20000; n++)
+	{
+		off = _rand() % 8;
+		doff = _rand() % 8;
+		len = (n < 2048) ? n : _rand() % 2048;
+		for (i = 0; i < len + off; i++)
+			_ckbuf[i] = (n % 16 == 1) ? 0xFF : _rand();
+
+		want = _old_chksum(_ckbuf + off, len);
+		if (chksum(_ckbuf + off, len) != want)
+		{
+			_printf("chksum: len %d off %d: %04x, want %04x\n", len, off,
+			        chksum(_ckbuf + off, len), want);
+			_check(0, "chksum matches lwIP's");
+			break;
+		}
+		memset(_ckdst, 0, sizeof(_ckdst));
+		if (chksum_copy(_ckdst + doff, _ckbuf + off, len) != want
+		    || memcmp((char *)_ckdst + doff, (char *)_ckbuf + off, len)
+		    || _ckdst[doff + len] != 0)
+		{
+			_printf("chksum_copy: len %d off %d/%d\n", len, off, doff);
+			_check(0, "chksum_copy copies and matches lwIP's");
+			break;
+		}
+	}
+
+	/* A full-sized TCP segment, as tcp_enqueue() sees it. */
+	for (i = 0; i < 1460; i++)
+		_ckbuf[i] = _rand();
+	TIME(old, _ckout = _old_chksum(_ckbuf, 1460));
+	TIME(new, _ckout = chksum(_ckbuf, 1460));
+	_printf("chksum 1460:          old %8u  new %8u cycles  (%u.%ux)\n",
+	        old, new, old / new, old * 10 / new % 10);
+	TIME(old, { memcpy(_ckdst, _ckbuf, 1460); _ckout = _old_chksum(_ckdst, 1460); });
+	TIME(new, _ckout = chksum_copy(_ckdst, _ckbuf, 1460));
+	_printf("copy+chksum 1460:     old %8u  new %8u cycles  (%u.%ux)\n",
+	        old, new, old / new, old * 10 / new % 10);
+}
+
+int sim_main(int argc, char **argv)
+{
+	sys_mmap_fixed(SIM_LOWMEM_BASE, SIM_LOWMEM_SIZE);
+
+	_bench_text();
+	_bench_chksum();
+
+	_printf(_failed ? "FAILED\n" : "ok\n");
+	return _failed;
+}
@@ -0,0 +1,28 @@
+/* io.h
+ * I/O port access for the simulator
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree. 
+ *
+ */
+
+#ifndef __IO_H
+#define __IO_H
+
+/* This stands in for include/raw/io.h.  The simulator is an ordinary
+ * process, which may not touch I/O ports; accesses are logged instead,
+ * and reads come back as all ones. */
+
+extern unsigned long sim_in(unsigned short port, int size);
+extern void sim_out(unsigned short port, unsigned long val, int size);
+
+#define inb(port)	((unsigned char)sim_in((port), 1))
+#define inw(port)	((unsigned short)sim_in((port), 2))
+#define inl(port)	((unsigned long)sim_in((port), 4))
+#define outb(port, val)	sim_out((port), (unsigned char)(val), 1)
+#define outw(port, val)	sim_out((port), (unsigned short)(val), 2)
+#define outl(port, val)	sim_out((port), (unsigned long)(val), 4)
+
+#endif
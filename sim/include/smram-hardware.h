@@ -0,0 +1,16 @@
+/* smram-hardware.h
+ * SMRAM state type for the simulator
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#ifndef __SMRAM_SIM_H
+#define __SMRAM_SIM_H
+
+typedef unsigned char smram_state_t;
+
+#endif
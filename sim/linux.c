@@ -0,0 +1,119 @@
+/* linux.c
+ * Linux system calls for the simulator
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include "linux.h"
+
+#define NR_exit			1
+#define NR_read			3
+#define NR_write		4
+#define NR_open			5
+#define NR_close		6
+#define NR_ioctl		54
+#define NR_mmap			90
+#define NR_poll			168
+#define NR_clock_gettime	265
+#define NR_clock_nanosleep	267
+
+#define CLOCK_MONOTONIC		1
+#define TIMER_ABSTIME		1
+#define EINTR			4
+
+static long _syscall(long nr, long a, long b, long c, long d)
+{
+	long ret;
+
+	asm volatile("int $0x80"
+		: "=a" (ret)
+		: "a" (nr), "b" (a), "c" (b), "d" (c), "S" (d)
+		: "memory");
+	return ret;
+}
+
+int sys_open(const char *path, int flags)
+{
+	return _syscall(NR_open, (long)path, flags, 0, 0);
+}
+
+int sys_close(int fd)
+{
+	return _syscall(NR_close, fd, 0, 0, 0);
+}
+
+int sys_read(int fd, void *buf, int len)
+{
+	return _syscall(NR_read, fd, (long)buf, len, 0);
+}
+
+int sys_write(int fd, const void *buf, int len)
+{
+	return _syscall(NR_write, fd, (long)buf, len, 0);
+}
+
+int sys_ioctl(int fd, unsigned long req, void *arg)
+{
+	return _syscall(NR_ioctl, fd, req, (long)arg, 0);
+}
+
+int sys_poll_in(int fd)
+{
+	struct { int fd; short events, revents; } pfd = { fd, 0x1 /* POLLIN */, 0 };
+
+	return _syscall(NR_poll, (long)&pfd, 1, 0, 0);
+}
+
+void sys_exit(int code)
+{
+	for (;;)
+		_syscall(NR_exit, code, 0, 0, 0);
+}
+
+/* The old-style mmap, which takes its arguments in memory; the new one
+ * wants six registers, one of them %ebp. */
+void *sys_mmap_fixed(unsigned long addr, unsigned long len)
+{
+	unsigned long args[6] = {
+		addr, len,
+		0x3,			/* PROT_READ | PROT_WRITE */
+		0x02 | 0x10 | 0x20,	/* MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS */
+		-1, 0
+	};
+
+	return (void *)_syscall(NR_mmap, (long)args, 0, 0, 0);
+}
+
+void sim_gettime(struct sim_time *t)
+{
+	_syscall(NR_clock_gettime, CLOCK_MONOTONIC, (long)t, 0, 0);
+}
+
+void sim_sleep_until(const struct sim_time *t)
+{
+	while (_syscall(NR_clock_nanosleep, CLOCK_MONOTONIC, TIMER_ABSTIME,
+	                (long)t, 0) == -EINTR)
+		;
+}
+
+void sim_time_add_us(struct sim_time *t, long us)
+{
+	t->sec += us / 1000000;
+	t->nsec += (us % 1000000) * 1000;
+	if (t->nsec >= 1000000000)
+	{
+		t->sec++;
+		t->nsec -= 1000000000;
+	}
+}
+
+/* a - b; there is no 64-bit division without libgcc, so this stays in
+ * longs, which is good for a little over half an hour. */
+long sim_time_diff_us(const struct sim_time *a, const struct sim_time *b)
+{
+	return (a->sec - b->sec) * 1000000 + (a->nsec - b->nsec) / 1000;
+}
@@ -0,0 +1,46 @@
+/* linux.h
+ * Just enough of the Linux system call interface for the simulator
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#ifndef _SIM_LINUX_H
+#define _SIM_LINUX_H
+
+#include <stdint.h>
+
+/* The simulator is built with the same freestanding flags as NetWatch
+ * itself, against the same minilib, so there is no libc; these go straight
+ * to the kernel through the i386 int $0x80 interface.  Errors come back as
+ * negative errno values. */
+
+#define SIM_O_RDWR	02
+#define SIM_O_NONBLOCK	04000
+
+#define SIM_EAGAIN	11
+
+struct sim_time {
+	long sec;
+	long nsec;
+};
+
+extern int sys_open(const char *path, int flags);
+extern int sys_close(int fd);
+extern int sys_read(int fd, void *buf, int len);
+extern int sys_write(int fd, const void *buf, int len);
+extern int sys_ioctl(int fd, unsigned long req, void *arg);
+extern int sys_poll_in(int fd);	/* 1 if fd is readable now */
+extern void sys_exit(int code) __attribute__((noreturn));
+extern void *sys_mmap_fixed(unsigned long addr, unsigned long len);
+
+/* CLOCK_MONOTONIC */
+extern void sim_gettime(struct sim_time *t);
+extern void sim_sleep_until(const struct sim_time *t);
+extern void sim_time_add_us(struct sim_time *t, long us);
+extern long sim_time_diff_us(const struct sim_time *a, const struct sim_time *b);
+
+#endif
@@ -0,0 +1,255 @@
+/* main.c
+ * Entry point and SMI loop for the simulator
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <minilib.h>
+#include <output.h>
+#include <fb.h>
+#include <profile.h>
+#include <sched.h>
+#include "../net/net.h"
+#include "lwip/netif.h"
+#include "lwip/dhcp.h"
+#include "lwip/stats.h"
+
+#include "linux.h"
+#include "sim.h"
+
+/* The simulator runs NetWatch's network side -- lwIP, net.c, and whatever
+ * is in the PROTOCOL table -- as an ordinary Linux process, on top of a
+ * TAP device and a made-up screen, so that it can be loaded up and
+ * measured without any hardware.  In place of the SMI, there is a timer:
+ * every period, the screen changes a little, and then we do what
+ * smi_entry() does for the network.  Nothing else happens in between,
+ * just as on the real thing.
+ *
+ * To try it:
+ *	ip tuntap add dev nw0 mode tap
+ *	ip addr add 10.0.0.1/24 dev nw0 && ip link set nw0 up
+ *	./netwatch-sim -i nw0 -a 10.0.0.2
+ * and then point a browser, a VNC client or gdb at 10.0.0.2.
+ */
+
+#define DEFAULT_PERIOD_US	64000	/* The ICH2 fast timer */
+#define DEFAULT_STATS_SEC	10
+
+static const char usage[] =
+	"usage: netwatch-sim [-i tapdev] [-a ipaddr [-n netmask] [-g gateway]]\n"
+	"                    [-m mac] [-p period_us] [-s WxH] [-r stats_sec]\n"
+	"                    [-l loss_percent]\n";
+
+static unsigned char _hwaddr[6] = { 0x02, 0x4E, 0x57, 0x00, 0x00, 0x01 };
+
+/* Tick timing since the last report. */
+static unsigned long _ticks, _late, _idle;
+static long _work_us, _work_max_us;
+
+static int _atoi(const char *s, const char **end)
+{
+	int n = 0;
+
+	while (*s >= '0' && *s <= '9')
+		n = n * 10 + *(s++) - '0';
+	if (end)
+		*end = s;
+	return n;
+}
+
+static int _parse_ip(const char *s, struct ip_addr *ip)
+{
+	int a, b, c, d;
+
+	a = _atoi(s, &s);
+	if (*(s++) != '.') return -1;
+	b = _atoi(s, &s);
+	if (*(s++) != '.') return -1;
+	c = _atoi(s, &s);
+	if (*(s++) != '.') return -1;
+	d = _atoi(s, &s);
+	if (*s) return -1;
+	IP4_ADDR(ip, a, b, c, d);
+	return 0;
+}
+
+static int _hexdigit(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static int _parse_mac(const char *s, unsigned char *mac)
+{
+	int i, hi, lo;
+
+	for (i = 0; i < 6; i++)
+	{
+		hi = _hexdigit(s[0]);
+		lo = _hexdigit(s[1]);
+		if (hi < 0 || lo < 0 || (i < 5 && s[2] != ':'))
+			return -1;
+		mac[i] = (hi << 4) | lo;
+		s += 3;
+	}
+	return 0;
+}
+
+static void _report()
+{
+	outputf("sim: %lu ticks (%lu late, %lu idle), work avg %ld us, max %ld us",
+	        _ticks, _late, _idle, _ticks ? _work_us / (long)_ticks : 0,
+	        _work_max_us);
+	outputf("sim: poll: %lu pkts; drained %lu, tx full %lu, out of time %lu",
+	        eth_poll_stats.packets, eth_poll_stats.drained,
+	        eth_poll_stats.tx_full, eth_poll_stats.out_of_time);
+	outputf("sim: sched: %lu runs, %lu passes, %lu left work over",
+	        sched_stats.runs, sched_stats.passes, sched_stats.overruns);
+	outputf("sim: drop: %lu runt, %lu ethertype, %lu IP, %lu ARP not for us",
+	        eth_drop_stats.runt, eth_drop_stats.ethertype,
+	        eth_drop_stats.ip_not_us, eth_drop_stats.arp_not_us);
+	outputf("sim: link: %u recv, %u xmit, %u memerr",
+	        lwip_stats.link.recv, lwip_stats.link.xmit, lwip_stats.link.memerr);
+	outputf("sim: heap: %u/%u used (%u wasted), %u max, %u failed",
+	        lwip_stats.mem.used, lwip_stats.mem.avail,
+	        lwip_stats.mem.used - lwip_stats.mem.requested,
+	        lwip_stats.mem.max, lwip_stats.mem.err);
+	_ticks = _late = _idle = 0;
+	_work_us = _work_max_us = 0;
+}
+
+int sim_main(int argc, char **argv)
+{
+	const char *ifname = "nw0";
+	struct ip_addr ip, mask, gw;
+	int have_ip = 0, xres = 1024, yres = 768;
+	long period = DEFAULT_PERIOD_US, stats = DEFAULT_STATS_SEC, work;
+	struct sim_time next, now, done, lastreport;
+	const char *s;
+	int i;
+
+	IP4_ADDR(&mask, 255, 255, 255, 0);
+	gw.addr = 0;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-' || argv[i][2] || i + 1 == argc)
+			goto bad;
+		s = argv[++i];
+		switch (argv[i - 1][1])
+		{
+		case 'i':
+			ifname = s;
+			break;
+		case 'a':
+			if (_parse_ip(s, &ip))
+				goto bad;
+			have_ip = 1;
+			break;
+		case 'n':
+			if (_parse_ip(s, &mask))
+				goto bad;
+			break;
+		case 'g':
+			if (_parse_ip(s, &gw))
+				goto bad;
+			break;
+		case 'm':
+			if (_parse_mac(s, _hwaddr))
+				goto bad;
+			break;
+		case 'p':
+			period = _atoi(s, 0);
+			break;
+		case 's':
+			xres = _atoi(s, &s);
+			if (*(s++) != 'x')
+				goto bad;
+			yres = _atoi(s, 0);
+			break;
+		case 'r':
+			stats = _atoi(s, 0);
+			break;
+		case 'l':
+			tap_loss = _atoi(s, 0);
+			break;
+		default:
+			goto bad;
+		}
+	}
+	if (period <= 0)
+		goto bad;
+
+	sim_stubs_init();
+	if (screen_init(xres, yres) < 0)
+		return 1;
+
+	eth_init();
+	if (tap_init(ifname, _hwaddr) < 0)
+		return 1;
+
+	/* A fixed address saves having to run a DHCP server on the TAP. */
+	if (have_ip)
+	{
+		dhcp_stop(netif_default);
+		netif_set_addr(netif_default, &ip, &mask, &gw);
+		outputf("sim: address %d.%d.%d.%d",
+		        ip4_addr1(&ip), ip4_addr2(&ip), ip4_addr3(&ip), ip4_addr4(&ip));
+	}
+
+	outputf("sim: one tick every %ld us", period);
+
+	sim_gettime(&next);
+	lastreport = next;
+	for (;;)
+	{
+		sim_time_add_us(&next, period);
+		sim_sleep_until(&next);
+
+		sim_gettime(&now);
+		screen_tick();
+		PROF_BEGIN();
+		if (eth_idle())
+		{
+			/* smi_entry()'s fast path, less the chipset. */
+			eth_skip();
+			_idle++;
+			PROF_MARK(PROF_IDLE);
+		} else {
+			fb_checkmode();
+			PROF_MARK(PROF_GETVMODE);
+			sched_run();
+		}
+		PROF_END();
+		sim_gettime(&done);
+
+		_ticks++;
+		work = sim_time_diff_us(&done, &now);
+		_work_us += work;
+		if (work > _work_max_us)
+			_work_max_us = work;
+
+		/* If we have fallen behind, don't try to catch up. */
+		if (sim_time_diff_us(&done, &next) > period)
+		{
+			_late++;
+			next = done;
+		}
+
+		if (stats && sim_time_diff_us(&done, &lastreport) >= stats * 1000000)
+		{
+			_report();
+			lastreport = done;
+		}
+	}
+
+bad:
+	sys_write(2, usage, sizeof(usage) - 1);
+	return 1;
+}
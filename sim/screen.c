@@ -0,0 +1,151 @@
+/* screen.c
+ * A synthetic framebuffer for the simulator
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+#include <output.h>
+#include <fb.h>
+
+#include "../hardware/video/generic.h"
+#include "sim.h"
+
+/* An RGB888 screen in ordinary memory, read through the same generic32
+ * routines as a real linear framebuffer.  Something on it changes every
+ * tick, so that RFB clients always have work to do: a square bounces
+ * around over a fixed gradient, and a band of "console text" near the
+ * bottom scrolls up a line every so often.
+ */
+
+#define SCREEN_MAX_X	1920
+#define SCREEN_MAX_Y	1200
+
+#define BOX_SIZE	64
+#define LINE_HEIGHT	16
+#define TEXT_LINES	8
+#define SCROLL_TICKS	16
+
+static uint32_t _pixels[SCREEN_MAX_X * SCREEN_MAX_Y];
+
+static int _xres, _yres;
+static int _bx, _by, _dx = 5, _dy = 3;
+static unsigned int _ticks = 0;
+static uint32_t _seed = 1;
+
+static void screen_getvmode(void *priv);
+static uint32_t screen_getsig(void *priv);
+
+static struct fbdevice screen_fb = {
+	.getvmode = &screen_getvmode,
+	.getsig = &screen_getsig,
+	.checksum_rect = checksum_rect_generic32,
+	.copy_pixels = copy_pixels_generic32,
+	.copy_checksum = copy_checksum_generic32,
+};
+
+static void screen_getvmode(void *priv)
+{
+	screen_fb.curmode.xres = _xres;
+	screen_fb.curmode.yres = _yres;
+	screen_fb.curmode.bytestride = 4;
+	screen_fb.pitch = _xres * 4;
+	screen_fb.curmode.format = FB_RGB888;
+	screen_fb.curmode.text = 0;
+}
+
+static uint32_t screen_getsig(void *priv)
+{
+	return (_xres << 16) | _yres;
+}
+
+static uint32_t _background(int x, int y)
+{
+	return ((x * 255 / _xres) << 16) | ((y * 255 / _yres) << 8) | 0x40;
+}
+
+static void _fill(int x0, int y0, int w, int h, int box)
+{
+	int x, y;
+
+	for (y = y0; y < y0 + h; y++)
+		for (x = x0; x < x0 + w; x++)
+			_pixels[y * _xres + x] = box ? 0x00FFFFFF : _background(x, y);
+}
+
+/* One new line of fake text: runs of "characters" in random colours. */
+static void _text_line(int y0)
+{
+	int x, y, c;
+	uint32_t colour = 0;
+
+	for (x = 0; x < _xres; x += 8)
+	{
+		_seed = _seed * 1103515245 + 12345;
+		c = (_seed >> 16) & 7;
+		colour = c ? ((c & 1) ? 0xAA0000 : 0) | ((c & 2) ? 0xAA00 : 0)
+		             | ((c & 4) ? 0xAA : 0)
+		           : 0;
+		for (y = y0; y < y0 + LINE_HEIGHT; y++)
+			for (c = x; c < x + 8 && c < _xres; c++)
+				_pixels[y * _xres + c] = colour;
+	}
+}
+
+void screen_tick()
+{
+	int top = _yres - TEXT_LINES * LINE_HEIGHT;
+
+	_ticks++;
+
+	_fill(_bx, _by, BOX_SIZE, BOX_SIZE, 0);
+	_bx += _dx;
+	_by += _dy;
+	if (_bx < 0 || _bx + BOX_SIZE > _xres)
+	{
+		_dx = -_dx;
+		_bx += 2 * _dx;
+	}
+	if (_by < 0 || _by + BOX_SIZE > top)
+	{
+		_dy = -_dy;
+		_by += 2 * _dy;
+	}
+	_fill(_bx, _by, BOX_SIZE, BOX_SIZE, 1);
+
+	if (_ticks % SCROLL_TICKS == 0)
+	{
+		memmove(&_pixels[top * _xres], &_pixels[(top + LINE_HEIGHT) * _xres],
+		        (TEXT_LINES - 1) * LINE_HEIGHT * _xres * 4);
+		_text_line(_yres - LINE_HEIGHT);
+	}
+}
+
+int screen_init(int xres, int yres)
+{
+	int i;
+
+	if (xres > SCREEN_MAX_X || yres > SCREEN_MAX_Y
+	    || xres < BOX_SIZE * 2 || yres < BOX_SIZE * 2 + TEXT_LINES * LINE_HEIGHT)
+	{
+		outputf("screen: can't do %dx%d", xres, yres);
+		return -1;
+	}
+
+	_xres = xres;
+	_yres = yres;
+	_fill(0, 0, _xres, _yres, 0);
+	for (i = 0; i < TEXT_LINES; i++)
+		_text_line(_yres - (i + 1) * LINE_HEIGHT);
+
+	generic_init();
+	screen_fb.fbaddr = (unsigned char *)_pixels;
+	fb = &screen_fb;
+	outputf("screen: %dx%d", _xres, _yres);
+	return 0;
+}
@@ -0,0 +1,26 @@
+/* sim.h
+ * Pieces of the simulator
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#ifndef _SIM_H
+#define _SIM_H
+
+/* Where the simulator keeps its stand-in for the legacy VGA hole: the SMM
+ * save state area, at the top of ASEG, and VGA text memory both live here,
+ * where NetWatch expects to find them. */
+#define SIM_LOWMEM_BASE	0xA0000
+#define SIM_LOWMEM_SIZE	0x20000
+
+extern int tap_init(const char *ifname, const unsigned char *hwaddr);
+extern int tap_loss;
+extern int screen_init(int xres, int yres);
+extern void screen_tick();
+extern void sim_stubs_init();
+
+#endif
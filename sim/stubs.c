@@ -0,0 +1,182 @@
+/* stubs.c
+ * Stand-ins for the hardware that the simulator does not have
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <io.h>
+#include <stdarg.h>
+#include <minilib.h>
+#include <output.h>
+#include <smram.h>
+#include <smi.h>
+#include <paging.h>
+#include <timer.h>
+
+#include "linux.h"
+#include "sim.h"
+
+/*** Logging ***/
+
+/* Everything goes to stderr, a line at a time.  The last LOGLEN lines are
+ * also kept, in the same shape as vga-overlay.c keeps them, for dump_log. */
+#define LOGLEN 96
+
+static char _logents[LOGLEN][41];
+static int _prodptr = 0;
+
+static void _log(const char *s)
+{
+	int len = strlen(s);
+
+	memset(_logents[_prodptr], 0, sizeof(_logents[0]));
+	memcpy(_logents[_prodptr], s, len < 40 ? len : 40);
+	_prodptr = (_prodptr + 1) % LOGLEN;
+
+	sys_write(2, s, len);
+	sys_write(2, "\n", 1);
+}
+
+void dolog(const char *s)
+{
+	_log(s);
+}
+
+void dologf(const char *fmt, ...)
+{
+	char buf[256];
+	va_list va;
+
+	va_start(va, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, va);
+	va_end(va);
+	_log(buf);
+}
+
+void (*output)(const char *s) = dolog;
+void (*outputf)(const char *s, ...) = dologf;
+
+void outlog()
+{
+}
+
+void vga_flush_imm(int enb)
+{
+}
+
+void strblit(char *src, int row, int col, int fill)
+{
+}
+
+void dump_log(char *target)
+{
+	int i;
+
+	for (i = 0; i < LOGLEN; i++)
+		memcpy(target + i * 41, _logents[(_prodptr + i) % LOGLEN], 41);
+}
+
+/*** Port I/O ***/
+
+unsigned long sim_in(unsigned short port, int size)
+{
+	outputf("sim: in%c %04x", size == 1 ? 'b' : size == 2 ? 'w' : 'l', port);
+	return 0xFFFFFFFF;
+}
+
+void sim_out(unsigned short port, unsigned long val, int size)
+{
+	outputf("sim: out%c %04x, %x", size == 1 ? 'b' : size == 2 ? 'w' : 'l',
+	        port, val);
+}
+
+/*** SMM ***/
+
+int smram_locked()
+{
+	return 0;
+}
+
+smram_state_t smram_save_state()
+{
+	return 0;
+}
+
+void smram_restore_state(smram_state_t state)
+{
+}
+
+int smram_aseg_set_state(int open)
+{
+	return 0;
+}
+
+int smram_tseg_set_state(int open)
+{
+	return 0;
+}
+
+/* The real one clears CR4.TSD first, which we may not do (and the kernel
+ * has done already). */
+unsigned long rdtsc()
+{
+	unsigned long tsc;
+
+	asm volatile("rdtsc" : "=a" (tsc) : : "edx");
+	return tsc;
+}
+
+/* There is no PM timer; measure the TSC against CLOCK_MONOTONIC instead. */
+void tsc_calibrate(void)
+{
+	struct sim_time start, now;
+	unsigned long tsc0;
+
+	sim_gettime(&start);
+	tsc0 = rdtsc();
+	do
+		sim_gettime(&now);
+	while (sim_time_diff_us(&now, &start) < 10000);
+	tsc_per_ms = (rdtsc() - tsc0) / 10;
+	if (tsc_per_ms == 0)
+		tsc_per_ms = 1;
+}
+
+/*** Memory ***/
+
+/* There is no host physical memory to look at; the GDB stub and the
+ * backtrace page find nothing mapped. */
+void *p2v(unsigned long phys)
+{
+	if (phys >= SIM_LOWMEM_BASE && phys < SIM_LOWMEM_BASE + SIM_LOWMEM_SIZE)
+		return (void *)phys;
+	return 0;
+}
+
+void *p2v64(uint64_t phys)
+{
+	if (phys >> 32)
+		return 0;
+	return p2v(phys);
+}
+
+unsigned long v2p(void *virt)
+{
+	return (unsigned long)virt;
+}
+
+void sim_stubs_init()
+{
+	void *p;
+
+	p = sys_mmap_fixed(SIM_LOWMEM_BASE, SIM_LOWMEM_SIZE);
+	if (p != (void *)SIM_LOWMEM_BASE)
+	{
+		outputf("sim: can't map %05x: %d", SIM_LOWMEM_BASE, (int)p);
+		sys_exit(1);
+	}
+}
@@ -0,0 +1,153 @@
+/* tap.c
+ * A simulated network card, backed by a Linux TAP device
+ * NetWatch system management mode administration console
+ *
+ * Copyright (c) 2008 Jacob Potter and Joshua Wise.  All rights reserved.
+ * This program is free software; you can redistribute and/or modify it under
+ * the terms found in the file LICENSE in the root of this source tree.
+ *
+ */
+
+#include <minilib.h>
+#include <output.h>
+#include "etherboot-compat.h"
+#include "net.h"
+#include "lwip/pbuf.h"
+#include "lwip/stats.h"
+
+#include "linux.h"
+#include "sim.h"
+
+/* Frames go straight to and from the TAP file descriptor, which is
+ * non-blocking: recv reads until there is nothing left (or the budget runs
+ * out), and a write that would block counts as a full transmit ring.  The
+ * kernel does all the checksumming there is to do, which is none, so lwIP
+ * keeps its software checksums, as on a 3c905.
+ *
+ * tap_loss drops that percentage of frames in each direction, to see how
+ * TCP recovers without needing netem on the host.
+ */
+
+#define TUNSETIFF	0x400454CA
+#define IFF_TAP		0x0002
+#define IFF_NO_PI	0x1000
+
+struct ifreq {
+	char name[16];
+	short flags;
+	char pad[14];
+};
+
+static struct nic _nic;
+static int _fd = -1;
+static unsigned char _frame[2048];
+
+int tap_loss = 0;
+static unsigned long _seed = 1;
+
+static int _lose()
+{
+	if (!tap_loss)
+		return 0;
+	_seed = _seed * 1103515245 + 12345;
+	return ((_seed >> 16) % 100) < tap_loss;
+}
+
+static int _recv(struct nic *nic, int budget)
+{
+	struct pbuf *p, *q;
+	int len, off, n = 0;
+
+	while (n < budget)
+	{
+		len = sys_read(_fd, _frame, sizeof(_frame));
+		if (len <= 0)
+			break;
+		n++;
+		if (_lose())
+			continue;
+
+		p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+		if (!p)
+		{
+			outputf("tap: out of memory for rx pbuf?");
+			LINK_STATS_INC(link.memerr);
+			continue;
+		}
+		for (q = p, off = 0; q; q = q->next)
+		{
+			memcpy(q->payload, _frame + off, q->len);
+			off += q->len;
+		}
+		eth_recv(nic, p);
+	}
+
+	return n;
+}
+
+/* The kernel's queue is too deep to ever look nearly full, so this
+ * only says whether there is anything at all. */
+static void _pending(struct nic *nic, int *rx, int *tx)
+{
+	*rx = sys_poll_in(_fd) > 0;
+	*tx = 0;
+}
+
+static int _transmit(struct nic *nic, struct pbuf *p)
+{
+	int len = 0, ret;
+
+	if (p->tot_len > sizeof(_frame))
+		return -1;
+
+	if (_lose())
+		return 0;
+
+	for (; p; p = p->next)
+	{
+		memcpy(_frame + len, p->payload, p->len);
+		len += p->len;
+	}
+
+	ret = sys_write(_fd, _frame, len);
+	if (ret == -SIM_EAGAIN)
+		return -1;
+	if (ret != len)
+		outputf("tap: write returned %d", ret);
+	return 0;
+}
+
+int tap_init(const char *ifname, const unsigned char *hwaddr)
+{
+	struct ifreq ifr;
+	int ret;
+
+	_fd = sys_open("/dev/net/tun", SIM_O_RDWR | SIM_O_NONBLOCK);
+	if (_fd < 0)
+	{
+		outputf("tap: can't open /dev/net/tun: %d", _fd);
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.name, ifname);
+	ifr.flags = IFF_TAP | IFF_NO_PI;
+	ret = sys_ioctl(_fd, TUNSETIFF, &ifr);
+	if (ret < 0)
+	{
+		outputf("tap: TUNSETIFF on %s failed: %d", ifname, ret);
+		return -1;
+	}
+
+	memcpy(_nic.hwaddr, hwaddr, 6);
+	_nic.recv = _recv;
+	_nic.transmit = _transmit;
+	_nic.pending = _pending;
+	_nic.rx_ring = _nic.tx_ring = 64;
+	eth_register(&_nic);
+
+	outputf("tap: attached to %s as %02x:%02x:%02x:%02x:%02x:%02x",
+	        ifr.name, hwaddr[0], hwaddr[1], hwaddr[2],
+	        hwaddr[3], hwaddr[4], hwaddr[5]);
+	return 0;
+}